@@ -0,0 +1,540 @@
+/************************************************************************
+ Description:
+ Load generator for server99: send datagrams to port (6540) of localhost
+ (ip = 127.0.0.1) at a given rate, receive the echoes back and measure the
+ round-trip latency of every packet.
+ Client and server are running on the same pc.
+
+ Execution flow:
+ 1. Start server99 in throughput mode (menu item t), or any other echo server
+ 2. Start client99, every thread opens its share of the M sockets
+ 3. Every thread sends at rate/threads packets per second, round-robin over
+    its sockets, and waits in poll for the echoes until the next send is due
+ 4. After the duration the client waits DRAIN_SECONDS more for late echoes,
+    then prints sent/received/lost and the latency percentiles, and ends
+
+ Target:
+ 1. measure throughput and tail latency of server99, so regressions show up
+    as a lower receive rate, more loss or a higher p99/p999.
+ 2. every packet carries a magic number, a sequence number and its send time
+    in microseconds, so the echo alone is enough to compute the round trip.
+ 3. the latencies go into a LatencyHistogram, a log-linear (HDR-style)
+    histogram: values below SUB_COUNT microseconds are exact, and above that
+    every power of 2 is split into SUB_COUNT/2 buckets, so the relative error
+    is below 2/SUB_COUNT at any magnitude. Every thread fills its own
+    histogram, they are added up at the end.
+ 4. with -t the M sockets are TCP connections to the TCP echo of server99
+    (server99 -T). An echo may come back in pieces, so every connection
+    reassembles its packet before the latency is taken. The sockets are
+    watched with poll, so M is bounded by the open file limit only.
+
+ Usage: client99 [-h host] [-p port] [-c sockets] [-n threads] [-r rate]
+                 [-s size] [-d seconds] [-t]
+************************************************************************/
+
+#include <ace/Log_Msg.h>
+
+#include <ace/OS_NS_time.h>
+#include <ace/OS_NS_string.h>
+#include <ace/OS_NS_stdlib.h>
+#include <ace/OS_NS_unistd.h>
+#include <ace/OS_NS_poll.h>
+#include <ace/SOCK_Dgram.h>
+#include <ace/SOCK_Stream.h>
+#include <ace/SOCK_Connector.h>
+#include <ace/INET_Addr.h>
+#include <ace/Task.h>
+#include <ace/Atomic_Op.h>
+#include <ace/Get_Opt.h>
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+
+static const char*       IP_ADDR  = "127.0.0.1";
+static const u_short     UDP_PORT = 6540;
+static const int         MAX_SOCKETS = 16384;    //per thread
+static const int         MAX_THREADS = 64;
+static const int         MAX_PACKET_SIZE = 8192;
+static const int         DRAIN_SECONDS = 1;
+static const ACE_UINT32  PACKET_MAGIC = 0x39394543;
+
+//head of every packet, the rest up to the packet size is padding
+struct PacketHeader
+{
+    ACE_UINT32 magic;
+    ACE_UINT32 seq;
+    ACE_UINT64 send_usec;
+};
+
+static ACE_UINT64 now_usec(void)
+{
+    ACE_Time_Value now = ACE_OS::gettimeofday();
+    return (ACE_UINT64)now.sec() * 1000000 + now.usec();
+}
+
+//////////////////////////////////////////////////////////////////////////
+
+//log-linear latency histogram in microseconds, HDR-style
+class LatencyHistogram
+{
+public:
+    static const int SUB_BITS = 7;
+    static const int SUB_COUNT = 1 << SUB_BITS;
+    static const int MAX_BITS = 40;   //about 12 days
+    static const int BUCKETS = SUB_COUNT + (MAX_BITS - SUB_BITS + 1) * (SUB_COUNT / 2);
+
+    LatencyHistogram();
+
+    void record(ACE_UINT64 usec);
+    void add(const LatencyHistogram& other);
+    ACE_UINT64 percentile(double percent) const;
+
+    ACE_UINT64 count(void) const { return count_; }
+    ACE_UINT64 min(void) const   { return count_ ? min_ : 0; }
+    ACE_UINT64 max(void) const   { return max_; }
+    double mean(void) const      { return count_ ? (double)sum_ / count_ : 0; }
+
+private:
+    static int index_of(ACE_UINT64 usec);
+    static ACE_UINT64 value_of(int index);
+
+    ACE_UINT64 counts_[BUCKETS];
+    ACE_UINT64 count_;
+    ACE_UINT64 sum_;
+    ACE_UINT64 min_;
+    ACE_UINT64 max_;
+};
+
+LatencyHistogram::LatencyHistogram()
+{
+    for (int i = 0; i < BUCKETS; i++)
+        counts_[i] = 0;
+    count_ = 0;
+    sum_ = 0;
+    min_ = ~(ACE_UINT64)0;
+    max_ = 0;
+}
+
+//values below SUB_COUNT have a bucket each; above, the top SUB_BITS bits of the
+//value select one of the SUB_COUNT/2 buckets of its power of 2
+int LatencyHistogram::index_of(ACE_UINT64 usec)
+{
+    if (usec < (ACE_UINT64)SUB_COUNT)
+        return (int)usec;
+
+    int msb = 0;
+    for (ACE_UINT64 v = usec; v > 1; v >>= 1)
+        ++msb;
+    if (msb > MAX_BITS)
+        return BUCKETS - 1;
+
+    int shift = msb - SUB_BITS + 1;
+    int sub = (int)(usec >> shift);  //SUB_COUNT/2 .. SUB_COUNT-1
+    return SUB_COUNT + (shift - 1) * (SUB_COUNT / 2) + (sub - SUB_COUNT / 2);
+}
+
+//highest value which falls into the bucket
+ACE_UINT64 LatencyHistogram::value_of(int index)
+{
+    if (index < SUB_COUNT)
+        return index;
+
+    int shift = (index - SUB_COUNT) / (SUB_COUNT / 2) + 1;
+    ACE_UINT64 sub = (index - SUB_COUNT) % (SUB_COUNT / 2) + SUB_COUNT / 2;
+    return ((sub + 1) << shift) - 1;
+}
+
+void LatencyHistogram::record(ACE_UINT64 usec)
+{
+    ++counts_[index_of(usec)];
+    ++count_;
+    sum_ += usec;
+    if (usec < min_)
+        min_ = usec;
+    if (usec > max_)
+        max_ = usec;
+}
+
+void LatencyHistogram::add(const LatencyHistogram& other)
+{
+    for (int i = 0; i < BUCKETS; i++)
+        counts_[i] += other.counts_[i];
+    count_ += other.count_;
+    sum_ += other.sum_;
+    if (other.count_ && other.min_ < min_)
+        min_ = other.min_;
+    if (other.max_ > max_)
+        max_ = other.max_;
+}
+
+ACE_UINT64 LatencyHistogram::percentile(double percent) const
+{
+    if (0 == count_)
+        return 0;
+
+    ACE_UINT64 rank = (ACE_UINT64)(percent / 100.0 * count_ + 0.5);
+    if (rank < 1)
+        rank = 1;
+
+    ACE_UINT64 seen = 0;
+    for (int i = 0; i < BUCKETS; i++)
+    {
+        seen += counts_[i];
+        if (seen >= rank)
+            return value_of(i) < max_ ? value_of(i) : max_;
+    }
+    return max_;
+}
+
+//////////////////////////////////////////////////////////////////////////
+
+struct ClientOptions
+{
+    const char* host;
+    u_short port;
+    int sockets;   //M, over all threads
+    int threads;
+    int rate;      //packets per second, over all threads
+    int size;      //bytes per packet
+    int seconds;
+    int tcp;       //1: TCP connections instead of datagram sockets
+};
+
+class ClientTask: public ACE_Task<ACE_NULL_SYNCH>
+{
+public:
+    ClientTask();
+
+    int open(void *);
+    virtual int svc();
+
+    void report(void) const;
+
+private:
+    int receive(ACE_SOCK_Dgram& sock, char* buf, LatencyHistogram& histogram, int& received);
+    int receive_stream(ACE_SOCK_Stream& stream, char* packet, int& filled, LatencyHistogram& histogram, int& received);
+
+    ClientOptions options_;
+    ACE_INET_Addr server_addr_;
+    ACE_Atomic_Op<ACE_Thread_Mutex, int> next_index_;
+
+    //written by every thread when it leaves svc()
+    int thread_sent_[MAX_THREADS];
+    int thread_received_[MAX_THREADS];
+    LatencyHistogram thread_histogram_[MAX_THREADS];
+    ACE_Time_Value thread_elapsed_[MAX_THREADS];
+};
+
+typedef ACE_Singleton <ClientTask, ACE_SYNCH_MUTEX> clienttask;
+
+ClientTask::ClientTask()
+{
+    next_index_ = 0;
+    for (int i = 0; i < MAX_THREADS; i++)
+    {
+        thread_sent_[i] = 0;
+        thread_received_[i] = 0;
+    }
+}
+
+int ClientTask::open(void *p)
+{
+    options_ = *(ClientOptions*)p;
+    if (options_.threads < 1)
+        options_.threads = 1;
+    if (options_.threads > MAX_THREADS)
+        options_.threads = MAX_THREADS;
+    if (options_.sockets < options_.threads)
+        options_.sockets = options_.threads;
+    if (options_.sockets > options_.threads * MAX_SOCKETS)
+        options_.sockets = options_.threads * MAX_SOCKETS;
+    if (options_.size < (int)sizeof(PacketHeader))
+        options_.size = sizeof(PacketHeader);
+    if (options_.size > MAX_PACKET_SIZE)
+        options_.size = MAX_PACKET_SIZE;
+    if (options_.rate < options_.threads)
+        options_.rate = options_.threads;
+
+    if (server_addr_.set(options_.port, options_.host) == -1)
+        ACE_ERROR_RETURN((LM_ERROR, "%p\n", options_.host), -1);
+
+    ACE_DEBUG ((LM_INFO, "(%t) client: %s %s:%d, %d sockets, %d threads, %d pkts/s, %d bytes, %d seconds\n",
+        options_.tcp ? "tcp" : "udp", options_.host, options_.port, options_.sockets, options_.threads, 
+        options_.rate, options_.size, options_.seconds));
+
+    if(this->activate(THR_NEW_LWP, options_.threads) == -1)
+    {
+        ACE_DEBUG((LM_ERROR, "activate ClientTask failed"));
+        return -1;
+    }
+
+    return 0;
+}
+
+int ClientTask::svc()
+{
+    const int index = next_index_++;
+
+    //this thread's share of the sockets and of the rate
+    int count = options_.sockets / options_.threads + (index < options_.sockets % options_.threads ? 1 : 0);
+    int rate = options_.rate / options_.threads;
+
+    //udp: socks, tcp: streams, and the packet being reassembled per connection
+    ACE_SOCK_Dgram* socks = NULL;
+    ACE_SOCK_Stream* streams = NULL;
+    char* partial = NULL;
+    int* filled = NULL;
+    if (options_.tcp)
+    {
+        streams = new ACE_SOCK_Stream[count];
+        partial = new char[(size_t)count * options_.size];
+        filled = new int[count];
+    }
+    else
+        socks = new ACE_SOCK_Dgram[count];
+
+    struct pollfd* fds = new struct pollfd[count];
+    ACE_SOCK_Connector connector;
+    for (int i = 0; i < count; i++)
+    {
+        int result;
+        if (options_.tcp)
+        {
+            result = connector.connect(streams[i], server_addr_);
+            filled[i] = 0;
+        }
+        else
+            result = socks[i].open(ACE_INET_Addr((u_short)0));
+        if (result == -1)
+        {
+            ACE_ERROR((LM_ERROR, "%p\n", "client: open socket failed"));
+            count = i;
+            break;
+        }
+
+        ACE_SOCK& sock = options_.tcp ? (ACE_SOCK&)streams[i] : (ACE_SOCK&)socks[i];
+        sock.enable(ACE_NONBLOCK);
+        fds[i].fd = sock.get_handle();
+        fds[i].events = POLLIN;
+        fds[i].revents = 0;
+    }
+
+    char* buf = new char[MAX_PACKET_SIZE];
+    ACE_OS::memset(buf, 'x', MAX_PACKET_SIZE);
+    PacketHeader* header = (PacketHeader*)buf;
+    header->magic = PACKET_MAGIC;
+
+    LatencyHistogram& histogram = thread_histogram_[index];
+    int sent = 0;
+    int received = 0;
+    int next_sock = 0;
+
+    ACE_UINT64 interval = 1000000 / (rate > 0 ? rate : 1);
+    if (0 == interval)
+        interval = 1;
+    const ACE_UINT64 start = now_usec();
+    const ACE_UINT64 stop = start + (ACE_UINT64)options_.seconds * 1000000;
+    const ACE_UINT64 drain = stop + (ACE_UINT64)DRAIN_SECONDS * 1000000;
+    ACE_UINT64 next_send = start;
+
+    while (count > 0)
+    {
+        ACE_UINT64 now = now_usec();
+        if (now >= drain)
+            break;
+
+        //open loop: send what is due, even if echoes are missing
+        while (now < stop && next_send <= now)
+        {
+            header->seq = sent;
+            header->send_usec = now_usec();
+            if (options_.tcp)
+            {
+                //send_n waits if the connection is flow controlled, a TCP packet is never cut
+                if (fds[next_sock].fd >= 0 && streams[next_sock].send_n(buf, options_.size) == options_.size)
+                    ++sent;
+            }
+            else if (socks[next_sock].send(buf, options_.size, server_addr_) == options_.size)
+                ++sent;
+            if (++next_sock == count)
+                next_sock = 0;
+            next_send += interval;
+        }
+
+        //wait for echoes until the next send is due
+        ACE_UINT64 wait = now < stop ? (next_send > now ? next_send - now : 0) : drain - now;
+        ACE_Time_Value timeout((long)(wait / 1000000), (long)(wait % 1000000));
+        int ready = ACE_OS::poll(fds, count, &timeout);
+        if (ready == -1 && errno != EINTR)
+        {
+            ACE_ERROR((LM_ERROR, "%p\n", "client: poll failed"));
+            break;
+        }
+
+        for (int i = 0; ready > 0 && i < count; i++)
+        {
+            if (0 == fds[i].revents)
+                continue;
+            --ready;
+
+            if (!options_.tcp)
+                receive(socks[i], buf, histogram, received);
+            else if (receive_stream(streams[i], partial + (size_t)i * options_.size, filled[i], histogram, received) == -1)
+                fds[i].fd = -1;  //closed by the server, poll skips negative handles
+        }
+
+        if (now >= stop && received >= sent)
+            break;  //everything is back, no need to wait for the drain time
+    }
+
+    thread_sent_[index] = sent;
+    thread_received_[index] = received;
+    ACE_UINT64 elapsed = (stop < now_usec() ? stop : now_usec()) - start;
+    thread_elapsed_[index] = ACE_Time_Value((long)(elapsed / 1000000), (long)(elapsed % 1000000));
+
+    for (int i = 0; i < count; i++)
+    {
+        if (options_.tcp)
+            streams[i].close();
+        else
+            socks[i].close();
+    }
+    delete [] socks;
+    delete [] streams;
+    delete [] partial;
+    delete [] filled;
+    delete [] fds;
+    delete [] buf;
+    return 0;
+}
+
+//drain one non-blocking socket, the send buffer is reused for receiving
+int ClientTask::receive(ACE_SOCK_Dgram& sock, char* buf, LatencyHistogram& histogram, int& received)
+{
+    ACE_INET_Addr from;
+    for (;;)
+    {
+        ssize_t n = sock.recv(buf, MAX_PACKET_SIZE, from);
+        if (n == -1)
+            return (EWOULDBLOCK == errno || EAGAIN == errno) ? 0 : -1;
+
+        PacketHeader* header = (PacketHeader*)buf;
+        if (n < (ssize_t)sizeof(PacketHeader) || header->magic != PACKET_MAGIC)
+            continue;
+
+        ACE_UINT64 now = now_usec();
+        histogram.record(now > header->send_usec ? now - header->send_usec : 0);
+        ++received;
+    }
+}
+
+//read what the connection has, an echo may come back in any number of pieces
+int ClientTask::receive_stream(ACE_SOCK_Stream& stream, char* packet, int& filled, LatencyHistogram& histogram, int& received)
+{
+    for (;;)
+    {
+        ssize_t n = stream.recv(packet + filled, options_.size - filled);
+        if (n == 0)
+            return -1;
+        if (n == -1)
+            return (EWOULDBLOCK == errno || EAGAIN == errno) ? 0 : -1;
+
+        filled += (int)n;
+        if (filled < options_.size)
+            continue;
+        filled = 0;
+
+        PacketHeader* header = (PacketHeader*)packet;
+        if (header->magic != PACKET_MAGIC)
+            continue;
+
+        ACE_UINT64 now = now_usec();
+        histogram.record(now > header->send_usec ? now - header->send_usec : 0);
+        ++received;
+    }
+}
+
+void ClientTask::report(void) const
+{
+    LatencyHistogram total;
+    int sent = 0;
+    int received = 0;
+    double seconds = 0;
+    for (int i = 0; i < options_.threads; i++)
+    {
+        total.add(thread_histogram_[i]);
+        sent += thread_sent_[i];
+        received += thread_received_[i];
+        if (thread_elapsed_[i].msec() / 1000.0 > seconds)
+            seconds = thread_elapsed_[i].msec() / 1000.0;
+    }
+
+    int lost = sent > received ? sent - received : 0;
+    ACE_OS::printf("sent     : %d packets, %.0f pkts/s\n", sent, seconds > 0 ? sent / seconds : 0);
+    ACE_OS::printf("received : %d packets, %.0f pkts/s\n", received, seconds > 0 ? received / seconds : 0);
+    ACE_OS::printf("lost     : %d packets, %.3f%%\n", lost, sent > 0 ? 100.0 * lost / sent : 0);
+    ACE_OS::printf("latency  : min %lu, mean %.1f, p50 %lu, p90 %lu, p99 %lu, p999 %lu, max %lu usec\n",
+        (unsigned long)total.min(), total.mean(),
+        (unsigned long)total.percentile(50), (unsigned long)total.percentile(90),
+        (unsigned long)total.percentile(99), (unsigned long)total.percentile(99.9),
+        (unsigned long)total.max());
+}
+
+//////////////////////////////////////////////////////////////////////////
+
+int ACE_TMAIN (int argc, ACE_TCHAR* argv[])
+{
+    ClientOptions options;
+    options.host = IP_ADDR;
+    options.port = UDP_PORT;
+    options.sockets = 1;
+    options.threads = 1;
+    options.rate = 10000;
+    options.size = 64;
+    options.seconds = 10;
+    options.tcp = 0;
+
+    ACE_Get_Opt get_opt(argc, argv, ACE_TEXT("h:p:c:n:r:s:d:t"));
+    int c;
+    while ((c = get_opt()) != -1)
+    {
+        switch (c)
+        {
+        case 'h':
+            options.host = get_opt.opt_arg();
+            break;
+        case 'p':
+            options.port = (u_short)ACE_OS::atoi(get_opt.opt_arg());
+            break;
+        case 'c':
+            options.sockets = ACE_OS::atoi(get_opt.opt_arg());
+            break;
+        case 'n':
+            options.threads = ACE_OS::atoi(get_opt.opt_arg());
+            break;
+        case 'r':
+            options.rate = ACE_OS::atoi(get_opt.opt_arg());
+            break;
+        case 's':
+            options.size = ACE_OS::atoi(get_opt.opt_arg());
+            break;
+        case 'd':
+            options.seconds = ACE_OS::atoi(get_opt.opt_arg());
+            break;
+        case 't':
+            options.tcp = 1;
+            break;
+        default:
+            ACE_ERROR_RETURN((LM_ERROR, "usage: %s [-h host] [-p port] [-c sockets] [-n threads] [-r rate] [-s size] [-d seconds] [-t]\n",
+                argv[0]), -1);
+        }
+    }
+
+    if (clienttask::instance()->open(&options) == -1)
+        return -1;
+    ACE_Thread_Manager::instance ()->wait ();
+    clienttask::instance()->report();
+
+    return 0;
+}
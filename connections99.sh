@@ -0,0 +1,57 @@
+# compare the UDP and the TCP echo of server99 at 1k and 10k concurrent
+# sockets, measured by client99 at the same packet rate.
+# server99 and client99 have to be built in this directory. 10k sockets
+# need the epoll reactor (select takes FD_SETSIZE handles per thread) and
+# an open file limit above 10k for both processes. The summary goes to
+# connections99_linux.txt, to be kept like the resultN files of the
+# container examples.
+# settings: RATE (pkts/s), DURATION (seconds), PORT, THREADS (both sides)
+
+RATE=${RATE:-50000}
+DURATION=${DURATION:-10}
+PORT=${PORT:-6540}
+THREADS=${THREADS:-4}
+
+RESULT=connections99_linux.txt
+
+# the 10k run needs a socket per connection in each process, a lower limit
+# would show up as loss and make the table meaningless
+ulimit -n 65536 2>/dev/null
+if [ `ulimit -n` != unlimited ] && [ `ulimit -n` -lt 10100 ]
+then
+    echo "open file limit is `ulimit -n`, 10k connections need more. bye."
+    exit 1
+fi
+
+run()
+{
+    name=$1
+    connections=$2
+    shift 2
+    echo "$name running ..."
+    ./server99 -D -p $PORT -d $((DURATION + 5)) -r epoll -n $THREADS -T $connections > server_$name.txt 2>&1 &
+    sleep 1
+    ./client99 -p $PORT -n $THREADS -c $connections -r $RATE -d $DURATION "$@" > client_$name.txt 2>&1
+    wait
+    echo -e "    result is in client_$name.txt and server_$name.txt\n"
+}
+
+echo -e "start to compare UDP and TCP\n"
+
+for connections in 1000 10000
+do
+    run udp_$connections $connections
+    run tcp_$connections $connections -t
+done
+
+echo "server99 UDP vs TCP, `date`, `uname -sr`, `nproc` cpus, `grep -m 1 "model name" /proc/cpuinfo | cut -d: -f2`" > $RESULT
+echo "rate $RATE pkts/s, $DURATION seconds, $THREADS threads, open files `ulimit -n`" >> $RESULT
+for name in udp_1000 tcp_1000 udp_10000 tcp_10000
+do
+    echo "$name:" >> $RESULT
+    grep -E "received|lost|latency" client_$name.txt >> $RESULT
+    grep -E "tcp:|total: [0-9]+ threads" server_$name.txt >> $RESULT
+done
+cat $RESULT
+
+echo "done. bye."
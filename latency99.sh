@@ -0,0 +1,43 @@
+# compare the round-trip latency of server99 with the blocking reactor wait
+# and with busy polling (-P/-C), measured by client99 at the same load.
+# server99 and client99 have to be built in this directory (see smoke99.sh).
+# the summary goes to latency99_linux.txt, to be kept like the resultN files
+# of the container examples.
+# settings: RATE (pkts/s), DURATION (seconds), PORT, SPIN (usec for -P), CPU (for -C)
+
+RATE=${RATE:-20000}
+DURATION=${DURATION:-10}
+PORT=${PORT:-6540}
+SPIN=${SPIN:-200}
+CPU=${CPU:-1}
+
+RESULT=latency99_linux.txt
+
+run()
+{
+    name=$1
+    shift
+    echo "server99 $* running ..."
+    ./server99 -D -p $PORT -d $((DURATION + 3)) "$@" > server_$name.txt 2>&1 &
+    sleep 1
+    ./client99 -p $PORT -r $RATE -d $DURATION > latency_$name.txt 2>&1
+    wait
+    echo -e "    result is in latency_$name.txt and server_$name.txt\n"
+}
+
+echo -e "start to compare the blocking and the busy-poll path\n"
+
+run blocking
+run busypoll -P $SPIN -C $CPU
+
+echo "server99 latency, `date`, `uname -sr`, `nproc` cpus, `grep -m 1 "model name" /proc/cpuinfo | cut -d: -f2`" > $RESULT
+echo "rate $RATE pkts/s, $DURATION seconds, spin $SPIN usec on cpu $CPU" >> $RESULT
+for name in blocking busypoll
+do
+    echo "$name:" >> $RESULT
+    grep -E "received|lost|latency" latency_$name.txt >> $RESULT
+    grep -E "total: [0-9]+ threads" server_$name.txt >> $RESULT
+done
+cat $RESULT
+
+echo "done. bye."
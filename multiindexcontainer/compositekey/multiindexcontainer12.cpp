@@ -165,24 +165,14 @@ void print_container(const MultiIndexContainer& container)
     std::copy(indexSet.begin(), indexSet.end(), std::ostream_iterator<value_type>(cout));
 }
 
+//the elements are deleted in one pass, then all the nodes are dropped at once:
+//clear() does not unlink them one by one, so no index is rebalanced
 template<typename MultiIndexContainer>
 void free_container(MultiIndexContainer& container)
 {
-    typedef typename MultiIndexContainer::value_type value_type;
-
-    while (!container.empty())
-    {
-        typename MultiIndexContainer::iterator iter = container.begin();
-        if (NULL == (*iter))
-        {
-            container.erase(iter);
-            continue;
-        }
-
-        value_type pobj = *iter;
-        container.erase(iter);
-        delete pobj;
-    }
+    for (typename MultiIndexContainer::iterator iter = container.begin(); iter != container.end(); ++iter)
+        delete *iter;
+    container.clear();
 }
 
 void test1()
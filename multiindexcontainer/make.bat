@@ -23,6 +23,38 @@ echo making multiindexcontainer5.cpp ...
 cl /wd 4530 /nologo multiindexcontainer5.cpp
 echo.
 
+echo making multiindexcontainer6.cpp ...
+cl /wd 4530 /EHsc /O2 /nologo multiindexcontainer6.cpp
+echo.
+
+echo making multiindexcontainer7.cpp ...
+cl /wd 4530 /EHsc /O2 /nologo multiindexcontainer7.cpp
+echo.
+
+echo making multiindexcontainer8.cpp ...
+cl /wd 4530 /EHsc /O2 /nologo multiindexcontainer8.cpp
+echo.
+
+echo making multiindexcontainer9.cpp ...
+cl /wd 4530 /EHsc /O2 /nologo multiindexcontainer9.cpp
+echo.
+
+echo making multiindexcontainer10.cpp ...
+cl /wd 4530 /EHsc /O2 /nologo multiindexcontainer10.cpp
+echo.
+
+echo making multiindexcontainer15.cpp ...
+cl /wd 4530 /EHsc /O2 /nologo multiindexcontainer15.cpp
+echo.
+
+echo making multiindexcontainer16.cpp ...
+cl /wd 4530 /EHsc /O2 /nologo multiindexcontainer16.cpp
+echo.
+
+echo making multiindexcontainer17.cpp ...
+cl /wd 4530 /EHsc /O2 /nologo multiindexcontainer17.cpp
+echo.
+
 
 del *.obj
 
@@ -0,0 +1,464 @@
+/**
+ * boost multi index container test: ArenaStorage against HeapStorage, insert and free
+ * platform: win32, visual studio 2005/2010; Linux, gcc4.1.2
+ * usage: multiindexcontainer10 [records]
+ */
+
+#include <iostream>
+#include <vector>
+#include <algorithm>
+#include <new>
+#include <cstdlib>
+#include "boost/multi_index_container.hpp"
+#include "boost/multi_index/member.hpp"
+#include "boost/multi_index/ordered_index.hpp"
+#include "boost/mpl/size.hpp"
+#include "boost/date_time/posix_time/posix_time.hpp"
+
+using namespace std;
+using namespace boost::multi_index;
+using boost::multi_index_container;
+
+//define multiple index
+typedef struct MyIndex
+{
+    int x;
+    int y;
+    int z;
+
+    MyIndex(int ax = 0, int ay = 0, int az = 0): x(ax), y(ay), z(az){}
+}MyIndex;
+
+bool operator<(const MyIndex& lhs, const MyIndex& rhs)
+{
+    if (lhs.x < rhs.x) return true;
+    else if (lhs.x > rhs.x) return false;
+    else if (lhs.y < rhs.y) return true;
+    else if (lhs.y > rhs.y) return false;
+    else if (lhs.z < rhs.z) return true;
+    else if (lhs.z > rhs.z) return false;
+    else return false;
+}
+
+//define object to be indexed; unlike MyTest it prints nothing when destructed
+class MyRecord
+{
+public:
+    MyIndex myIndex;
+    int a;
+    int b;
+
+    MyRecord(int x, int y, int z, int aa, int ab): myIndex(x, y, z), a(aa), b(ab){}
+
+private:
+    MyRecord(const MyRecord&);
+    MyRecord& operator= (const MyRecord&);
+};
+
+//memory handed out from large blocks, in order, and given back all at once:
+//nothing is freed on its own, what is allocated together sits together
+class MonotonicArena
+{
+public:
+    enum { BLOCK_SIZE = 1 << 20, ALIGNMENT = 16 };
+
+    MonotonicArena(): next(NULL), left(0){}
+    ~MonotonicArena() { release(); }
+
+    void* allocate(size_t size)
+    {
+        size = (size + ALIGNMENT - 1) & ~(size_t)(ALIGNMENT - 1);
+        if (size > left)
+        {
+            //a large request gets a block of its own, the current one stays open
+            if (size > BLOCK_SIZE / 4)
+            {
+                blocks.push_back(static_cast<char*>(::operator new(size)));
+                return blocks.back();
+            }
+            blocks.push_back(static_cast<char*>(::operator new(BLOCK_SIZE)));
+            next = blocks.back();
+            left = BLOCK_SIZE;
+        }
+
+        void* memory = next;
+        next += size;
+        left -= size;
+        return memory;
+    }
+
+    //one call per block, however many objects were allocated
+    void release()
+    {
+        for (size_t i = 0; i < blocks.size(); i++)
+            ::operator delete(blocks[i]);
+        blocks.clear();
+        next = NULL;
+        left = 0;
+    }
+
+private:
+    MonotonicArena(const MonotonicArena&);
+    MonotonicArena& operator= (const MonotonicArena&);
+
+    std::vector<char*> blocks;
+    char* next;
+    size_t left;
+};
+
+//new (arena) MyTest(...): the object lives until the arena is released, its destructor is not run
+inline void* operator new(size_t size, MonotonicArena& arena)
+{
+    return arena.allocate(size);
+}
+
+inline void operator delete(void*, MonotonicArena&)
+{
+}
+
+//an allocator for the nodes of a multi_index_container, from an arena
+template <class T>
+class arena_allocator
+{
+public:
+    typedef T value_type;
+    typedef T* pointer;
+    typedef const T* const_pointer;
+    typedef T& reference;
+    typedef const T& const_reference;
+    typedef size_t size_type;
+    typedef ptrdiff_t difference_type;
+
+    template <class U>
+    struct rebind
+    {
+        typedef arena_allocator<U> other;
+    };
+
+    arena_allocator(MonotonicArena& aarena): arena(&aarena){}
+    template <class U>
+    arena_allocator(const arena_allocator<U>& other): arena(other.arena){}
+
+    pointer address(reference value) const { return &value; }
+    const_pointer address(const_reference value) const { return &value; }
+    size_type max_size() const { return ~(size_type)0 / sizeof(T); }
+
+    pointer allocate(size_type count, const void* = 0)
+    {
+        return static_cast<pointer>(arena->allocate(count * sizeof(T)));
+    }
+
+    void deallocate(pointer, size_type)
+    {
+    }
+
+    void construct(pointer p, const T& value) { new (static_cast<void*>(p)) T(value); }
+    void destroy(pointer p) { p->~T(); }
+
+    MonotonicArena* arena;
+};
+
+template <class T, class U>
+bool operator==(const arena_allocator<T>& lhs, const arena_allocator<U>& rhs)
+{
+    return lhs.arena == rhs.arena;
+}
+
+template <class T, class U>
+bool operator!=(const arena_allocator<T>& lhs, const arena_allocator<U>& rhs)
+{
+    return lhs.arena != rhs.arena;
+}
+
+//where MyContainer keeps its container, nodes and elements. HeapStorage is
+//the usual: elements from new, nodes from the container's allocator, and
+//free() erases and deletes the elements one by one
+struct HeapStorage
+{
+    enum { OWNS_ELEMENTS = false };
+
+    template <class Container_T>
+    Container_T* create()
+    {
+        return new Container_T();
+    }
+
+    template <class Container_T>
+    void clear(Container_T& container)
+    {
+        container.clear();
+    }
+
+    template <class Container_T>
+    void destroy(Container_T* container)
+    {
+        delete container;
+    }
+};
+
+//ArenaStorage puts the nodes, and the elements made with new (arena), in one
+//arena. The container type must use arena_allocator. free() releases the
+//arena and starts an empty container: no element is visited, and no
+//destructor of an element is run
+struct ArenaStorage
+{
+    enum { OWNS_ELEMENTS = true };
+
+    MonotonicArena arena;
+
+    template <class Container_T>
+    Container_T* create()
+    {
+        return new (::operator new(sizeof(Container_T))) Container_T(
+            typename Container_T::ctor_args_list(), typename Container_T::allocator_type(arena));
+    }
+
+    //the old container is dropped without its destructor, all its memory is in the arena
+    template <class Container_T>
+    void clear(Container_T& container)
+    {
+        arena.release();
+        new (&container) Container_T(typename Container_T::ctor_args_list(), typename Container_T::allocator_type(arena));
+    }
+
+    template <class Container_T>
+    void destroy(Container_T* container)
+    {
+        arena.release();
+        ::operator delete(container);
+    }
+};
+
+//the disposer of free(): delete what an element points to
+struct delete_disposer
+{
+    template <class T>
+    void operator()(T* pobj) const
+    {
+        delete pobj;
+    }
+};
+
+//the MyContainer of multiindexcontainer5, with what the benchmark needs
+template <class MultiIndexContainer_T, class Tag_T, class Data_T, class Index_T, class Storage_T = HeapStorage>
+class MyContainer
+{
+    Storage_T theStorage;
+    MultiIndexContainer_T& theContainer;
+
+public:
+    MyContainer(): theContainer(*theStorage.template create<MultiIndexContainer_T>()){}
+    ~MyContainer() { theStorage.destroy(&theContainer); }
+
+    Storage_T& get_storage() { return theStorage; }
+    size_t size() const { return theContainer.size(); }
+    void insert(Data_T* data);
+    bool find(const Index_T& index);
+    template <class Disposer_T>
+    void clear_and_dispose(Disposer_T dispose);
+    void free();
+    void erase_free();
+};
+
+template <class MultiIndexContainer_T, class Tag_T, class Data_T, class Index_T, class Storage_T>
+void MyContainer<MultiIndexContainer_T, Tag_T, Data_T, Index_T, Storage_T>::insert(Data_T* data)
+{
+    theContainer.insert(data);
+}
+
+template <class MultiIndexContainer_T, class Tag_T, class Data_T, class Index_T, class Storage_T>
+bool MyContainer<MultiIndexContainer_T, Tag_T, Data_T, Index_T, Storage_T>::find(const Index_T& index)
+{
+    const typename boost::multi_index::index<MultiIndexContainer_T, Tag_T>::type& indexSet = get<Tag_T>(theContainer);
+    return indexSet.find(index) != indexSet.end();
+}
+
+//empty the container, passing each element to dispose, in the order of the
+//first index. With more than one index erase(begin()) in a loop would unlink
+//each node from the others at some place in the middle and rebalance them, so
+//the elements are visited once and then all the nodes are dropped together:
+//clear() frees them without unlinking. With a single index taking out the
+//first element is cheap and reads each node once instead of twice, so there
+//the loop stays
+template <class MultiIndexContainer_T, class Tag_T, class Data_T, class Index_T, class Storage_T>
+template <class Disposer_T>
+void MyContainer<MultiIndexContainer_T, Tag_T, Data_T, Index_T, Storage_T>::clear_and_dispose(Disposer_T dispose)
+{
+    typedef typename MultiIndexContainer_T::value_type value_type;
+
+    if (1 == boost::mpl::size<typename MultiIndexContainer_T::index_type_list>::value)
+    {
+        while (!theContainer.empty())
+        {
+            typename MultiIndexContainer_T::iterator iter = theContainer.begin();
+            value_type element = *iter;
+            theContainer.erase(iter);
+            dispose(element);
+        }
+    }
+    else
+    {
+        for (typename MultiIndexContainer_T::iterator iter = theContainer.begin(); iter != theContainer.end(); ++iter)
+            dispose(*iter);
+    }
+    theStorage.clear(theContainer);
+}
+
+//the elements of an arena go with it, they are not visited
+template <class MultiIndexContainer_T, class Tag_T, class Data_T, class Index_T, class Storage_T>
+void MyContainer<MultiIndexContainer_T, Tag_T, Data_T, Index_T, Storage_T>::free()
+{
+    if (Storage_T::OWNS_ELEMENTS)
+    {
+        theStorage.clear(theContainer);
+        return;
+    }
+
+    clear_and_dispose(delete_disposer());
+}
+
+//what free() did before clear_and_dispose, for comparison with more than one index
+template <class MultiIndexContainer_T, class Tag_T, class Data_T, class Index_T, class Storage_T>
+void MyContainer<MultiIndexContainer_T, Tag_T, Data_T, Index_T, Storage_T>::erase_free()
+{
+    while (!theContainer.empty())
+    {
+        typename MultiIndexContainer_T::iterator iter = theContainer.begin();
+        Data_T* pobj = *iter;
+        theContainer.erase(iter);
+        delete pobj;
+    }
+}
+
+//define index tag, multi_index_containers, and their types
+struct MyIndexTag{};
+typedef multi_index_container<
+    MyRecord*,
+    indexed_by<
+        ordered_unique<
+            tag<MyIndexTag>,  member<MyRecord, MyIndex, &MyRecord::myIndex> > >
+>MyContainer_T;
+
+typedef multi_index_container<
+    MyRecord*,
+    indexed_by<
+        ordered_unique<
+            tag<MyIndexTag>,  member<MyRecord, MyIndex, &MyRecord::myIndex> > >,
+    arena_allocator<MyRecord*>
+>MyArenaContainer_T;
+
+//a second index, in an order which has nothing to do with the first one
+struct MyDataTag{};
+typedef multi_index_container<
+    MyRecord*,
+    indexed_by<
+        ordered_unique<
+            tag<MyIndexTag>,  member<MyRecord, MyIndex, &MyRecord::myIndex> >,
+        ordered_non_unique<
+            tag<MyDataTag>,  member<MyRecord, int, &MyRecord::a> > >
+>MyTwoIndexContainer_T;
+
+typedef MyContainer<MyContainer_T, MyIndexTag, MyRecord, MyIndex> MyHeapRecords;
+typedef MyContainer<MyTwoIndexContainer_T, MyIndexTag, MyRecord, MyIndex> MyTwoIndexRecords;
+typedef MyContainer<MyArenaContainer_T, MyIndexTag, MyRecord, MyIndex, ArenaStorage> MyArenaRecords;
+
+//milliseconds since start
+long elapsed(const boost::posix_time::ptime& start)
+{
+    return (long)(boost::posix_time::microsec_clock::universal_time() - start).total_milliseconds();
+}
+
+//the same random order on every platform
+unsigned next_random(unsigned& seed)
+{
+    seed = seed * 1103515245 + 12345;
+    return (seed >> 8) & 0xffffff;
+}
+
+//a larger random number, for more than 16M records
+size_t next_random_large(unsigned& seed)
+{
+    size_t high = next_random(seed);
+    return (high << 24) | next_random(seed);
+}
+
+//the key of record i
+MyIndex record_index(size_t i)
+{
+    return MyIndex((int)(i / 10000), (int)(i / 100 % 100), (int)(i % 100));
+}
+
+//the way each storage makes an element; a is scattered over the key order
+template <class Container_T>
+MyRecord* make_record(Container_T&, const MyIndex& index, size_t i)
+{
+    return new MyRecord(index.x, index.y, index.z, (int)((unsigned)i * 2654435761u), (int)(i * 10));
+}
+
+MyRecord* make_record(MyArenaRecords& container, const MyIndex& index, size_t i)
+{
+    return new (container.get_storage().arena) MyRecord(index.x, index.y, index.z, (int)((unsigned)i * 2654435761u), (int)(i * 10));
+}
+
+//make and insert the records in order, look some up, then free them all
+template <class Container_T>
+void run(const char* name, const vector<unsigned>& order, long& insert_ms, long& find_ms, long& free_ms, bool erase_free = false)
+{
+    Container_T container;
+
+    boost::posix_time::ptime start = boost::posix_time::microsec_clock::universal_time();
+    for (size_t i = 0; i < order.size(); i++)
+        container.insert(make_record(container, record_index(order[i]), order[i]));
+    insert_ms = elapsed(start);
+
+    size_t found = 0;
+    start = boost::posix_time::microsec_clock::universal_time();
+    for (size_t i = 0; i < order.size(); i += 7)
+        found += container.find(record_index(order[i])) ? 1 : 0;
+    find_ms = elapsed(start);
+
+    size_t size = container.size();
+    start = boost::posix_time::microsec_clock::universal_time();
+    if (erase_free)
+        container.erase_free();
+    else
+        container.free();
+    free_ms = elapsed(start);
+
+    cout << name << "insert " << insert_ms << " ms, find " << find_ms << " ms, free " << free_ms << " ms";
+    cout << ((size == order.size() && found == (order.size() + 6) / 7 && 0 == container.size()) ? "" : ", WRONG RESULT") << endl;
+}
+
+int main(int argc, char* argv[])
+{
+    size_t count = argc > 1 ? (size_t)atol(argv[1]) : 10000000;
+    if (0 == count)
+    {
+        cout << "usage: multiindexcontainer10 [records]" << endl;
+        return 1;
+    }
+
+    //(x, y, z) unique, inserted in random order
+    vector<unsigned> order(count);
+    for (size_t i = 0; i < count; i++)
+        order[i] = (unsigned)i;
+    unsigned seed = 1;
+    for (size_t i = count; i > 1; i--)
+        std::swap(order[i - 1], order[next_random_large(seed) % i]);
+
+    cout << count << " records" << endl;
+    long heap_insert, heap_find, heap_free, arena_insert, arena_find, arena_free;
+    run<MyHeapRecords>("HeapStorage:                     ", order, heap_insert, heap_find, heap_free);
+    run<MyArenaRecords>("ArenaStorage:                    ", order, arena_insert, arena_find, arena_free);
+
+    cout << "speedup: insert " << (arena_insert > 0 ? (double)heap_insert / arena_insert : 0);
+    cout << ", find " << (arena_find > 0 ? (double)heap_find / arena_find : 0);
+    cout << ", free " << heap_free << " ms down to " << arena_free << " ms" << endl;
+
+    long two_insert, two_find, erase_free, dispose_free;
+    run<MyTwoIndexRecords>("two indexes, erase loop free:    ", order, two_insert, two_find, erase_free, true);
+    run<MyTwoIndexRecords>("two indexes, clear_and_dispose:  ", order, two_insert, two_find, dispose_free);
+    cout << "clear_and_dispose against the erase loop: " << erase_free << " ms down to " << dispose_free << " ms" << endl;
+
+    return 0;
+}
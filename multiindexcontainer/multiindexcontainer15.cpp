@@ -0,0 +1,254 @@
+/**
+ * boost multi index container test: MyRecord stored in the nodes against MyRecord*
+ * platform: win32, visual studio 2005/2010; Linux, gcc4.1.2
+ * usage: multiindexcontainer15 [records] [probes]
+ */
+
+#include <iostream>
+#include <vector>
+#include <algorithm>
+#include <cstdlib>
+#include "boost/multi_index_container.hpp"
+#include "boost/multi_index/member.hpp"
+#include "boost/multi_index/ordered_index.hpp"
+#include "boost/date_time/posix_time/posix_time.hpp"
+
+using namespace std;
+using namespace boost::multi_index;
+using boost::multi_index_container;
+
+//define multiple index
+typedef struct MyIndex
+{
+    int x;
+    int y;
+    int z;
+
+    MyIndex(int ax = 0, int ay = 0, int az = 0): x(ax), y(ay), z(az){}
+}MyIndex;
+
+bool operator<(const MyIndex& lhs, const MyIndex& rhs)
+{
+    if (lhs.x < rhs.x) return true;
+    else if (lhs.x > rhs.x) return false;
+    else if (lhs.y < rhs.y) return true;
+    else if (lhs.y > rhs.y) return false;
+    else if (lhs.z < rhs.z) return true;
+    else if (lhs.z > rhs.z) return false;
+    else return false;
+}
+
+//define object to be indexed; unlike MyTest it prints nothing when destructed
+class MyRecord
+{
+public:
+    MyIndex myIndex;
+    int a;
+    int b;
+
+    MyRecord(int x, int y, int z, int aa, int ab): myIndex(x, y, z), a(aa), b(ab){}
+
+private:
+    MyRecord(const MyRecord&);
+    MyRecord& operator= (const MyRecord&);
+};
+
+//how an element is pointed to from outside the container: a pointer element
+//is its own handle, an element stored in place in its node is pointed to
+template <class Value_T>
+struct element_handle
+{
+    typedef const Value_T* type;
+    static type of(const Value_T& value) { return &value; }
+};
+
+template <class Value_T>
+struct element_handle<Value_T*>
+{
+    typedef Value_T* type;
+    static type of(Value_T* const& value) { return value; }
+};
+
+//the MyContainer of multiindexcontainer5, with what the benchmark needs
+template <class MultiIndexContainer_T, class Tag_T, class Data_T, class Index_T>
+class MyContainer
+{
+    MultiIndexContainer_T theContainer;
+
+public:
+    typedef typename element_handle<typename MultiIndexContainer_T::value_type>::type handle_type;
+
+    void insert(Data_T* data);
+    template <class A1, class A2, class A3, class A4, class A5>
+    bool emplace(const A1& a1, const A2& a2, const A3& a3, const A4& a4, const A5& a5) { return theContainer.emplace(a1, a2, a3, a4, a5).second; }
+    handle_type find(const Index_T& index);
+    size_t size() const { return theContainer.size(); }
+    void free();
+};
+
+template <class MultiIndexContainer_T, class Tag_T, class Data_T, class Index_T>
+void MyContainer<MultiIndexContainer_T, Tag_T, Data_T, Index_T>::insert(Data_T* data)
+{
+    theContainer.insert(data);
+}
+
+template <class MultiIndexContainer_T, class Tag_T, class Data_T, class Index_T>
+typename MyContainer<MultiIndexContainer_T, Tag_T, Data_T, Index_T>::handle_type MyContainer<MultiIndexContainer_T, Tag_T, Data_T, Index_T>::find(const Index_T& index)
+{
+    const typename boost::multi_index::index<MultiIndexContainer_T, Tag_T>::type& indexSet = get<Tag_T>(theContainer);
+    const typename boost::multi_index::index<MultiIndexContainer_T, Tag_T>::type::iterator iter = indexSet.find(index);
+    return indexSet.end() == iter ? NULL : element_handle<typename MultiIndexContainer_T::value_type>::of(*iter);
+}
+
+//the disposer of free(): delete what an element points to; an element stored
+//in place is destroyed by the container itself
+struct delete_disposer
+{
+    template <class T>
+    void operator()(T* const& pobj) const
+    {
+        delete pobj;
+    }
+
+    template <class T>
+    void operator()(const T&) const
+    {
+    }
+};
+
+template <class MultiIndexContainer_T, class Tag_T, class Data_T, class Index_T>
+void MyContainer<MultiIndexContainer_T, Tag_T, Data_T, Index_T>::free()
+{
+    delete_disposer dispose;
+    while (!theContainer.empty())
+    {
+        typename MultiIndexContainer_T::iterator iter = theContainer.begin();
+        dispose(*iter);
+        theContainer.erase(iter);
+    }
+}
+
+//define index tag, multi_index_containers, and their types
+struct MyIndexTag{};
+typedef multi_index_container<
+    MyRecord*,
+    indexed_by<
+        ordered_unique<
+            tag<MyIndexTag>,  member<MyRecord, MyIndex, &MyRecord::myIndex> > >
+>MyContainer_T;
+
+typedef multi_index_container<
+    MyRecord,
+    indexed_by<
+        ordered_unique<
+            tag<MyIndexTag>,  member<MyRecord, MyIndex, &MyRecord::myIndex> > >
+>MyValueContainer_T;
+
+typedef MyContainer<MyContainer_T, MyIndexTag, MyRecord, MyIndex> MyPointerRecords;
+typedef MyContainer<MyValueContainer_T, MyIndexTag, MyRecord, MyIndex> MyValueRecords;
+
+//milliseconds since start
+long elapsed(const boost::posix_time::ptime& start)
+{
+    return (long)(boost::posix_time::microsec_clock::universal_time() - start).total_milliseconds();
+}
+
+//the same random order on every platform
+unsigned next_random(unsigned& seed)
+{
+    seed = seed * 1103515245 + 12345;
+    return (seed >> 8) & 0xffffff;
+}
+
+//a larger random number, for more than 16M records
+size_t next_random_large(unsigned& seed)
+{
+    size_t high = next_random(seed);
+    return (high << 24) | next_random(seed);
+}
+
+//the key of record i; z of 100 and more is never inserted
+MyIndex record_index(size_t i)
+{
+    return MyIndex((int)(i / 10000), (int)(i / 100 % 100), (int)(i % 100));
+}
+
+//the way each layout gets a record in
+void add_record(MyPointerRecords& container, const MyIndex& index, size_t i)
+{
+    container.insert(new MyRecord(index.x, index.y, index.z, (int)i, (int)(i * 10)));
+}
+
+void add_record(MyValueRecords& container, const MyIndex& index, size_t i)
+{
+    container.emplace(index.x, index.y, index.z, (int)i, (int)(i * 10));
+}
+
+//insert the records in order, find the keys and read what was found, then free them all
+template <class Container_T>
+void run(const char* name, const vector<unsigned>& order, const vector<MyIndex>& keys, long& find_ms, long long& sum)
+{
+    Container_T container;
+
+    boost::posix_time::ptime start = boost::posix_time::microsec_clock::universal_time();
+    for (size_t i = 0; i < order.size(); i++)
+        add_record(container, record_index(order[i]), order[i]);
+    long insert_ms = elapsed(start);
+
+    sum = 0;
+    start = boost::posix_time::microsec_clock::universal_time();
+    for (size_t i = 0; i < keys.size(); i++)
+    {
+        typename Container_T::handle_type record = container.find(keys[i]);
+        if (NULL != record)
+            sum += record->a + record->b;
+    }
+    find_ms = elapsed(start);
+
+    size_t size = container.size();
+    start = boost::posix_time::microsec_clock::universal_time();
+    container.free();
+    long free_ms = elapsed(start);
+
+    cout << name << "insert " << insert_ms << " ms, find " << find_ms << " ms (" << find_ms * 1000000.0 / keys.size() << " ns each), free " << free_ms << " ms";
+    cout << ((size == order.size() && 0 == container.size()) ? "" : ", WRONG RESULT") << endl;
+}
+
+int main(int argc, char* argv[])
+{
+    size_t count = argc > 1 ? (size_t)atol(argv[1]) : 1000000;
+    size_t probes = argc > 2 ? (size_t)atol(argv[2]) : count;
+    if (0 == count || 0 == probes)
+    {
+        cout << "usage: multiindexcontainer15 [records] [probes]" << endl;
+        return 1;
+    }
+
+    //(x, y, z) unique, inserted in random order
+    vector<unsigned> order(count);
+    for (size_t i = 0; i < count; i++)
+        order[i] = (unsigned)i;
+    unsigned seed = 1;
+    for (size_t i = count; i > 1; i--)
+        std::swap(order[i - 1], order[next_random_large(seed) % i]);
+
+    //random keys, one in eight of them not in the container
+    vector<MyIndex> keys(probes);
+    for (size_t i = 0; i < probes; i++)
+    {
+        keys[i] = record_index(next_random_large(seed) % count);
+        if (0 == next_random(seed) % 8)
+            keys[i].z += 100;
+    }
+
+    cout << count << " records, " << probes << " probes" << endl;
+    long pointer_ms, value_ms;
+    long long pointer_sum, value_sum;
+    run<MyPointerRecords>("MyRecord*:  ", order, keys, pointer_ms, pointer_sum);
+    run<MyValueRecords>("MyRecord:   ", order, keys, value_ms, value_sum);
+
+    cout << "find speedup " << (value_ms > 0 ? (double)pointer_ms / value_ms : 0);
+    cout << (pointer_sum == value_sum ? "" : ", WRONG RESULT") << endl;
+
+    return 0;
+}
@@ -0,0 +1,801 @@
+/**
+ * boost multi index container test: ConcurrentContainer against a container behind a shared_mutex
+ * platform: win32, visual studio 2005/2010; Linux, gcc4.1.2
+ * usage: multiindexcontainer16 [records] [milliseconds] [write percent]
+ */
+
+#include <iostream>
+#include <vector>
+#include <algorithm>
+#include <cstdlib>
+#include "boost/multi_index_container.hpp"
+#include "boost/multi_index/member.hpp"
+#include "boost/multi_index/ordered_index.hpp"
+#include "boost/atomic.hpp"
+#include "boost/thread/thread.hpp"
+#include "boost/thread/mutex.hpp"
+#include "boost/thread/shared_mutex.hpp"
+#include "boost/functional/hash.hpp"
+#include "boost/date_time/posix_time/posix_time.hpp"
+
+using namespace std;
+using namespace boost::multi_index;
+using boost::multi_index_container;
+
+//define multiple index
+typedef struct MyIndex
+{
+    int x;
+    int y;
+    int z;
+
+    MyIndex(int ax = 0, int ay = 0, int az = 0): x(ax), y(ay), z(az){}
+}MyIndex;
+
+bool operator<(const MyIndex& lhs, const MyIndex& rhs)
+{
+    if (lhs.x < rhs.x) return true;
+    else if (lhs.x > rhs.x) return false;
+    else if (lhs.y < rhs.y) return true;
+    else if (lhs.y > rhs.y) return false;
+    else if (lhs.z < rhs.z) return true;
+    else if (lhs.z > rhs.z) return false;
+    else return false;
+}
+
+//the shard of a MyIndex in ConcurrentContainer
+size_t hash_value(const MyIndex& index)
+{
+    size_t seed = 0;
+    boost::hash_combine(seed, index.x);
+    boost::hash_combine(seed, index.y);
+    boost::hash_combine(seed, index.z);
+    return seed;
+}
+
+//define object to be indexed; unlike MyTest it prints nothing when destructed
+class MyRecord
+{
+public:
+    MyIndex myIndex;
+    int a;
+    int b;
+
+    MyRecord(int x, int y, int z, int aa, int ab): myIndex(x, y, z), a(aa), b(ab){}
+
+private:
+    MyRecord(const MyRecord&);
+    MyRecord& operator= (const MyRecord&);
+};
+
+//how an element is pointed to from outside the container: a pointer element
+//is its own handle, an element stored in place in its node is pointed to
+template <class Value_T>
+struct element_handle
+{
+    typedef const Value_T* type;
+    static type of(const Value_T& value) { return &value; }
+};
+
+template <class Value_T>
+struct element_handle<Value_T*>
+{
+    typedef Value_T* type;
+    static type of(Value_T* const& value) { return value; }
+};
+
+//a read only copy of an ordered index: the keys in one sorted array, the
+//elements in another one beside it. A lookup is a binary search over the
+//keys alone, no node or element is read until the key is there
+template <class Key_T, class Value_T, class Compare_T = std::less<Key_T> >
+class flat_index
+{
+public:
+    typedef Key_T key_type;
+    typedef Value_T value_type;
+    typedef Compare_T key_compare;
+    typedef typename std::vector<Value_T>::const_iterator const_iterator;
+    typedef const_iterator iterator;
+
+    flat_index(const Compare_T& acomp = Compare_T()): comp(acomp){}
+
+    //copy an ordered index with the same key, it is in order already
+    template <class OrderedIndex_T>
+    void assign(const OrderedIndex_T& index)
+    {
+        const typename OrderedIndex_T::key_from_value key = index.key_extractor();
+
+        keys.clear();
+        values.clear();
+        keys.reserve(index.size());
+        values.reserve(index.size());
+        for (typename OrderedIndex_T::const_iterator iter = index.begin(); iter != index.end(); ++iter)
+        {
+            keys.push_back(key(*iter));
+            values.push_back(element_handle<typename OrderedIndex_T::value_type>::of(*iter));
+        }
+        comp = index.key_comp();
+    }
+
+    const_iterator begin() const { return values.begin(); }
+    const_iterator end() const { return values.end(); }
+    size_t size() const { return values.size(); }
+    bool empty() const { return values.empty(); }
+
+    const_iterator lower_bound(const Key_T& key) const
+    {
+        return values.begin() + position(KeyBefore(comp, key));
+    }
+
+    const_iterator upper_bound(const Key_T& key) const
+    {
+        return values.begin() + position(KeyNotAfter(comp, key));
+    }
+
+    std::pair<const_iterator, const_iterator> equal_range(const Key_T& key) const
+    {
+        return std::make_pair(lower_bound(key), upper_bound(key));
+    }
+
+    const_iterator find(const Key_T& key) const
+    {
+        size_t pos = position(KeyBefore(comp, key));
+        if (pos == keys.size() || comp(key, keys[pos]))
+            return end();
+        return values.begin() + pos;
+    }
+
+    size_t count(const Key_T& key) const
+    {
+        std::pair<const_iterator, const_iterator> range = equal_range(key);
+        return range.second - range.first;
+    }
+
+private:
+    //a range this short is searched by counting the keys before the one looked for
+    enum { SCAN_KEYS = 16 };
+
+    //the keys of lower_bound and upper_bound
+    struct KeyBefore
+    {
+        KeyBefore(const Compare_T& acomp, const Key_T& akey): comp(acomp), key(akey){}
+        bool operator()(const Key_T& element) const { return comp(element, key); }
+        const Compare_T& comp;
+        const Key_T& key;
+    };
+
+    struct KeyNotAfter
+    {
+        KeyNotAfter(const Compare_T& acomp, const Key_T& akey): comp(acomp), key(akey){}
+        bool operator()(const Key_T& element) const { return !comp(key, element); }
+        const Compare_T& comp;
+        const Key_T& key;
+    };
+
+    //the number of keys for which before is true, they are all at the front.
+    //Each halving step picks the half with a conditional move instead of a
+    //branch, and the last SCAN_KEYS are counted in a loop without one, which
+    //the compiler can turn into a compare of several keys at once
+    template <class Before_T>
+    size_t position(const Before_T& before) const
+    {
+        if (keys.empty())
+            return 0;
+
+        const Key_T* base = &keys[0];
+        size_t length = keys.size();
+        while (length > SCAN_KEYS)
+        {
+            size_t half = length / 2;
+            base = before(base[half - 1]) ? base + half : base;
+            length -= half;
+        }
+
+        size_t count = 0;
+        for (size_t i = 0; i < length; i++)
+            count += before(base[i]) ? 1 : 0;
+        return (base - &keys[0]) + count;
+    }
+
+    std::vector<Key_T> keys;
+    std::vector<Value_T> values;
+    Compare_T comp;
+};
+
+//for many threads, over containers of Data_T*. The elements are spread over
+//Shards_N shards by the hash of their key; a writer locks the shard of the
+//key only, a reader takes no lock at all. After each write the shard
+//publishes a new flat_index of its Tag_T index, made in O(shard size), and a
+//reader searches whichever one was published when it looked. A replaced
+//flat_index, or an erased element, is freed only once no reader which could
+//still be reading it is left: every reader holds a slot with the epoch it
+//started in, and what was retired in an epoch waits for all readers of that
+//epoch or before to finish (epoch based reclamation)
+template <class MultiIndexContainer_T, class Tag_T, class Data_T, class Index_T, size_t Shards_N = 64>
+class ConcurrentContainer
+{
+    typedef typename boost::multi_index::index<MultiIndexContainer_T, Tag_T>::type ordered_type;
+
+public:
+    typedef typename element_handle<typename MultiIndexContainer_T::value_type>::type handle_type;
+    typedef flat_index<typename ordered_type::key_type, handle_type, typename ordered_type::key_compare> flat_type;
+
+    //the lock free side, one per reading thread. What find and equal_range
+    //return stays valid until release(), which the reader must call when it is
+    //done with it; until then it holds back the freeing of retired memory
+    class reader
+    {
+    public:
+        reader(ConcurrentContainer& acontainer);
+        ~reader();
+
+        handle_type find(const Index_T& index);
+        size_t equal_range(const Index_T& index, std::vector<handle_type>& found);
+        void release();
+
+    private:
+        reader(const reader&);
+        reader& operator= (const reader&);
+
+        const flat_type& pin(const Index_T& index);
+
+        ConcurrentContainer& container;
+        boost::atomic<unsigned long>* slot;
+        bool pinned;
+    };
+
+    ConcurrentContainer();
+    ~ConcurrentContainer();
+
+    //serialized per shard; false if the key is there already
+    bool insert(Data_T* data);
+    //returns the number inserted, each shard is locked and published once
+    template <class InputIterator_T>
+    size_t insert(InputIterator_T first, InputIterator_T last);
+    //returns the number erased, the elements are deleted once no reader can see them
+    size_t erase(const Index_T& index);
+    //the sizes of the shards as they were last published, no snapshot is read
+    size_t size() const;
+    //delete all the elements, no reader may be running
+    void free();
+
+private:
+    ConcurrentContainer(const ConcurrentContainer&);
+    ConcurrentContainer& operator= (const ConcurrentContainer&);
+
+    //a slot is free, held by a reader which is reading nothing, or holds the epoch its reader started in
+    static const unsigned long FREE_SLOT = ~0UL;
+    static const unsigned long IDLE_SLOT = 0;
+
+    struct Shard
+    {
+        boost::mutex mutex;
+        MultiIndexContainer_T container;
+        boost::atomic<const flat_type*> published;
+        boost::atomic<size_t> count;
+    };
+
+    //one cache line each, readers do not share the line they write
+    struct ReaderSlot
+    {
+        boost::atomic<unsigned long> epoch;
+        char pad[64 - sizeof(boost::atomic<unsigned long>)];
+    };
+
+    //the slots come in blocks; when every slot is held a reader appends
+    //another block, so there can be any number of readers. A block is only
+    //freed with the container
+    enum { SLOTS_PER_BLOCK = 64 };
+
+    struct SlotBlock
+    {
+        ReaderSlot slots[SLOTS_PER_BLOCK];
+        boost::atomic<SlotBlock*> next;
+
+        SlotBlock(): next(NULL)
+        {
+            for (size_t i = 0; i < SLOTS_PER_BLOCK; i++)
+                slots[i].epoch.store(FREE_SLOT);
+        }
+    };
+
+    struct Retired
+    {
+        unsigned long epoch;
+        void* object;
+        void (*dispose)(void*);
+    };
+
+    template <class T>
+    static void delete_object(void* object)
+    {
+        delete static_cast<T*>(object);
+    }
+
+    size_t shard_index(const Index_T& index) const;
+    Shard& shard_of(const Index_T& index);
+    void publish(Shard& shard);
+    void retire(void* object, void (*dispose)(void*));
+    void reclaim_all();
+
+    Shard shards[Shards_N];
+    SlotBlock firstBlock;
+    boost::atomic<unsigned long> globalEpoch;
+    boost::mutex retiredMutex;
+    std::vector<Retired> retired;
+};
+
+template <class MultiIndexContainer_T, class Tag_T, class Data_T, class Index_T, size_t Shards_N>
+ConcurrentContainer<MultiIndexContainer_T, Tag_T, Data_T, Index_T, Shards_N>::ConcurrentContainer(): globalEpoch(1)
+{
+    for (size_t i = 0; i < Shards_N; i++)
+    {
+        shards[i].published.store(new flat_type());
+        shards[i].count.store(0);
+    }
+}
+
+template <class MultiIndexContainer_T, class Tag_T, class Data_T, class Index_T, size_t Shards_N>
+ConcurrentContainer<MultiIndexContainer_T, Tag_T, Data_T, Index_T, Shards_N>::~ConcurrentContainer()
+{
+    for (size_t i = 0; i < Shards_N; i++)
+        delete shards[i].published.load();
+    reclaim_all();
+
+    for (SlotBlock* block = firstBlock.next.load(); NULL != block; )
+    {
+        SlotBlock* next = block->next.load();
+        delete block;
+        block = next;
+    }
+}
+
+template <class MultiIndexContainer_T, class Tag_T, class Data_T, class Index_T, size_t Shards_N>
+size_t ConcurrentContainer<MultiIndexContainer_T, Tag_T, Data_T, Index_T, Shards_N>::shard_index(const Index_T& index) const
+{
+    return boost::hash<Index_T>()(index) % Shards_N;
+}
+
+template <class MultiIndexContainer_T, class Tag_T, class Data_T, class Index_T, size_t Shards_N>
+typename ConcurrentContainer<MultiIndexContainer_T, Tag_T, Data_T, Index_T, Shards_N>::Shard& ConcurrentContainer<MultiIndexContainer_T, Tag_T, Data_T, Index_T, Shards_N>::shard_of(const Index_T& index)
+{
+    return shards[shard_index(index)];
+}
+
+template <class MultiIndexContainer_T, class Tag_T, class Data_T, class Index_T, size_t Shards_N>
+bool ConcurrentContainer<MultiIndexContainer_T, Tag_T, Data_T, Index_T, Shards_N>::insert(Data_T* data)
+{
+    Shard& shard = shard_of(get<Tag_T>(shards[0].container).key_extractor()(data));
+    boost::mutex::scoped_lock lock(shard.mutex);
+    if (!shard.container.insert(data).second)
+        return false;
+
+    publish(shard);
+    return true;
+}
+
+template <class MultiIndexContainer_T, class Tag_T, class Data_T, class Index_T, size_t Shards_N>
+template <class InputIterator_T>
+size_t ConcurrentContainer<MultiIndexContainer_T, Tag_T, Data_T, Index_T, Shards_N>::insert(InputIterator_T first, InputIterator_T last)
+{
+    const typename ordered_type::key_from_value key = get<Tag_T>(shards[0].container).key_extractor();
+    std::vector<std::vector<Data_T*> > sharded(Shards_N);
+    for (; first != last; ++first)
+        sharded[shard_index(key(*first))].push_back(*first);
+
+    size_t count = 0;
+    for (size_t i = 0; i < Shards_N; i++)
+    {
+        if (sharded[i].empty())
+            continue;
+
+        boost::mutex::scoped_lock lock(shards[i].mutex);
+        for (size_t j = 0; j < sharded[i].size(); j++)
+            count += shards[i].container.insert(sharded[i][j]).second ? 1 : 0;
+        publish(shards[i]);
+    }
+    return count;
+}
+
+template <class MultiIndexContainer_T, class Tag_T, class Data_T, class Index_T, size_t Shards_N>
+size_t ConcurrentContainer<MultiIndexContainer_T, Tag_T, Data_T, Index_T, Shards_N>::erase(const Index_T& index)
+{
+    Shard& shard = shard_of(index);
+    boost::mutex::scoped_lock lock(shard.mutex);
+
+    ordered_type& indexSet = get<Tag_T>(shard.container);
+    std::pair<typename ordered_type::iterator, typename ordered_type::iterator> range = indexSet.equal_range(index);
+    std::vector<Data_T*> erased(range.first, range.second);
+    if (erased.empty())
+        return 0;
+
+    indexSet.erase(range.first, range.second);
+    publish(shard);
+    for (size_t i = 0; i < erased.size(); i++)
+        retire(erased[i], delete_object<Data_T>);
+    return erased.size();
+}
+
+template <class MultiIndexContainer_T, class Tag_T, class Data_T, class Index_T, size_t Shards_N>
+size_t ConcurrentContainer<MultiIndexContainer_T, Tag_T, Data_T, Index_T, Shards_N>::size() const
+{
+    size_t count = 0;
+    for (size_t i = 0; i < Shards_N; i++)
+        count += shards[i].count.load();
+    return count;
+}
+
+template <class MultiIndexContainer_T, class Tag_T, class Data_T, class Index_T, size_t Shards_N>
+void ConcurrentContainer<MultiIndexContainer_T, Tag_T, Data_T, Index_T, Shards_N>::free()
+{
+    for (size_t i = 0; i < Shards_N; i++)
+    {
+        boost::mutex::scoped_lock lock(shards[i].mutex);
+        for (typename MultiIndexContainer_T::iterator iter = shards[i].container.begin(); iter != shards[i].container.end(); ++iter)
+            delete *iter;
+        shards[i].container.clear();
+        publish(shards[i]);
+    }
+    reclaim_all();
+}
+
+//the shard is locked by the caller
+template <class MultiIndexContainer_T, class Tag_T, class Data_T, class Index_T, size_t Shards_N>
+void ConcurrentContainer<MultiIndexContainer_T, Tag_T, Data_T, Index_T, Shards_N>::publish(Shard& shard)
+{
+    flat_type* next = new flat_type();
+    next->assign(get<Tag_T>(shard.container));
+    const flat_type* previous = shard.published.exchange(next);
+    shard.count.store(next->size());
+    retire(const_cast<flat_type*>(previous), delete_object<flat_type>);
+}
+
+//what is retired now may be in use by readers of this epoch or before: it is
+//tagged with this epoch, and readers starting from now on get the next one.
+//Then everything retired before the oldest epoch a reader is in is freed; the
+//readers are looked at after all of it was retired, under the same lock
+template <class MultiIndexContainer_T, class Tag_T, class Data_T, class Index_T, size_t Shards_N>
+void ConcurrentContainer<MultiIndexContainer_T, Tag_T, Data_T, Index_T, Shards_N>::retire(void* object, void (*dispose)(void*))
+{
+    std::vector<Retired> done;
+    {
+        boost::mutex::scoped_lock lock(retiredMutex);
+        Retired entry = { globalEpoch.fetch_add(1), object, dispose };
+        retired.push_back(entry);
+
+        //a block appended after this walk has only readers which pin after the exchange above
+        unsigned long oldest = FREE_SLOT;
+        for (const SlotBlock* block = &firstBlock; NULL != block; block = block->next.load())
+        {
+            for (size_t i = 0; i < SLOTS_PER_BLOCK; i++)
+            {
+                unsigned long epoch = block->slots[i].epoch.load();
+                if (IDLE_SLOT != epoch && epoch < oldest)
+                    oldest = epoch;
+            }
+        }
+
+        size_t kept = 0;
+        for (size_t i = 0; i < retired.size(); i++)
+        {
+            if (retired[i].epoch < oldest)
+                done.push_back(retired[i]);
+            else
+                retired[kept++] = retired[i];
+        }
+        retired.resize(kept);
+    }
+
+    for (size_t i = 0; i < done.size(); i++)
+        done[i].dispose(done[i].object);
+}
+
+//no reader is left
+template <class MultiIndexContainer_T, class Tag_T, class Data_T, class Index_T, size_t Shards_N>
+void ConcurrentContainer<MultiIndexContainer_T, Tag_T, Data_T, Index_T, Shards_N>::reclaim_all()
+{
+    boost::mutex::scoped_lock lock(retiredMutex);
+    for (size_t i = 0; i < retired.size(); i++)
+        retired[i].dispose(retired[i].object);
+    retired.clear();
+}
+
+template <class MultiIndexContainer_T, class Tag_T, class Data_T, class Index_T, size_t Shards_N>
+ConcurrentContainer<MultiIndexContainer_T, Tag_T, Data_T, Index_T, Shards_N>::reader::reader(ConcurrentContainer& acontainer): container(acontainer), slot(NULL), pinned(false)
+{
+    SlotBlock* block = &container.firstBlock;
+    for (;;)
+    {
+        for (size_t i = 0; i < SLOTS_PER_BLOCK; i++)
+        {
+            unsigned long expected = FREE_SLOT;
+            if (block->slots[i].epoch.compare_exchange_strong(expected, IDLE_SLOT))
+            {
+                slot = &block->slots[i].epoch;
+                return;
+            }
+        }
+
+        //all taken: go on to the next block, adding it if there is none yet
+        SlotBlock* next = block->next.load();
+        if (NULL == next)
+        {
+            SlotBlock* added = new SlotBlock();
+            if (block->next.compare_exchange_strong(next, added))
+                next = added;
+            else
+                delete added;
+        }
+        block = next;
+    }
+}
+
+template <class MultiIndexContainer_T, class Tag_T, class Data_T, class Index_T, size_t Shards_N>
+ConcurrentContainer<MultiIndexContainer_T, Tag_T, Data_T, Index_T, Shards_N>::reader::~reader()
+{
+    slot->store(FREE_SLOT);
+}
+
+//enter the current epoch first, then look at what is published: a writer
+//which retires it later sees this reader, one which retired it before has
+//published its successor already
+template <class MultiIndexContainer_T, class Tag_T, class Data_T, class Index_T, size_t Shards_N>
+const typename ConcurrentContainer<MultiIndexContainer_T, Tag_T, Data_T, Index_T, Shards_N>::flat_type& ConcurrentContainer<MultiIndexContainer_T, Tag_T, Data_T, Index_T, Shards_N>::reader::pin(const Index_T& index)
+{
+    if (!pinned)
+    {
+        slot->store(container.globalEpoch.load());
+        pinned = true;
+    }
+    return *container.shard_of(index).published.load();
+}
+
+template <class MultiIndexContainer_T, class Tag_T, class Data_T, class Index_T, size_t Shards_N>
+typename ConcurrentContainer<MultiIndexContainer_T, Tag_T, Data_T, Index_T, Shards_N>::handle_type ConcurrentContainer<MultiIndexContainer_T, Tag_T, Data_T, Index_T, Shards_N>::reader::find(const Index_T& index)
+{
+    const flat_type& indexSet = pin(index);
+    typename flat_type::const_iterator iter = indexSet.find(index);
+    return indexSet.end() == iter ? NULL : *iter;
+}
+
+template <class MultiIndexContainer_T, class Tag_T, class Data_T, class Index_T, size_t Shards_N>
+size_t ConcurrentContainer<MultiIndexContainer_T, Tag_T, Data_T, Index_T, Shards_N>::reader::equal_range(const Index_T& index, std::vector<handle_type>& found)
+{
+    const flat_type& indexSet = pin(index);
+    std::pair<typename flat_type::const_iterator, typename flat_type::const_iterator> range = indexSet.equal_range(index);
+    found.assign(range.first, range.second);
+    return found.size();
+}
+
+template <class MultiIndexContainer_T, class Tag_T, class Data_T, class Index_T, size_t Shards_N>
+void ConcurrentContainer<MultiIndexContainer_T, Tag_T, Data_T, Index_T, Shards_N>::reader::release()
+{
+    if (pinned)
+    {
+        slot->store(IDLE_SLOT);
+        pinned = false;
+    }
+}
+
+//define index tag, multi_index_container, and its type
+struct MyIndexTag{};
+typedef multi_index_container<
+    MyRecord*,
+    indexed_by<
+        ordered_unique<
+            tag<MyIndexTag>,  member<MyRecord, MyIndex, &MyRecord::myIndex> > >
+>MyContainer_T;
+
+//a shard holds about a thousand records, so that publishing one after a write stays cheap
+const size_t SHARDS = 1024;
+typedef ConcurrentContainer<MyContainer_T, MyIndexTag, MyRecord, MyIndex, SHARDS> MyConcurrentRecords;
+
+//the other way to share it: readers take the lock shared, writers alone
+class MyLockedRecords
+{
+public:
+    class reader
+    {
+    public:
+        reader(MyLockedRecords& acontainer): container(acontainer), locked(false){}
+
+        //the lock is held until release(), so the record stays valid
+        MyRecord* find(const MyIndex& index)
+        {
+            if (!locked)
+            {
+                container.mutex.lock_shared();
+                locked = true;
+            }
+            MyContainer_T::index<MyIndexTag>::type::iterator iter = container.theContainer.find(index);
+            return container.theContainer.end() == iter ? NULL : *iter;
+        }
+
+        void release()
+        {
+            if (locked)
+            {
+                container.mutex.unlock_shared();
+                locked = false;
+            }
+        }
+
+    private:
+        MyLockedRecords& container;
+        bool locked;
+    };
+
+    bool insert(MyRecord* data)
+    {
+        boost::unique_lock<boost::shared_mutex> lock(mutex);
+        return theContainer.insert(data).second;
+    }
+
+    size_t erase(const MyIndex& index)
+    {
+        boost::unique_lock<boost::shared_mutex> lock(mutex);
+        MyContainer_T::iterator iter = theContainer.find(index);
+        if (theContainer.end() == iter)
+            return 0;
+        MyRecord* pobj = *iter;
+        theContainer.erase(iter);
+        delete pobj;
+        return 1;
+    }
+
+    size_t size()
+    {
+        boost::shared_lock<boost::shared_mutex> lock(mutex);
+        return theContainer.size();
+    }
+
+    void free()
+    {
+        boost::unique_lock<boost::shared_mutex> lock(mutex);
+        for (MyContainer_T::iterator iter = theContainer.begin(); iter != theContainer.end(); ++iter)
+            delete *iter;
+        theContainer.clear();
+    }
+
+private:
+    boost::shared_mutex mutex;
+    MyContainer_T theContainer;
+};
+
+//milliseconds since start
+long elapsed(const boost::posix_time::ptime& start)
+{
+    return (long)(boost::posix_time::microsec_clock::universal_time() - start).total_milliseconds();
+}
+
+//the same random order on every platform
+unsigned next_random(unsigned& seed)
+{
+    seed = seed * 1103515245 + 12345;
+    return (seed >> 8) & 0xffffff;
+}
+
+//the key of record i
+MyIndex record_index(size_t i)
+{
+    return MyIndex((int)(i / 10000), (int)(i / 100 % 100), (int)(i % 100));
+}
+
+//what one thread does until stop: find random records and read them, and in
+//write_percent of the operations insert a record of its own or erase it again
+template <class Container_T>
+struct Worker
+{
+    Container_T* container;
+    size_t count;
+    unsigned write_percent;
+    unsigned id;
+    boost::atomic<bool>* stop;
+    unsigned long long operations;
+    unsigned long long checksum;
+
+    void operator()()
+    {
+        typename Container_T::reader reader(*container);
+        unsigned seed = id + 1;
+        int written = 0;
+        bool inserted = false;
+        operations = 0;
+        checksum = 0;
+
+        while (!stop->load(boost::memory_order_relaxed))
+        {
+            if (next_random(seed) % 100 < write_percent)
+            {
+                //the keys of this thread are out of the range of the records
+                MyIndex index((int)(count / 10000) + 1 + (int)id, written / 100 % 100, written % 100);
+                if (!inserted)
+                    container->insert(new MyRecord(index.x, index.y, index.z, (int)id, written));
+                else
+                    container->erase(index), written++;
+                inserted = !inserted;
+            }
+            else
+            {
+                MyRecord* record = reader.find(record_index(next_random(seed) % count));
+                if (NULL != record)
+                    checksum += record->a;
+                reader.release();
+            }
+            operations++;
+        }
+
+        if (inserted)
+            container->erase(MyIndex((int)(count / 10000) + 1 + (int)id, written / 100 % 100, written % 100));
+    }
+};
+
+//threads threads for milliseconds, returns the operations per second
+template <class Container_T>
+double run(Container_T& container, size_t count, unsigned threads, unsigned write_percent, long milliseconds)
+{
+    boost::atomic<bool> stop(false);
+    vector<Worker<Container_T> > workers(threads);
+    boost::thread_group group;
+    for (unsigned i = 0; i < threads; i++)
+    {
+        Worker<Container_T> worker = { &container, count, write_percent, i, &stop, 0, 0 };
+        workers[i] = worker;
+        group.create_thread(boost::ref(workers[i]));
+    }
+
+    boost::this_thread::sleep(boost::posix_time::milliseconds(milliseconds));
+    stop.store(true);
+    group.join_all();
+
+    unsigned long long operations = 0;
+    for (unsigned i = 0; i < threads; i++)
+        operations += workers[i].operations;
+    return operations * 1000.0 / milliseconds;
+}
+
+int main(int argc, char* argv[])
+{
+    size_t count = argc > 1 ? (size_t)atol(argv[1]) : 1000000;
+    long milliseconds = argc > 2 ? atol(argv[2]) : 1000;
+    unsigned write_percent = argc > 3 ? (unsigned)atoi(argv[3]) : 5;
+    if (0 == count || milliseconds <= 0 || write_percent > 100)
+    {
+        cout << "usage: multiindexcontainer16 [records] [milliseconds] [write percent]" << endl;
+        return 1;
+    }
+
+    MyConcurrentRecords concurrent;
+    MyLockedRecords locked;
+    vector<MyRecord*> records(count);
+    for (size_t i = 0; i < count; i++)
+    {
+        MyIndex index = record_index(i);
+        records[i] = new MyRecord(index.x, index.y, index.z, (int)i, (int)(i * 10));
+        locked.insert(new MyRecord(index.x, index.y, index.z, (int)i, (int)(i * 10)));
+    }
+    concurrent.insert(records.begin(), records.end());
+
+    unsigned cores = boost::thread::hardware_concurrency();
+    vector<unsigned> threads;
+    for (unsigned i = 1; i < cores; i *= 2)
+        threads.push_back(i);
+    threads.push_back(cores > 0 ? cores : 1);
+    if (threads.back() < 4)
+        threads.push_back(4);
+
+    cout << count << " records, " << write_percent << "% writes, " << cores << " cores" << endl;
+    for (size_t i = 0; i < threads.size(); i++)
+    {
+        double lock_free = run(concurrent, count, threads[i], write_percent, milliseconds);
+        double shared = run(locked, count, threads[i], write_percent, milliseconds);
+        cout << threads[i] << " threads: ConcurrentContainer " << (long)lock_free << " ops/s, ";
+        cout << "shared_mutex " << (long)shared << " ops/s, ratio " << lock_free / shared << endl;
+    }
+
+    cout << ((concurrent.size() == count && locked.size() == count) ? "" : "WRONG RESULT\n");
+    concurrent.free();
+    locked.free();
+
+    return 0;
+}
@@ -0,0 +1,495 @@
+/**
+ * boost multi index container test: inserts from many threads into a sharded_container against one locked container
+ * platform: win32, visual studio 2005/2010; Linux, gcc4.1.2
+ * usage: multiindexcontainer17 [records] [threads]
+ */
+
+#include <iostream>
+#include <vector>
+#include <algorithm>
+#include <cstdlib>
+#include "boost/multi_index_container.hpp"
+#include "boost/multi_index/member.hpp"
+#include "boost/multi_index/ordered_index.hpp"
+#include "boost/thread/thread.hpp"
+#include "boost/thread/mutex.hpp"
+#include "boost/functional/hash.hpp"
+#include "boost/type_traits/is_same.hpp"
+#include "boost/type_traits/integral_constant.hpp"
+#include "boost/date_time/posix_time/posix_time.hpp"
+
+using namespace std;
+using namespace boost::multi_index;
+using boost::multi_index_container;
+
+//define multiple index
+typedef struct MyIndex
+{
+    int x;
+    int y;
+    int z;
+
+    MyIndex(int ax = 0, int ay = 0, int az = 0): x(ax), y(ay), z(az){}
+}MyIndex;
+
+bool operator<(const MyIndex& lhs, const MyIndex& rhs)
+{
+    if (lhs.x < rhs.x) return true;
+    else if (lhs.x > rhs.x) return false;
+    else if (lhs.y < rhs.y) return true;
+    else if (lhs.y > rhs.y) return false;
+    else if (lhs.z < rhs.z) return true;
+    else if (lhs.z > rhs.z) return false;
+    else return false;
+}
+
+//the shard of a MyIndex in sharded_container
+size_t hash_value(const MyIndex& index)
+{
+    size_t seed = 0;
+    boost::hash_combine(seed, index.x);
+    boost::hash_combine(seed, index.y);
+    boost::hash_combine(seed, index.z);
+    return seed;
+}
+
+//define object to be indexed; unlike MyTest it prints nothing when destructed
+class MyRecord
+{
+public:
+    MyIndex myIndex;
+    int a;
+    int b;
+
+    MyRecord(int x, int y, int z, int aa, int ab): myIndex(x, y, z), a(aa), b(ab){}
+
+private:
+    MyRecord(const MyRecord&);
+    MyRecord& operator= (const MyRecord&);
+};
+
+//define index tags, multi_index_container, and its type: the records are
+//sharded by MyIndex, a lookup by a must ask every shard
+struct MyIndexTag{};
+struct MyGroupTag{};
+typedef multi_index_container<
+    MyRecord*,
+    indexed_by<
+        ordered_unique<
+            tag<MyIndexTag>,  member<MyRecord, MyIndex, &MyRecord::myIndex> >,
+        ordered_non_unique<
+            tag<MyGroupTag>,  member<MyRecord, int, &MyRecord::a> > >
+>MyContainer_T;
+
+//compare two elements by the key of an index, to sort them in its order
+template <class Index_T>
+struct KeyLess
+{
+    KeyLess(const Index_T& index): key(index.key_extractor()), comp(index.key_comp()){}
+
+    template <class Value_T>
+    bool operator()(const Value_T& lhs, const Value_T& rhs) const
+    {
+        return comp(key(lhs), key(rhs));
+    }
+
+    typename Index_T::key_from_value key;
+    typename Index_T::key_compare comp;
+};
+
+//how an element is pointed to from outside the container: a pointer element
+//is its own handle, an element stored in place in its node is pointed to
+template <class Value_T>
+struct element_handle
+{
+    typedef const Value_T* type;
+    static type of(const Value_T& value) { return &value; }
+};
+
+template <class Value_T>
+struct element_handle<Value_T*>
+{
+    typedef Value_T* type;
+    static type of(Value_T* const& value) { return value; }
+};
+
+//merge the runs, each one sorted by less, into found: a heap holds where each
+//run is up to, so every element costs O(log runs) and not a sort of them all
+template <class Handle_T, class Less_T>
+struct RunAfter
+{
+    RunAfter(const std::vector<std::vector<Handle_T> >& aruns, const Less_T& aless): runs(aruns), less(aless){}
+
+    //the heap keeps its greatest on top, here that is the run with the least element
+    bool operator()(const std::pair<size_t, size_t>& lhs, const std::pair<size_t, size_t>& rhs) const
+    {
+        return less(runs[rhs.first][rhs.second], runs[lhs.first][lhs.second]);
+    }
+
+    const std::vector<std::vector<Handle_T> >& runs;
+    Less_T less;
+};
+
+template <class Handle_T, class Less_T>
+void merge_runs(const std::vector<std::vector<Handle_T> >& runs, const Less_T& less, std::vector<Handle_T>& found)
+{
+    RunAfter<Handle_T, Less_T> after(runs, less);
+    std::vector<std::pair<size_t, size_t> > heap;
+    size_t count = 0;
+    for (size_t i = 0; i < runs.size(); i++)
+    {
+        if (!runs[i].empty())
+            heap.push_back(std::make_pair(i, (size_t)0));
+        count += runs[i].size();
+    }
+    std::make_heap(heap.begin(), heap.end(), after);
+
+    found.clear();
+    found.reserve(count);
+    while (!heap.empty())
+    {
+        std::pop_heap(heap.begin(), heap.end(), after);
+        std::pair<size_t, size_t>& next = heap.back();
+        found.push_back(runs[next.first][next.second]);
+        if (++next.second < runs[next.first].size())
+            std::push_heap(heap.begin(), heap.end(), after);
+        else
+            heap.pop_back();
+    }
+}
+
+//Shards_N multi_index_containers, each with its own lock, so that inserts of
+//different shards do not wait for each other. An element goes to the shard of
+//the hash of its key in the ShardIndex_N-th index. A lookup by that index goes
+//to the one shard its key can be in; a lookup by another index, or a range,
+//asks every shard in turn and merges what they hold into the order of the
+//index. The shards are locked one at a time, so what is gathered from them
+//is not one snapshot while other threads write
+template <class MultiIndexContainer_T, size_t Shards_N, size_t ShardIndex_N = 0>
+class sharded_container
+{
+    typedef typename nth_index<MultiIndexContainer_T, ShardIndex_N>::type shard_index_type;
+
+    template <class Tag_T>
+    struct index_of
+    {
+        typedef typename boost::multi_index::index<MultiIndexContainer_T, Tag_T>::type type;
+        typedef typename type::key_type key_type;
+        typedef boost::is_same<type, shard_index_type> routed;
+    };
+
+public:
+    typedef typename MultiIndexContainer_T::value_type value_type;
+    typedef typename element_handle<value_type>::type handle_type;
+
+    //the shard of key, a key of the ShardIndex_N-th index
+    size_t shard_of(const typename shard_index_type::key_type& key) const
+    {
+        return boost::hash<typename shard_index_type::key_type>()(key) % Shards_N;
+    }
+
+    //serialized per shard; false if an index refused the element
+    bool insert(const value_type& value);
+
+    //NULL if no element has the key in the index of Tag_T
+    template <class Tag_T>
+    handle_type find(const typename index_of<Tag_T>::key_type& key);
+    //the elements with the key in the index of Tag_T, and with a key in
+    //[lower, upper], in its order; they return how many there are
+    template <class Tag_T>
+    size_t equal_range(const typename index_of<Tag_T>::key_type& key, std::vector<handle_type>& found);
+    template <class Tag_T>
+    size_t range(const typename index_of<Tag_T>::key_type& lower, const typename index_of<Tag_T>::key_type& upper, std::vector<handle_type>& found);
+    //every element, in the order of the index of Tag_T
+    template <class Tag_T>
+    size_t gather(std::vector<handle_type>& found);
+
+    size_t size() const;
+    template <class Disposer_T>
+    void clear_and_dispose(Disposer_T dispose);
+
+private:
+    struct Shard
+    {
+        mutable boost::mutex mutex;
+        MultiIndexContainer_T container;
+    };
+
+    //a key of the index of Tag_T is in one shard only if Tag_T is the shard index
+    template <class Key_T>
+    size_t route(const Key_T& key, boost::true_type) const { return shard_of(key); }
+    template <class Key_T>
+    size_t route(const Key_T&, boost::false_type) const { return Shards_N; }
+
+    //copy the elements of a shard between the bounds, NULL for no bound
+    template <class Tag_T>
+    void collect(Shard& shard, const typename index_of<Tag_T>::key_type* lower, const typename index_of<Tag_T>::key_type* upper, std::vector<handle_type>& run);
+    template <class Tag_T>
+    size_t scatter_gather(const typename index_of<Tag_T>::key_type* lower, const typename index_of<Tag_T>::key_type* upper, std::vector<handle_type>& found);
+
+    Shard shards[Shards_N];
+};
+
+template <class MultiIndexContainer_T, size_t Shards_N, size_t ShardIndex_N>
+bool sharded_container<MultiIndexContainer_T, Shards_N, ShardIndex_N>::insert(const value_type& value)
+{
+    Shard& shard = shards[shard_of(get<ShardIndex_N>(shards[0].container).key_extractor()(value))];
+    boost::mutex::scoped_lock lock(shard.mutex);
+    return shard.container.insert(value).second;
+}
+
+template <class MultiIndexContainer_T, size_t Shards_N, size_t ShardIndex_N>
+template <class Tag_T>
+typename sharded_container<MultiIndexContainer_T, Shards_N, ShardIndex_N>::handle_type sharded_container<MultiIndexContainer_T, Shards_N, ShardIndex_N>::find(const typename index_of<Tag_T>::key_type& key)
+{
+    size_t first = route(key, typename index_of<Tag_T>::routed());
+    size_t last = first + 1;
+    if (Shards_N == first)
+        first = 0;
+
+    for (size_t i = first; i < last; i++)
+    {
+        boost::mutex::scoped_lock lock(shards[i].mutex);
+        const typename index_of<Tag_T>::type& indexSet = get<Tag_T>(shards[i].container);
+        typename index_of<Tag_T>::type::const_iterator iter = indexSet.find(key);
+        if (iter != indexSet.end())
+            return element_handle<value_type>::of(*iter);
+    }
+    return (handle_type)NULL;
+}
+
+template <class MultiIndexContainer_T, size_t Shards_N, size_t ShardIndex_N>
+template <class Tag_T>
+size_t sharded_container<MultiIndexContainer_T, Shards_N, ShardIndex_N>::equal_range(const typename index_of<Tag_T>::key_type& key, std::vector<handle_type>& found)
+{
+    size_t shard = route(key, typename index_of<Tag_T>::routed());
+    if (Shards_N == shard)
+        return scatter_gather<Tag_T>(&key, &key, found);
+
+    found.clear();
+    collect<Tag_T>(shards[shard], &key, &key, found);
+    return found.size();
+}
+
+template <class MultiIndexContainer_T, size_t Shards_N, size_t ShardIndex_N>
+template <class Tag_T>
+size_t sharded_container<MultiIndexContainer_T, Shards_N, ShardIndex_N>::range(const typename index_of<Tag_T>::key_type& lower, const typename index_of<Tag_T>::key_type& upper, std::vector<handle_type>& found)
+{
+    return scatter_gather<Tag_T>(&lower, &upper, found);
+}
+
+template <class MultiIndexContainer_T, size_t Shards_N, size_t ShardIndex_N>
+template <class Tag_T>
+size_t sharded_container<MultiIndexContainer_T, Shards_N, ShardIndex_N>::gather(std::vector<handle_type>& found)
+{
+    return scatter_gather<Tag_T>(NULL, NULL, found);
+}
+
+template <class MultiIndexContainer_T, size_t Shards_N, size_t ShardIndex_N>
+size_t sharded_container<MultiIndexContainer_T, Shards_N, ShardIndex_N>::size() const
+{
+    size_t count = 0;
+    for (size_t i = 0; i < Shards_N; i++)
+    {
+        boost::mutex::scoped_lock lock(shards[i].mutex);
+        count += shards[i].container.size();
+    }
+    return count;
+}
+
+//empty every shard, passing each element to dispose
+template <class MultiIndexContainer_T, size_t Shards_N, size_t ShardIndex_N>
+template <class Disposer_T>
+void sharded_container<MultiIndexContainer_T, Shards_N, ShardIndex_N>::clear_and_dispose(Disposer_T dispose)
+{
+    for (size_t i = 0; i < Shards_N; i++)
+    {
+        boost::mutex::scoped_lock lock(shards[i].mutex);
+        for (typename MultiIndexContainer_T::iterator iter = shards[i].container.begin(); iter != shards[i].container.end(); ++iter)
+            dispose(*iter);
+        shards[i].container.clear();
+    }
+}
+
+template <class MultiIndexContainer_T, size_t Shards_N, size_t ShardIndex_N>
+template <class Tag_T>
+void sharded_container<MultiIndexContainer_T, Shards_N, ShardIndex_N>::collect(Shard& shard, const typename index_of<Tag_T>::key_type* lower, const typename index_of<Tag_T>::key_type* upper, std::vector<handle_type>& run)
+{
+    typedef typename index_of<Tag_T>::type index_type;
+
+    boost::mutex::scoped_lock lock(shard.mutex);
+    const index_type& indexSet = get<Tag_T>(shard.container);
+    typename index_type::const_iterator first = lower ? indexSet.lower_bound(*lower) : indexSet.begin();
+    typename index_type::const_iterator last = upper ? indexSet.upper_bound(*upper) : indexSet.end();
+    for (; first != last; ++first)
+        run.push_back(element_handle<value_type>::of(*first));
+}
+
+//each shard is in the order of the index already, only the runs are merged
+template <class MultiIndexContainer_T, size_t Shards_N, size_t ShardIndex_N>
+template <class Tag_T>
+size_t sharded_container<MultiIndexContainer_T, Shards_N, ShardIndex_N>::scatter_gather(const typename index_of<Tag_T>::key_type* lower, const typename index_of<Tag_T>::key_type* upper, std::vector<handle_type>& found)
+{
+    std::vector<std::vector<handle_type> > runs(Shards_N);
+    for (size_t i = 0; i < Shards_N; i++)
+        collect<Tag_T>(shards[i], lower, upper, runs[i]);
+
+    merge_runs(runs, KeyLess<typename index_of<Tag_T>::type>(get<Tag_T>(shards[0].container)), found);
+    return found.size();
+}
+
+const size_t SHARDS = 64;
+typedef sharded_container<MyContainer_T, SHARDS> MyShardedRecords;
+
+//the same container behind one lock, every insert waits for all the others
+class MyLockedRecords
+{
+public:
+    bool insert(MyRecord* record)
+    {
+        boost::mutex::scoped_lock lock(mutex);
+        return theContainer.insert(record).second;
+    }
+
+    size_t count_group(int a)
+    {
+        boost::mutex::scoped_lock lock(mutex);
+        return get<MyGroupTag>(theContainer).count(a);
+    }
+
+    size_t size()
+    {
+        boost::mutex::scoped_lock lock(mutex);
+        return theContainer.size();
+    }
+
+private:
+    boost::mutex mutex;
+    MyContainer_T theContainer;
+};
+
+//the records have a in [0, GROUPS)
+const int GROUPS = 1000;
+
+//milliseconds since start
+long elapsed(const boost::posix_time::ptime& start)
+{
+    return (long)(boost::posix_time::microsec_clock::universal_time() - start).total_milliseconds();
+}
+
+//the same random order on every platform
+unsigned next_random(unsigned& seed)
+{
+    seed = seed * 1103515245 + 12345;
+    return (seed >> 8) & 0xffffff;
+}
+
+//the key of record i, ascending with i
+MyIndex record_index(size_t i)
+{
+    return MyIndex((int)(i / 10000), (int)(i / 100 % 100), (int)(i % 100));
+}
+
+//what one thread inserts: every step-th record from first on
+template <class Container_T>
+struct Inserter
+{
+    Container_T* container;
+    const vector<MyRecord*>* records;
+    size_t first;
+    size_t step;
+
+    void operator()()
+    {
+        for (size_t i = first; i < records->size(); i += step)
+            container->insert((*records)[i]);
+    }
+};
+
+//all the records from threads threads at once, returns the milliseconds
+template <class Container_T>
+long insert_all(Container_T& container, const vector<MyRecord*>& records, unsigned threads)
+{
+    boost::posix_time::ptime start = boost::posix_time::microsec_clock::universal_time();
+    boost::thread_group group;
+    for (unsigned i = 0; i < threads; i++)
+    {
+        Inserter<Container_T> inserter = { &container, &records, i, threads };
+        group.create_thread(inserter);
+    }
+    group.join_all();
+    return elapsed(start);
+}
+
+//every record once, in the order of MyIndex
+bool check_order(MyShardedRecords& sharded, size_t count)
+{
+    vector<MyRecord*> all;
+    if (sharded.gather<MyIndexTag>(all) != count)
+        return false;
+    for (size_t i = 1; i < all.size(); i++)
+    {
+        if (!(all[i - 1]->myIndex < all[i]->myIndex))
+            return false;
+    }
+    return true;
+}
+
+int main(int argc, char* argv[])
+{
+    size_t count = argc > 1 ? (size_t)atol(argv[1]) : 1000000;
+    //at least 4 threads, so that the locks are contended even on a small machine
+    unsigned cores = boost::thread::hardware_concurrency();
+    unsigned threads = argc > 2 ? (unsigned)atoi(argv[2]) : (cores > 4 ? cores : 4);
+    if (0 == threads)
+        threads = 1;
+
+    //(x, y, z) unique, in random order
+    vector<MyRecord*> records;
+    records.reserve(count);
+    for (size_t i = 0; i < count; i++)
+    {
+        MyIndex index = record_index(i);
+        records.push_back(new MyRecord(index.x, index.y, index.z, (int)(i % GROUPS), (int)(i * 10)));
+    }
+    unsigned seed = 1;
+    for (size_t i = count; i > 1; i--)
+        std::swap(records[i - 1], records[next_random(seed) % i]);
+
+    cout << count << " records, " << threads << " threads, " << cores << " cores, " << SHARDS << " shards" << endl;
+
+    MyLockedRecords locked;
+    long one_lock = insert_all(locked, records, threads);
+    cout << "insert, one lock:        " << one_lock << " ms" << endl;
+
+    MyShardedRecords sharded;
+    long shards = insert_all(sharded, records, threads);
+    cout << "insert, sharded:         " << shards << " ms";
+    if (shards > 0)
+        cout << ", speedup " << (double)one_lock / shards;
+    cout << ((sharded.size() == count && locked.size() == count && check_order(sharded, count)) ? "" : ", WRONG RESULT") << endl;
+
+    //a range of MyIndex and a group of a are gathered from every shard
+    vector<MyRecord*> found;
+    size_t lower = count / 4;
+    size_t upper = count / 2;
+    boost::posix_time::ptime start = boost::posix_time::microsec_clock::universal_time();
+    sharded.range<MyIndexTag>(record_index(lower), record_index(upper), found);
+    cout << "range of " << found.size() << ":         " << elapsed(start) << " ms";
+    cout << ((count > 0 && found.size() == upper - lower + 1) ? "" : ", WRONG RESULT") << endl;
+
+    vector<size_t> groups(GROUPS);
+    for (int a = 0; a < GROUPS; a++)
+        groups[a] = locked.count_group(a);
+    size_t matched = 0;
+    start = boost::posix_time::microsec_clock::universal_time();
+    for (int a = 0; a < GROUPS; a++)
+        matched += sharded.equal_range<MyGroupTag>(a, found) == groups[a] ? 1 : 0;
+    cout << "equal_range of each a:   " << elapsed(start) << " ms";
+    cout << (matched == (size_t)GROUPS ? "" : ", WRONG RESULT") << endl;
+
+    for (size_t i = 0; i < count; i++)
+        delete records[i];
+
+    return 0;
+}
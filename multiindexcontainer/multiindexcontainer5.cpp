@@ -4,9 +4,21 @@
  */
 
 #include <iostream>
+#include <vector>
+#include <algorithm>
+#include <new>
 #include "boost/multi_index_container.hpp"
 #include "boost/multi_index/member.hpp"
 #include "boost/multi_index/ordered_index.hpp"
+#include "boost/mpl/size.hpp"
+#include "boost/thread/thread.hpp"
+#include "boost/cstdint.hpp"
+#include "boost/atomic.hpp"
+#include "boost/thread/mutex.hpp"
+#include "boost/functional/hash.hpp"
+#include "boost/type_traits/is_same.hpp"
+#include "boost/type_traits/integral_constant.hpp"
+#include "boost/static_assert.hpp"
 
 using namespace std;
 using namespace boost::multi_index;
@@ -27,122 +39,1453 @@ typedef struct MyIndex
     }
 }MyIndex;
 
+//the shard of a MyIndex in ConcurrentContainer and sharded_container
+size_t hash_value(const MyIndex& index)
+{
+    size_t seed = 0;
+    boost::hash_combine(seed, index.x);
+    boost::hash_combine(seed, index.y);
+    boost::hash_combine(seed, index.z);
+    return seed;
+}
+
+//up to three 32 bit fields in one 128 bit word which sorts in the same order:
+//the sign bits are flipped so that unsigned order is signed order, and the
+//first field goes highest. Comparing two is two compares of 64 bits, no branch
+struct PackedIndex
+{
+    boost::uint64_t high;
+    boost::uint64_t low;
+
+    PackedIndex(boost::uint64_t ahigh = 0, boost::uint64_t alow = 0): high(ahigh), low(alow){}
+};
+
+inline boost::uint32_t pack_field(int field)
+{
+    return (boost::uint32_t)field ^ 0x80000000u;
+}
+
+inline PackedIndex pack_index(int x, int y, int z)
+{
+    return PackedIndex(((boost::uint64_t)pack_field(x) << 32) | pack_field(y), pack_field(z));
+}
+
+inline PackedIndex pack_index(const MyIndex& index)
+{
+    return pack_index(index.x, index.y, index.z);
+}
+
+//when every field is in [-PACK64_LIMIT, PACK64_LIMIT) 21 bits each are enough,
+//and the whole key is one 64 bit word, compared by a single instruction
+const int PACK64_BITS = 21;
+const int PACK64_LIMIT = 1 << (PACK64_BITS - 1);
+
+inline bool fits_pack64(int x, int y, int z)
+{
+    return x >= -PACK64_LIMIT && x < PACK64_LIMIT && y >= -PACK64_LIMIT && y < PACK64_LIMIT && z >= -PACK64_LIMIT && z < PACK64_LIMIT;
+}
+
+inline boost::uint64_t pack_index64(int x, int y, int z)
+{
+    return ((boost::uint64_t)(x + PACK64_LIMIT) << (2 * PACK64_BITS)) |
+        ((boost::uint64_t)(y + PACK64_LIMIT) << PACK64_BITS) | (boost::uint64_t)(z + PACK64_LIMIT);
+}
+
+inline bool operator<(const PackedIndex& lhs, const PackedIndex& rhs)
+{
+    return (lhs.high < rhs.high) | ((lhs.high == rhs.high) & (lhs.low < rhs.low));
+}
+
+inline bool operator==(const PackedIndex& lhs, const PackedIndex& rhs)
+{
+    return (lhs.high == rhs.high) & (lhs.low == rhs.low);
+}
+
+//the three fields compared at once in SSE2 lanes: one mask of the lanes where
+//lhs is less, one where it is greater, and the lowest lane set in either (the
+//first field which differs) decides. The fourth lane is 0 on both sides
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+
+inline bool simd_less(const MyIndex& lhs, const MyIndex& rhs)
+{
+    __m128i l = _mm_set_epi32(0, lhs.z, lhs.y, lhs.x);
+    __m128i r = _mm_set_epi32(0, rhs.z, rhs.y, rhs.x);
+    int less = _mm_movemask_ps(_mm_castsi128_ps(_mm_cmplt_epi32(l, r)));
+    int greater = _mm_movemask_ps(_mm_castsi128_ps(_mm_cmpgt_epi32(l, r)));
+    int differ = less | greater;
+    return (less & differ & -differ) != 0;
+}
+#else
+inline bool simd_less(const MyIndex& lhs, const MyIndex& rhs)
+{
+    return lhs.x != rhs.x ? lhs.x < rhs.x : (lhs.y != rhs.y ? lhs.y < rhs.y : lhs.z < rhs.z);
+}
+#endif
+
+//opt-in compare of an ordered index of MyIndex, the same order as operator<;
+//multiindexcontainer9 measures both
+struct MyIndexSimdLess
+{
+    bool operator()(const MyIndex& lhs, const MyIndex& rhs) const
+    {
+        return simd_less(lhs, rhs);
+    }
+};
+
 //define data to be indexed
 typedef struct
 {
-    int a;
-    int b;
-}MyData;
+    int a;
+    int b;
+}MyData;
+
+//define object to be indexed
+class MyTest
+{
+public:
+    MyIndex myIndex;
+    MyData  myData;
+
+public:
+
+    MyTest(int x, int y, int z, int a, int b)
+    {
+        myIndex.x = x;
+        myIndex.y = y;
+        myIndex.z = z;
+
+        myData.a = a;
+        myData.b = b;
+    }
+
+    ~MyTest()
+    {
+        print(", destructed");
+    }
+
+    void print(char* prompt = "") const
+    {
+        cout << "(" << myIndex.x << ", " << myIndex.y << ", " << myIndex.z << ") - ";
+        cout << "(" << myData.a << ", " << myData.b << ")" << prompt << endl;
+    }
+
+private:
+    MyTest(const MyTest&);
+    MyTest& operator= (const MyTest&);
+};
+
+//opt-in key extractor: an ordered index over it compares PackedIndex words,
+//and is searched with pack_index(x, y, z). The default index of MyIndex keeps
+//operator<, which is faster in the tree (see multiindexcontainer9)
+struct packed_index_key
+{
+    typedef PackedIndex result_type;
+
+    PackedIndex operator()(const MyTest& test) const
+    {
+        return pack_index(test.myIndex);
+    }
+
+    PackedIndex operator()(const MyTest* test) const
+    {
+        return pack_index(test->myIndex);
+    }
+};
+
+//define index tag, multi_index_container, and its type
+struct MyIndexTag{};
+typedef multi_index_container<
+    MyTest*,
+    indexed_by<
+        ordered_unique<
+            tag<MyIndexTag>,  member<MyTest, MyIndex, &MyTest::myIndex> > > 
+>MyContainer_T;
+
+typedef MyContainer_T::index<MyIndexTag>::type MyContainerIndex_T;
+typedef MyContainer_T::index<MyIndexTag>::type::iterator MyContainerIterator_T;
+typedef std::pair<MyContainerIterator_T, bool> MyContainerPair_T;
+
+//ask the cache for the memory at p before it is read
+#if defined(__GNUC__)
+#define PREFETCH(p) __builtin_prefetch(p)
+#elif defined(_MSC_VER)
+#include <xmmintrin.h>
+#define PREFETCH(p) _mm_prefetch((const char*)(p), _MM_HINT_T0)
+#else
+#define PREFETCH(p)
+#endif
+
+//an index of pointers keeps its keys in the objects pointed to
+template <class Value_T>
+inline void prefetch_value(Value_T* const& value)
+{
+    PREFETCH(value);
+}
+
+template <class Value_T>
+inline void prefetch_value(const Value_T& value)
+{
+    PREFETCH(&value);
+}
+
+//find_many_sorted walks this many elements from the last one found before it searches from the root
+const int FINGER_STEPS = 8;
+
+//ranges shorter than this are sorted by the calling thread
+const size_t PARALLEL_SORT_MIN = 16384;
+
+//sort [first, last) on up to threads threads: the halves are sorted at the same time, then merged
+template <class RandomIterator_T, class Compare_T>
+void parallel_sort(RandomIterator_T first, RandomIterator_T last, Compare_T comp, unsigned threads)
+{
+    if (threads < 2 || (size_t)(last - first) < PARALLEL_SORT_MIN)
+    {
+        std::sort(first, last, comp);
+        return;
+    }
+
+    RandomIterator_T middle = first + (last - first) / 2;
+    boost::thread left(parallel_sort<RandomIterator_T, Compare_T>, first, middle, comp, threads / 2);
+    parallel_sort(middle, last, comp, threads - threads / 2);
+    left.join();
+    std::inplace_merge(first, middle, last, comp);
+}
+
+//compare positions in an array of keys by the keys, to visit them in order
+template <class Key_T, class Compare_T>
+struct ProbeLess
+{
+    ProbeLess(const Key_T* akeys, const Compare_T& acomp): keys(akeys), comp(acomp){}
+
+    bool operator()(size_t lhs, size_t rhs) const
+    {
+        return comp(keys[lhs], keys[rhs]);
+    }
+
+    const Key_T* keys;
+    Compare_T comp;
+};
+
+//compare two elements by the key of an index, to sort them in its order
+template <class Index_T>
+struct KeyLess
+{
+    KeyLess(const Index_T& index): key(index.key_extractor()), comp(index.key_comp()){}
+
+    template <class Value_T>
+    bool operator()(const Value_T& lhs, const Value_T& rhs) const
+    {
+        return comp(key(lhs), key(rhs));
+    }
+
+    typename Index_T::key_from_value key;
+    typename Index_T::key_compare comp;
+};
+
+//how an element is pointed to from outside the container: a pointer element
+//is its own handle, an element stored in place in its node is pointed to
+template <class Value_T>
+struct element_handle
+{
+    typedef const Value_T* type;
+    static type of(const Value_T& value) { return &value; }
+};
+
+template <class Value_T>
+struct element_handle<Value_T*>
+{
+    typedef Value_T* type;
+    static type of(Value_T* const& value) { return value; }
+};
+
+//a read only copy of an ordered index: the keys in one sorted array, the
+//elements in another one beside it. A lookup is a binary search over the
+//keys alone, no node or element is read until the key is there
+template <class Key_T, class Value_T, class Compare_T = std::less<Key_T> >
+class flat_index
+{
+public:
+    typedef Key_T key_type;
+    typedef Value_T value_type;
+    typedef Compare_T key_compare;
+    typedef typename std::vector<Value_T>::const_iterator const_iterator;
+    typedef const_iterator iterator;
+
+    flat_index(const Compare_T& acomp = Compare_T()): comp(acomp){}
+
+    //copy an ordered index with the same key, it is in order already
+    template <class OrderedIndex_T>
+    void assign(const OrderedIndex_T& index)
+    {
+        const typename OrderedIndex_T::key_from_value key = index.key_extractor();
+
+        keys.clear();
+        values.clear();
+        keys.reserve(index.size());
+        values.reserve(index.size());
+        for (typename OrderedIndex_T::const_iterator iter = index.begin(); iter != index.end(); ++iter)
+        {
+            keys.push_back(key(*iter));
+            values.push_back(element_handle<typename OrderedIndex_T::value_type>::of(*iter));
+        }
+        comp = index.key_comp();
+    }
+
+    const_iterator begin() const { return values.begin(); }
+    const_iterator end() const { return values.end(); }
+    size_t size() const { return values.size(); }
+    bool empty() const { return values.empty(); }
+
+    const_iterator lower_bound(const Key_T& key) const
+    {
+        return values.begin() + position(KeyBefore(comp, key));
+    }
+
+    const_iterator upper_bound(const Key_T& key) const
+    {
+        return values.begin() + position(KeyNotAfter(comp, key));
+    }
+
+    std::pair<const_iterator, const_iterator> equal_range(const Key_T& key) const
+    {
+        return std::make_pair(lower_bound(key), upper_bound(key));
+    }
+
+    const_iterator find(const Key_T& key) const
+    {
+        size_t pos = position(KeyBefore(comp, key));
+        if (pos == keys.size() || comp(key, keys[pos]))
+            return end();
+        return values.begin() + pos;
+    }
+
+    size_t count(const Key_T& key) const
+    {
+        std::pair<const_iterator, const_iterator> range = equal_range(key);
+        return range.second - range.first;
+    }
+
+private:
+    //a range this short is searched by counting the keys before the one looked for
+    enum { SCAN_KEYS = 16 };
+
+    //the keys of lower_bound and upper_bound
+    struct KeyBefore
+    {
+        KeyBefore(const Compare_T& acomp, const Key_T& akey): comp(acomp), key(akey){}
+        bool operator()(const Key_T& element) const { return comp(element, key); }
+        const Compare_T& comp;
+        const Key_T& key;
+    };
+
+    struct KeyNotAfter
+    {
+        KeyNotAfter(const Compare_T& acomp, const Key_T& akey): comp(acomp), key(akey){}
+        bool operator()(const Key_T& element) const { return !comp(key, element); }
+        const Compare_T& comp;
+        const Key_T& key;
+    };
+
+    //the number of keys for which before is true, they are all at the front.
+    //Each halving step picks the half with a conditional move instead of a
+    //branch, and the last SCAN_KEYS are counted in a loop without one, which
+    //the compiler can turn into a compare of several keys at once
+    template <class Before_T>
+    size_t position(const Before_T& before) const
+    {
+        if (keys.empty())
+            return 0;
+
+        const Key_T* base = &keys[0];
+        size_t length = keys.size();
+        while (length > SCAN_KEYS)
+        {
+            size_t half = length / 2;
+            base = before(base[half - 1]) ? base + half : base;
+            length -= half;
+        }
+
+        size_t count = 0;
+        for (size_t i = 0; i < length; i++)
+            count += before(base[i]) ? 1 : 0;
+        return (base - &keys[0]) + count;
+    }
+
+    std::vector<Key_T> keys;
+    std::vector<Value_T> values;
+    Compare_T comp;
+};
+
+//memory handed out from large blocks, in order, and given back all at once:
+//nothing is freed on its own, what is allocated together sits together
+class MonotonicArena
+{
+public:
+    enum { BLOCK_SIZE = 1 << 20, ALIGNMENT = 16 };
+
+    MonotonicArena(): next(NULL), left(0){}
+    ~MonotonicArena() { release(); }
+
+    void* allocate(size_t size)
+    {
+        size = (size + ALIGNMENT - 1) & ~(size_t)(ALIGNMENT - 1);
+        if (size > left)
+        {
+            //a large request gets a block of its own, the current one stays open
+            if (size > BLOCK_SIZE / 4)
+            {
+                blocks.push_back(static_cast<char*>(::operator new(size)));
+                return blocks.back();
+            }
+            blocks.push_back(static_cast<char*>(::operator new(BLOCK_SIZE)));
+            next = blocks.back();
+            left = BLOCK_SIZE;
+        }
+
+        void* memory = next;
+        next += size;
+        left -= size;
+        return memory;
+    }
+
+    //one call per block, however many objects were allocated
+    void release()
+    {
+        for (size_t i = 0; i < blocks.size(); i++)
+            ::operator delete(blocks[i]);
+        blocks.clear();
+        next = NULL;
+        left = 0;
+    }
+
+private:
+    MonotonicArena(const MonotonicArena&);
+    MonotonicArena& operator= (const MonotonicArena&);
+
+    std::vector<char*> blocks;
+    char* next;
+    size_t left;
+};
+
+//new (arena) MyTest(...): the object lives until the arena is released, its destructor is not run
+inline void* operator new(size_t size, MonotonicArena& arena)
+{
+    return arena.allocate(size);
+}
+
+inline void operator delete(void*, MonotonicArena&)
+{
+}
+
+//an allocator for the nodes of a multi_index_container, from an arena
+template <class T>
+class arena_allocator
+{
+public:
+    typedef T value_type;
+    typedef T* pointer;
+    typedef const T* const_pointer;
+    typedef T& reference;
+    typedef const T& const_reference;
+    typedef size_t size_type;
+    typedef ptrdiff_t difference_type;
+
+    template <class U>
+    struct rebind
+    {
+        typedef arena_allocator<U> other;
+    };
+
+    arena_allocator(MonotonicArena& aarena): arena(&aarena){}
+    template <class U>
+    arena_allocator(const arena_allocator<U>& other): arena(other.arena){}
+
+    pointer address(reference value) const { return &value; }
+    const_pointer address(const_reference value) const { return &value; }
+    size_type max_size() const { return ~(size_type)0 / sizeof(T); }
+
+    pointer allocate(size_type count, const void* = 0)
+    {
+        return static_cast<pointer>(arena->allocate(count * sizeof(T)));
+    }
+
+    void deallocate(pointer, size_type)
+    {
+    }
+
+    void construct(pointer p, const T& value) { new (static_cast<void*>(p)) T(value); }
+    void destroy(pointer p) { p->~T(); }
+
+    MonotonicArena* arena;
+};
+
+template <class T, class U>
+bool operator==(const arena_allocator<T>& lhs, const arena_allocator<U>& rhs)
+{
+    return lhs.arena == rhs.arena;
+}
+
+template <class T, class U>
+bool operator!=(const arena_allocator<T>& lhs, const arena_allocator<U>& rhs)
+{
+    return lhs.arena != rhs.arena;
+}
+
+//where MyContainer keeps its container, nodes and elements. HeapStorage is
+//the usual: elements from new, nodes from the container's allocator, and
+//free() erases and deletes the elements one by one
+struct HeapStorage
+{
+    enum { OWNS_ELEMENTS = false };
+
+    template <class Container_T>
+    Container_T* create()
+    {
+        return new Container_T();
+    }
+
+    template <class Container_T>
+    void clear(Container_T& container)
+    {
+        container.clear();
+    }
+
+    template <class Container_T>
+    void destroy(Container_T* container)
+    {
+        delete container;
+    }
+};
+
+//ArenaStorage puts the nodes, and the elements made with new (arena), in one
+//arena. The container type must use arena_allocator. free() releases the
+//arena and starts an empty container: no element is visited, and no
+//destructor of an element is run
+struct ArenaStorage
+{
+    enum { OWNS_ELEMENTS = true };
+
+    MonotonicArena arena;
+
+    template <class Container_T>
+    Container_T* create()
+    {
+        return new (::operator new(sizeof(Container_T))) Container_T(
+            typename Container_T::ctor_args_list(), typename Container_T::allocator_type(arena));
+    }
+
+    //the old container is dropped without its destructor, all its memory is in the arena
+    template <class Container_T>
+    void clear(Container_T& container)
+    {
+        arena.release();
+        new (&container) Container_T(typename Container_T::ctor_args_list(), typename Container_T::allocator_type(arena));
+    }
+
+    template <class Container_T>
+    void destroy(Container_T* container)
+    {
+        arena.release();
+        ::operator delete(container);
+    }
+};
+
+//the disposer of free(): delete what an element points to; an element stored
+//in place is destroyed by the container itself
+struct delete_disposer
+{
+    template <class T>
+    void operator()(T* const& pobj) const
+    {
+        delete pobj;
+    }
+
+    template <class T>
+    void operator()(const T&) const
+    {
+    }
+};
+
+//a template class. It owns the container its Storage_T made, so it is not
+//copied. With ArenaStorage the elements belong to the arena: free() drops
+//them with it, and clear_and_dispose may not delete them
+template <class MultiIndexContainer_T, class Tag_T, class Data_T, class Index_T, class Storage_T = HeapStorage>
+class MyContainer
+{
+    typedef typename boost::multi_index::index<MultiIndexContainer_T, Tag_T>::type ordered_type;
+public:
+    typedef typename element_handle<typename MultiIndexContainer_T::value_type>::type handle_type;
+    //a frozen copy of the index of Tag_T, see freeze()
+    typedef flat_index<typename ordered_type::key_type, handle_type, typename ordered_type::key_compare> flat_type;
+
+private:
+    Storage_T theStorage;
+    MultiIndexContainer_T& theContainer;
+
+public:
+    MyContainer(): theContainer(*theStorage.template create<MultiIndexContainer_T>()){}
+    ~MyContainer() { theStorage.destroy(&theContainer); }
+
+    //where new (get_storage().arena) makes elements of an ArenaStorage container
+    Storage_T& get_storage() { return theStorage; }
+    size_t size() const { return theContainer.size(); }
+
+    void insert(Data_T* data);
+
+    //for a container of Data_T itself: make the element in its node from the
+    //arguments of a Data_T constructor, it is never copied. Returns false if
+    //the key is there already, the element made for it is destructed again
+    template <class A1>
+    bool emplace(const A1& a1) { return theContainer.emplace(a1).second; }
+    template <class A1, class A2>
+    bool emplace(const A1& a1, const A2& a2) { return theContainer.emplace(a1, a2).second; }
+    template <class A1, class A2, class A3>
+    bool emplace(const A1& a1, const A2& a2, const A3& a3) { return theContainer.emplace(a1, a2, a3).second; }
+    template <class A1, class A2, class A3, class A4>
+    bool emplace(const A1& a1, const A2& a2, const A3& a3, const A4& a4) { return theContainer.emplace(a1, a2, a3, a4).second; }
+    template <class A1, class A2, class A3, class A4, class A5>
+    bool emplace(const A1& a1, const A2& a2, const A3& a3, const A4& a4, const A5& a5) { return theContainer.emplace(a1, a2, a3, a4, a5).second; }
+
+    template <class InputIterator_T>
+    size_t bulk_insert(InputIterator_T first, InputIterator_T last, unsigned threads = 0);
+    void find(const Index_T& index);
+    //for read-mostly use: copy the index of Tag_T into frozen, whose lookups
+    //search one sorted array. It is made in O(n) and does not see later changes
+    void freeze(flat_type& frozen) const { frozen.assign(get<Tag_T>(theContainer)); }
+    template <class KeyIterator_T>
+    size_t find_many_sorted(KeyIterator_T first, KeyIterator_T last, std::vector<handle_type>& found);
+    void print();
+    template <class Disposer_T>
+    void clear_and_dispose(Disposer_T dispose);
+    void free();
+
+private:
+    MyContainer(const MyContainer&);
+    MyContainer& operator= (const MyContainer&);
+
+    void free(boost::true_type);
+    void free(boost::false_type);
+};
+
+template <class MultiIndexContainer_T, class Tag_T, class Data_T, class Index_T, class Storage_T>
+void MyContainer<MultiIndexContainer_T, Tag_T, Data_T, Index_T, Storage_T>::insert(Data_T* data)
+{
+    theContainer.insert(data);
+}
+
+//insert [first, last) at once, returns the number inserted. The elements are
+//sorted by the key of Tag_T on threads threads (0: one per core) and go in in
+//that order, each one with the element after it as hint: appended to an empty
+//index or merged into a filled one, no insert searches the tree from the root
+template <class MultiIndexContainer_T, class Tag_T, class Data_T, class Index_T, class Storage_T>
+template <class InputIterator_T>
+size_t MyContainer<MultiIndexContainer_T, Tag_T, Data_T, Index_T, Storage_T>::bulk_insert(InputIterator_T first, InputIterator_T last, unsigned threads)
+{
+    typedef typename boost::multi_index::index<MultiIndexContainer_T, Tag_T>::type index_type;
+    typedef typename MultiIndexContainer_T::value_type value_type;
+
+    index_type& indexSet = get<Tag_T>(theContainer);
+    KeyLess<index_type> less(indexSet);
+
+    std::vector<value_type> sorted(first, last);
+    if (0 == threads)
+        threads = boost::thread::hardware_concurrency();
+    parallel_sort(sorted.begin(), sorted.end(), less, threads);
+
+    size_t before = indexSet.size();
+    typename index_type::iterator hint = indexSet.begin();
+    for (typename std::vector<value_type>::iterator iter = sorted.begin(); iter != sorted.end(); ++iter)
+    {
+        //skip what is already in the index and goes before this one
+        while (hint != indexSet.end() && !less(*iter, *hint))
+            ++hint;
+        indexSet.insert(hint, *iter);
+    }
+    return indexSet.size() - before;
+}
+
+template <class MultiIndexContainer_T, class Tag_T, class Data_T, class Index_T, class Storage_T>
+void MyContainer<MultiIndexContainer_T, Tag_T, Data_T, Index_T, Storage_T>::find(const Index_T& index)
+{
+    const ordered_type& indexSet = get<Tag_T>(theContainer);
+    const typename ordered_type::const_iterator iter = indexSet.find(index);
+    if (indexSet.end() == iter)
+    {
+        index.print("not found");
+        return;
+    }
+
+    element_handle<typename MultiIndexContainer_T::value_type>::of(*iter)->print(", found");
+}
+
+//look up the keys [first, last) at once, returns the number found. found[i] is
+//the element of the i-th key, NULL if there is none. The gain is the order:
+//the keys are sorted and visited in index order, so each search finds the
+//upper levels of the tree (and the elements between near keys) still in the
+//cache from the one before. The next one is looked for by walking on from the
+//last one found, and only when it is more than FINGER_STEPS away is the tree
+//searched from the root again. The nodes of the tree are not reachable
+//through the index, so nothing prefetches the path of a search; the walk
+//only prefetches the object of the element after the finger, which holds the
+//key of an index of pointers. That is worth a few percent at most, see
+//multiindexcontainer7
+template <class MultiIndexContainer_T, class Tag_T, class Data_T, class Index_T, class Storage_T>
+template <class KeyIterator_T>
+size_t MyContainer<MultiIndexContainer_T, Tag_T, Data_T, Index_T, Storage_T>::find_many_sorted(KeyIterator_T first, KeyIterator_T last, std::vector<handle_type>& found)
+{
+    typedef typename boost::multi_index::index<MultiIndexContainer_T, Tag_T>::type index_type;
+    typedef typename index_type::key_compare key_compare;
+
+    const index_type& indexSet = get<Tag_T>(theContainer);
+    const typename index_type::key_from_value key = indexSet.key_extractor();
+    const key_compare comp = indexSet.key_comp();
+
+    std::vector<Index_T> keys(first, last);
+    found.assign(keys.size(), (handle_type)NULL);
+    if (keys.empty())
+        return 0;
+
+    std::vector<size_t> order(keys.size());
+    for (size_t i = 0; i < order.size(); i++)
+        order[i] = i;
+    std::sort(order.begin(), order.end(), ProbeLess<Index_T, key_compare>(&keys[0], comp));
+
+    size_t count = 0;
+    int limit = FINGER_STEPS;
+    typename index_type::const_iterator finger = indexSet.begin();
+    for (std::vector<size_t>::const_iterator pos = order.begin(); pos != order.end(); ++pos)
+    {
+        const Index_T& index = keys[*pos];
+
+        //after a search from the root the keys are far apart, only look at the next element
+        int steps = 0;
+        while (finger != indexSet.end() && comp(key(*finger), index))
+        {
+            if (++steps > limit)
+            {
+                finger = indexSet.lower_bound(index);
+                break;
+            }
+
+            ++finger;
+            typename index_type::const_iterator next = finger;
+            if (next != indexSet.end() && ++next != indexSet.end())
+                prefetch_value(*next);
+        }
+
+        limit = steps > limit ? 1 : FINGER_STEPS;
+
+        if (finger != indexSet.end() && !comp(index, key(*finger)))
+        {
+            found[*pos] = element_handle<typename MultiIndexContainer_T::value_type>::of(*finger);
+            count++;
+        }
+    }
+    return count;
+}
+
+template <class MultiIndexContainer_T, class Tag_T, class Data_T, class Index_T, class Storage_T>
+void MyContainer<MultiIndexContainer_T, Tag_T, Data_T, Index_T, Storage_T>::print()
+{
+    const typename boost::multi_index::index<MultiIndexContainer_T, Tag_T>::type& indexSet = get<Tag_T>(theContainer);
+
+    typedef typename MultiIndexContainer_T::value_type value_type;
+    std::copy(indexSet.begin(), indexSet.end(), std::ostream_iterator<value_type>(cout));
+}
+
+//empty the container, passing each element to dispose, in the order of the
+//first index. With more than one index erase(begin()) in a loop would unlink
+//each node from the others at some place in the middle and rebalance them, so
+//the elements are visited once and then all the nodes are dropped together:
+//clear() frees them without unlinking. With a single index taking out the
+//first element is cheap and reads each node once instead of twice, so there
+//the loop stays
+template <class MultiIndexContainer_T, class Tag_T, class Data_T, class Index_T, class Storage_T>
+template <class Disposer_T>
+void MyContainer<MultiIndexContainer_T, Tag_T, Data_T, Index_T, Storage_T>::clear_and_dispose(Disposer_T dispose)
+{
+    //an arena element was not made by new, it is not deleted one by one
+    BOOST_STATIC_ASSERT(!(Storage_T::OWNS_ELEMENTS && boost::is_same<Disposer_T, delete_disposer>::value));
+
+    if (1 == boost::mpl::size<typename MultiIndexContainer_T::index_type_list>::value)
+    {
+        while (!theContainer.empty())
+        {
+            typename MultiIndexContainer_T::iterator iter = theContainer.begin();
+            dispose(*iter);
+            theContainer.erase(iter);
+        }
+    }
+    else
+    {
+        for (typename MultiIndexContainer_T::iterator iter = theContainer.begin(); iter != theContainer.end(); ++iter)
+            dispose(*iter);
+    }
+    theStorage.clear(theContainer);
+}
+
+template <class MultiIndexContainer_T, class Tag_T, class Data_T, class Index_T, class Storage_T>
+void MyContainer<MultiIndexContainer_T, Tag_T, Data_T, Index_T, Storage_T>::free()
+{
+    free(boost::integral_constant<bool, Storage_T::OWNS_ELEMENTS>());
+}
+
+//the elements of an arena go with it, they are not visited
+template <class MultiIndexContainer_T, class Tag_T, class Data_T, class Index_T, class Storage_T>
+void MyContainer<MultiIndexContainer_T, Tag_T, Data_T, Index_T, Storage_T>::free(boost::true_type)
+{
+    theStorage.clear(theContainer);
+}
+
+template <class MultiIndexContainer_T, class Tag_T, class Data_T, class Index_T, class Storage_T>
+void MyContainer<MultiIndexContainer_T, Tag_T, Data_T, Index_T, Storage_T>::free(boost::false_type)
+{
+    clear_and_dispose(delete_disposer());
+}
+
+//for many threads, over containers of Data_T*. The elements are spread over
+//Shards_N shards by the hash of their key; a writer locks the shard of the
+//key only, a reader takes no lock at all. After each write the shard
+//publishes a new flat_index of its Tag_T index, made in O(shard size), and a
+//reader searches whichever one was published when it looked. A replaced
+//flat_index, or an erased element, is freed only once no reader which could
+//still be reading it is left: every reader holds a slot with the epoch it
+//started in, and what was retired in an epoch waits for all readers of that
+//epoch or before to finish (epoch based reclamation)
+template <class MultiIndexContainer_T, class Tag_T, class Data_T, class Index_T, size_t Shards_N = 64>
+class ConcurrentContainer
+{
+    typedef typename boost::multi_index::index<MultiIndexContainer_T, Tag_T>::type ordered_type;
+
+public:
+    typedef typename element_handle<typename MultiIndexContainer_T::value_type>::type handle_type;
+    typedef flat_index<typename ordered_type::key_type, handle_type, typename ordered_type::key_compare> flat_type;
+
+    //the lock free side, one per reading thread. What find and equal_range
+    //return stays valid until release(), which the reader must call when it is
+    //done with it; until then it holds back the freeing of retired memory
+    class reader
+    {
+    public:
+        reader(ConcurrentContainer& acontainer);
+        ~reader();
+
+        handle_type find(const Index_T& index);
+        size_t equal_range(const Index_T& index, std::vector<handle_type>& found);
+        void release();
+
+    private:
+        reader(const reader&);
+        reader& operator= (const reader&);
+
+        const flat_type& pin(const Index_T& index);
+
+        ConcurrentContainer& container;
+        boost::atomic<unsigned long>* slot;
+        bool pinned;
+    };
+
+    ConcurrentContainer();
+    ~ConcurrentContainer();
+
+    //serialized per shard; false if the key is there already
+    bool insert(Data_T* data);
+    //returns the number inserted, each shard is locked and published once
+    template <class InputIterator_T>
+    size_t insert(InputIterator_T first, InputIterator_T last);
+    //returns the number erased, the elements are deleted once no reader can see them
+    size_t erase(const Index_T& index);
+    //the sizes of the shards as they were last published, no snapshot is read
+    size_t size() const;
+    //delete all the elements, no reader may be running
+    void free();
+
+private:
+    ConcurrentContainer(const ConcurrentContainer&);
+    ConcurrentContainer& operator= (const ConcurrentContainer&);
+
+    //a slot is free, held by a reader which is reading nothing, or holds the epoch its reader started in
+    static const unsigned long FREE_SLOT = ~0UL;
+    static const unsigned long IDLE_SLOT = 0;
+
+    struct Shard
+    {
+        boost::mutex mutex;
+        MultiIndexContainer_T container;
+        boost::atomic<const flat_type*> published;
+        boost::atomic<size_t> count;
+    };
+
+    //one cache line each, readers do not share the line they write
+    struct ReaderSlot
+    {
+        boost::atomic<unsigned long> epoch;
+        char pad[64 - sizeof(boost::atomic<unsigned long>)];
+    };
+
+    //the slots come in blocks; when every slot is held a reader appends
+    //another block, so there can be any number of readers. A block is only
+    //freed with the container
+    enum { SLOTS_PER_BLOCK = 64 };
+
+    struct SlotBlock
+    {
+        ReaderSlot slots[SLOTS_PER_BLOCK];
+        boost::atomic<SlotBlock*> next;
+
+        SlotBlock(): next(NULL)
+        {
+            for (size_t i = 0; i < SLOTS_PER_BLOCK; i++)
+                slots[i].epoch.store(FREE_SLOT);
+        }
+    };
+
+    struct Retired
+    {
+        unsigned long epoch;
+        void* object;
+        void (*dispose)(void*);
+    };
+
+    template <class T>
+    static void delete_object(void* object)
+    {
+        delete static_cast<T*>(object);
+    }
+
+    size_t shard_index(const Index_T& index) const;
+    Shard& shard_of(const Index_T& index);
+    void publish(Shard& shard);
+    void retire(void* object, void (*dispose)(void*));
+    void reclaim_all();
+
+    Shard shards[Shards_N];
+    SlotBlock firstBlock;
+    boost::atomic<unsigned long> globalEpoch;
+    boost::mutex retiredMutex;
+    std::vector<Retired> retired;
+};
+
+template <class MultiIndexContainer_T, class Tag_T, class Data_T, class Index_T, size_t Shards_N>
+ConcurrentContainer<MultiIndexContainer_T, Tag_T, Data_T, Index_T, Shards_N>::ConcurrentContainer(): globalEpoch(1)
+{
+    for (size_t i = 0; i < Shards_N; i++)
+    {
+        shards[i].published.store(new flat_type());
+        shards[i].count.store(0);
+    }
+}
+
+template <class MultiIndexContainer_T, class Tag_T, class Data_T, class Index_T, size_t Shards_N>
+ConcurrentContainer<MultiIndexContainer_T, Tag_T, Data_T, Index_T, Shards_N>::~ConcurrentContainer()
+{
+    for (size_t i = 0; i < Shards_N; i++)
+        delete shards[i].published.load();
+    reclaim_all();
+
+    for (SlotBlock* block = firstBlock.next.load(); NULL != block; )
+    {
+        SlotBlock* next = block->next.load();
+        delete block;
+        block = next;
+    }
+}
+
+template <class MultiIndexContainer_T, class Tag_T, class Data_T, class Index_T, size_t Shards_N>
+size_t ConcurrentContainer<MultiIndexContainer_T, Tag_T, Data_T, Index_T, Shards_N>::shard_index(const Index_T& index) const
+{
+    return boost::hash<Index_T>()(index) % Shards_N;
+}
+
+template <class MultiIndexContainer_T, class Tag_T, class Data_T, class Index_T, size_t Shards_N>
+typename ConcurrentContainer<MultiIndexContainer_T, Tag_T, Data_T, Index_T, Shards_N>::Shard& ConcurrentContainer<MultiIndexContainer_T, Tag_T, Data_T, Index_T, Shards_N>::shard_of(const Index_T& index)
+{
+    return shards[shard_index(index)];
+}
+
+template <class MultiIndexContainer_T, class Tag_T, class Data_T, class Index_T, size_t Shards_N>
+bool ConcurrentContainer<MultiIndexContainer_T, Tag_T, Data_T, Index_T, Shards_N>::insert(Data_T* data)
+{
+    Shard& shard = shard_of(get<Tag_T>(shards[0].container).key_extractor()(data));
+    boost::mutex::scoped_lock lock(shard.mutex);
+    if (!shard.container.insert(data).second)
+        return false;
+
+    publish(shard);
+    return true;
+}
+
+template <class MultiIndexContainer_T, class Tag_T, class Data_T, class Index_T, size_t Shards_N>
+template <class InputIterator_T>
+size_t ConcurrentContainer<MultiIndexContainer_T, Tag_T, Data_T, Index_T, Shards_N>::insert(InputIterator_T first, InputIterator_T last)
+{
+    const typename ordered_type::key_from_value key = get<Tag_T>(shards[0].container).key_extractor();
+    std::vector<std::vector<Data_T*> > sharded(Shards_N);
+    for (; first != last; ++first)
+        sharded[shard_index(key(*first))].push_back(*first);
 
-//define object to be indexed
-class MyTest
+    size_t count = 0;
+    for (size_t i = 0; i < Shards_N; i++)
+    {
+        if (sharded[i].empty())
+            continue;
+
+        boost::mutex::scoped_lock lock(shards[i].mutex);
+        for (size_t j = 0; j < sharded[i].size(); j++)
+            count += shards[i].container.insert(sharded[i][j]).second ? 1 : 0;
+        publish(shards[i]);
+    }
+    return count;
+}
+
+template <class MultiIndexContainer_T, class Tag_T, class Data_T, class Index_T, size_t Shards_N>
+size_t ConcurrentContainer<MultiIndexContainer_T, Tag_T, Data_T, Index_T, Shards_N>::erase(const Index_T& index)
 {
-public:
-    MyIndex myIndex;
-    MyData  myData;
+    Shard& shard = shard_of(index);
+    boost::mutex::scoped_lock lock(shard.mutex);
 
-public:
+    ordered_type& indexSet = get<Tag_T>(shard.container);
+    std::pair<typename ordered_type::iterator, typename ordered_type::iterator> range = indexSet.equal_range(index);
+    std::vector<Data_T*> erased(range.first, range.second);
+    if (erased.empty())
+        return 0;
 
-    MyTest(int x, int y, int z, int a, int b)
+    indexSet.erase(range.first, range.second);
+    publish(shard);
+    for (size_t i = 0; i < erased.size(); i++)
+        retire(erased[i], delete_object<Data_T>);
+    return erased.size();
+}
+
+template <class MultiIndexContainer_T, class Tag_T, class Data_T, class Index_T, size_t Shards_N>
+size_t ConcurrentContainer<MultiIndexContainer_T, Tag_T, Data_T, Index_T, Shards_N>::size() const
+{
+    size_t count = 0;
+    for (size_t i = 0; i < Shards_N; i++)
+        count += shards[i].count.load();
+    return count;
+}
+
+template <class MultiIndexContainer_T, class Tag_T, class Data_T, class Index_T, size_t Shards_N>
+void ConcurrentContainer<MultiIndexContainer_T, Tag_T, Data_T, Index_T, Shards_N>::free()
+{
+    for (size_t i = 0; i < Shards_N; i++)
     {
-        myIndex.x = x;
-        myIndex.y = y;
-        myIndex.z = z;
+        boost::mutex::scoped_lock lock(shards[i].mutex);
+        for (typename MultiIndexContainer_T::iterator iter = shards[i].container.begin(); iter != shards[i].container.end(); ++iter)
+            delete *iter;
+        shards[i].container.clear();
+        publish(shards[i]);
+    }
+    reclaim_all();
+}
 
-        myData.a = a;
-        myData.b = b;
+//the shard is locked by the caller
+template <class MultiIndexContainer_T, class Tag_T, class Data_T, class Index_T, size_t Shards_N>
+void ConcurrentContainer<MultiIndexContainer_T, Tag_T, Data_T, Index_T, Shards_N>::publish(Shard& shard)
+{
+    flat_type* next = new flat_type();
+    next->assign(get<Tag_T>(shard.container));
+    const flat_type* previous = shard.published.exchange(next);
+    shard.count.store(next->size());
+    retire(const_cast<flat_type*>(previous), delete_object<flat_type>);
+}
+
+//what is retired now may be in use by readers of this epoch or before: it is
+//tagged with this epoch, and readers starting from now on get the next one.
+//Then everything retired before the oldest epoch a reader is in is freed; the
+//readers are looked at after all of it was retired, under the same lock
+template <class MultiIndexContainer_T, class Tag_T, class Data_T, class Index_T, size_t Shards_N>
+void ConcurrentContainer<MultiIndexContainer_T, Tag_T, Data_T, Index_T, Shards_N>::retire(void* object, void (*dispose)(void*))
+{
+    std::vector<Retired> done;
+    {
+        boost::mutex::scoped_lock lock(retiredMutex);
+        Retired entry = { globalEpoch.fetch_add(1), object, dispose };
+        retired.push_back(entry);
+
+        //a block appended after this walk has only readers which pin after the exchange above
+        unsigned long oldest = FREE_SLOT;
+        for (const SlotBlock* block = &firstBlock; NULL != block; block = block->next.load())
+        {
+            for (size_t i = 0; i < SLOTS_PER_BLOCK; i++)
+            {
+                unsigned long epoch = block->slots[i].epoch.load();
+                if (IDLE_SLOT != epoch && epoch < oldest)
+                    oldest = epoch;
+            }
+        }
+
+        size_t kept = 0;
+        for (size_t i = 0; i < retired.size(); i++)
+        {
+            if (retired[i].epoch < oldest)
+                done.push_back(retired[i]);
+            else
+                retired[kept++] = retired[i];
+        }
+        retired.resize(kept);
     }
 
-    ~MyTest()
+    for (size_t i = 0; i < done.size(); i++)
+        done[i].dispose(done[i].object);
+}
+
+//no reader is left
+template <class MultiIndexContainer_T, class Tag_T, class Data_T, class Index_T, size_t Shards_N>
+void ConcurrentContainer<MultiIndexContainer_T, Tag_T, Data_T, Index_T, Shards_N>::reclaim_all()
+{
+    boost::mutex::scoped_lock lock(retiredMutex);
+    for (size_t i = 0; i < retired.size(); i++)
+        retired[i].dispose(retired[i].object);
+    retired.clear();
+}
+
+template <class MultiIndexContainer_T, class Tag_T, class Data_T, class Index_T, size_t Shards_N>
+ConcurrentContainer<MultiIndexContainer_T, Tag_T, Data_T, Index_T, Shards_N>::reader::reader(ConcurrentContainer& acontainer): container(acontainer), slot(NULL), pinned(false)
+{
+    SlotBlock* block = &container.firstBlock;
+    for (;;)
     {
-        print(", destructed");
+        for (size_t i = 0; i < SLOTS_PER_BLOCK; i++)
+        {
+            unsigned long expected = FREE_SLOT;
+            if (block->slots[i].epoch.compare_exchange_strong(expected, IDLE_SLOT))
+            {
+                slot = &block->slots[i].epoch;
+                return;
+            }
+        }
+
+        //all taken: go on to the next block, adding it if there is none yet
+        SlotBlock* next = block->next.load();
+        if (NULL == next)
+        {
+            SlotBlock* added = new SlotBlock();
+            if (block->next.compare_exchange_strong(next, added))
+                next = added;
+            else
+                delete added;
+        }
+        block = next;
     }
+}
 
-    void print(char* prompt = "") const
+template <class MultiIndexContainer_T, class Tag_T, class Data_T, class Index_T, size_t Shards_N>
+ConcurrentContainer<MultiIndexContainer_T, Tag_T, Data_T, Index_T, Shards_N>::reader::~reader()
+{
+    slot->store(FREE_SLOT);
+}
+
+//enter the current epoch first, then look at what is published: a writer
+//which retires it later sees this reader, one which retired it before has
+//published its successor already
+template <class MultiIndexContainer_T, class Tag_T, class Data_T, class Index_T, size_t Shards_N>
+const typename ConcurrentContainer<MultiIndexContainer_T, Tag_T, Data_T, Index_T, Shards_N>::flat_type& ConcurrentContainer<MultiIndexContainer_T, Tag_T, Data_T, Index_T, Shards_N>::reader::pin(const Index_T& index)
+{
+    if (!pinned)
     {
-        cout << "(" << myIndex.x << ", " << myIndex.y << ", " << myIndex.z << ") - ";
-        cout << "(" << myData.a << ", " << myData.b << ")" << prompt << endl;
+        slot->store(container.globalEpoch.load());
+        pinned = true;
     }
+    return *container.shard_of(index).published.load();
+}
 
-private:
-    MyTest(const MyTest&);
-    MyTest& operator= (const MyTest&);
-};
+template <class MultiIndexContainer_T, class Tag_T, class Data_T, class Index_T, size_t Shards_N>
+typename ConcurrentContainer<MultiIndexContainer_T, Tag_T, Data_T, Index_T, Shards_N>::handle_type ConcurrentContainer<MultiIndexContainer_T, Tag_T, Data_T, Index_T, Shards_N>::reader::find(const Index_T& index)
+{
+    const flat_type& indexSet = pin(index);
+    typename flat_type::const_iterator iter = indexSet.find(index);
+    return indexSet.end() == iter ? NULL : *iter;
+}
 
-//define index tag, multi_index_container, and its type
-struct MyIndexTag{};
-typedef multi_index_container<
-    MyTest*,
-    indexed_by<
-        ordered_unique<
-            tag<MyIndexTag>,  member<MyTest, MyIndex, &MyTest::myIndex> > > 
->MyContainer_T;
+template <class MultiIndexContainer_T, class Tag_T, class Data_T, class Index_T, size_t Shards_N>
+size_t ConcurrentContainer<MultiIndexContainer_T, Tag_T, Data_T, Index_T, Shards_N>::reader::equal_range(const Index_T& index, std::vector<handle_type>& found)
+{
+    const flat_type& indexSet = pin(index);
+    std::pair<typename flat_type::const_iterator, typename flat_type::const_iterator> range = indexSet.equal_range(index);
+    found.assign(range.first, range.second);
+    return found.size();
+}
 
-typedef MyContainer_T::index<MyIndexTag>::type MyContainerIndex_T;
-typedef MyContainer_T::index<MyIndexTag>::type::iterator MyContainerIterator_T;
-typedef std::pair<MyContainerIterator_T, bool> MyContainerPair_T;
+template <class MultiIndexContainer_T, class Tag_T, class Data_T, class Index_T, size_t Shards_N>
+void ConcurrentContainer<MultiIndexContainer_T, Tag_T, Data_T, Index_T, Shards_N>::reader::release()
+{
+    if (pinned)
+    {
+        slot->store(IDLE_SLOT);
+        pinned = false;
+    }
+}
 
+//merge the runs, each one sorted by less, into found: a heap holds where each
+//run is up to, so every element costs O(log runs) and not a sort of them all
+template <class Handle_T, class Less_T>
+struct RunAfter
+{
+    RunAfter(const std::vector<std::vector<Handle_T> >& aruns, const Less_T& aless): runs(aruns), less(aless){}
 
-//a template class
-template <class MultiIndexContainer_T, class Tag_T, class Data_T, class Index_T>
-class MyContainer
+    //the heap keeps its greatest on top, here that is the run with the least element
+    bool operator()(const std::pair<size_t, size_t>& lhs, const std::pair<size_t, size_t>& rhs) const
+    {
+        return less(runs[rhs.first][rhs.second], runs[lhs.first][lhs.second]);
+    }
+
+    const std::vector<std::vector<Handle_T> >& runs;
+    Less_T less;
+};
+
+template <class Handle_T, class Less_T>
+void merge_runs(const std::vector<std::vector<Handle_T> >& runs, const Less_T& less, std::vector<Handle_T>& found)
+{
+    RunAfter<Handle_T, Less_T> after(runs, less);
+    std::vector<std::pair<size_t, size_t> > heap;
+    size_t count = 0;
+    for (size_t i = 0; i < runs.size(); i++)
+    {
+        if (!runs[i].empty())
+            heap.push_back(std::make_pair(i, (size_t)0));
+        count += runs[i].size();
+    }
+    std::make_heap(heap.begin(), heap.end(), after);
+
+    found.clear();
+    found.reserve(count);
+    while (!heap.empty())
+    {
+        std::pop_heap(heap.begin(), heap.end(), after);
+        std::pair<size_t, size_t>& next = heap.back();
+        found.push_back(runs[next.first][next.second]);
+        if (++next.second < runs[next.first].size())
+            std::push_heap(heap.begin(), heap.end(), after);
+        else
+            heap.pop_back();
+    }
+}
+
+//Shards_N multi_index_containers, each with its own lock, so that inserts of
+//different shards do not wait for each other. An element goes to the shard of
+//the hash of its key in the ShardIndex_N-th index. A lookup by that index goes
+//to the one shard its key can be in; a lookup by another index, or a range,
+//asks every shard in turn and merges what they hold into the order of the
+//index. The shards are locked one at a time, so what is gathered from them
+//is not one snapshot while other threads write
+template <class MultiIndexContainer_T, size_t Shards_N, size_t ShardIndex_N = 0>
+class sharded_container
 {
-    MultiIndexContainer_T theContainer;
+    typedef typename nth_index<MultiIndexContainer_T, ShardIndex_N>::type shard_index_type;
+
+    template <class Tag_T>
+    struct index_of
+    {
+        typedef typename boost::multi_index::index<MultiIndexContainer_T, Tag_T>::type type;
+        typedef typename type::key_type key_type;
+        typedef boost::is_same<type, shard_index_type> routed;
+    };
 
 public:
-    void insert(Data_T* data);
-    void find(const Index_T& index);
-    void print();
-    void free();
+    typedef typename MultiIndexContainer_T::value_type value_type;
+    typedef typename element_handle<value_type>::type handle_type;
+
+    //the shard of key, a key of the ShardIndex_N-th index
+    size_t shard_of(const typename shard_index_type::key_type& key) const
+    {
+        return boost::hash<typename shard_index_type::key_type>()(key) % Shards_N;
+    }
+
+    //serialized per shard; false if an index refused the element
+    bool insert(const value_type& value);
+
+    //NULL if no element has the key in the index of Tag_T
+    template <class Tag_T>
+    handle_type find(const typename index_of<Tag_T>::key_type& key);
+    //the elements with the key in the index of Tag_T, and with a key in
+    //[lower, upper], in its order; they return how many there are
+    template <class Tag_T>
+    size_t equal_range(const typename index_of<Tag_T>::key_type& key, std::vector<handle_type>& found);
+    template <class Tag_T>
+    size_t range(const typename index_of<Tag_T>::key_type& lower, const typename index_of<Tag_T>::key_type& upper, std::vector<handle_type>& found);
+    //every element, in the order of the index of Tag_T
+    template <class Tag_T>
+    size_t gather(std::vector<handle_type>& found);
+
+    size_t size() const;
+    template <class Disposer_T>
+    void clear_and_dispose(Disposer_T dispose);
+
+private:
+    struct Shard
+    {
+        mutable boost::mutex mutex;
+        MultiIndexContainer_T container;
+    };
+
+    //a key of the index of Tag_T is in one shard only if Tag_T is the shard index
+    template <class Key_T>
+    size_t route(const Key_T& key, boost::true_type) const { return shard_of(key); }
+    template <class Key_T>
+    size_t route(const Key_T&, boost::false_type) const { return Shards_N; }
+
+    //copy the elements of a shard between the bounds, NULL for no bound
+    template <class Tag_T>
+    void collect(Shard& shard, const typename index_of<Tag_T>::key_type* lower, const typename index_of<Tag_T>::key_type* upper, std::vector<handle_type>& run);
+    template <class Tag_T>
+    size_t scatter_gather(const typename index_of<Tag_T>::key_type* lower, const typename index_of<Tag_T>::key_type* upper, std::vector<handle_type>& found);
+
+    Shard shards[Shards_N];
 };
 
-template <class MultiIndexContainer_T, class Tag_T, class Data_T, class Index_T>
-void MyContainer<MultiIndexContainer_T, Tag_T, Data_T, Index_T>::insert(Data_T* data)
+template <class MultiIndexContainer_T, size_t Shards_N, size_t ShardIndex_N>
+bool sharded_container<MultiIndexContainer_T, Shards_N, ShardIndex_N>::insert(const value_type& value)
 {
-    theContainer.insert(data);
+    Shard& shard = shards[shard_of(get<ShardIndex_N>(shards[0].container).key_extractor()(value))];
+    boost::mutex::scoped_lock lock(shard.mutex);
+    return shard.container.insert(value).second;
 }
 
-template <class MultiIndexContainer_T, class Tag_T, class Data_T, class Index_T>
-void MyContainer<MultiIndexContainer_T, Tag_T, Data_T, Index_T>::find(const Index_T& index)
+template <class MultiIndexContainer_T, size_t Shards_N, size_t ShardIndex_N>
+template <class Tag_T>
+typename sharded_container<MultiIndexContainer_T, Shards_N, ShardIndex_N>::handle_type sharded_container<MultiIndexContainer_T, Shards_N, ShardIndex_N>::find(const typename index_of<Tag_T>::key_type& key)
 {
-    const typename boost::multi_index::index<MultiIndexContainer_T, Tag_T>::type& indexSet = get<Tag_T>(theContainer);
-    const typename boost::multi_index::index<MultiIndexContainer_T, Tag_T>::type::iterator iter = indexSet.find(index);
-    if (indexSet.end() == iter)
+    size_t first = route(key, typename index_of<Tag_T>::routed());
+    size_t last = first + 1;
+    if (Shards_N == first)
+        first = 0;
+
+    for (size_t i = first; i < last; i++)
     {
-        index.print("not found");
-        return;
+        boost::mutex::scoped_lock lock(shards[i].mutex);
+        const typename index_of<Tag_T>::type& indexSet = get<Tag_T>(shards[i].container);
+        typename index_of<Tag_T>::type::const_iterator iter = indexSet.find(key);
+        if (iter != indexSet.end())
+            return element_handle<value_type>::of(*iter);
     }
+    return (handle_type)NULL;
+}
+
+template <class MultiIndexContainer_T, size_t Shards_N, size_t ShardIndex_N>
+template <class Tag_T>
+size_t sharded_container<MultiIndexContainer_T, Shards_N, ShardIndex_N>::equal_range(const typename index_of<Tag_T>::key_type& key, std::vector<handle_type>& found)
+{
+    size_t shard = route(key, typename index_of<Tag_T>::routed());
+    if (Shards_N == shard)
+        return scatter_gather<Tag_T>(&key, &key, found);
 
-    (*iter)->print(", found");
+    found.clear();
+    collect<Tag_T>(shards[shard], &key, &key, found);
+    return found.size();
 }
 
-template <class MultiIndexContainer_T, class Tag_T, class Data_T, class Index_T>
-void MyContainer<MultiIndexContainer_T, Tag_T, Data_T, Index_T>::print()
+template <class MultiIndexContainer_T, size_t Shards_N, size_t ShardIndex_N>
+template <class Tag_T>
+size_t sharded_container<MultiIndexContainer_T, Shards_N, ShardIndex_N>::range(const typename index_of<Tag_T>::key_type& lower, const typename index_of<Tag_T>::key_type& upper, std::vector<handle_type>& found)
 {
-    const typename boost::multi_index::index<MultiIndexContainer_T, Tag_T>::type& indexSet = get<Tag_T>(theContainer);
+    return scatter_gather<Tag_T>(&lower, &upper, found);
+}
 
-    typedef typename MultiIndexContainer_T::value_type value_type;
-    std::copy(indexSet.begin(), indexSet.end(), std::ostream_iterator<value_type>(cout));
+template <class MultiIndexContainer_T, size_t Shards_N, size_t ShardIndex_N>
+template <class Tag_T>
+size_t sharded_container<MultiIndexContainer_T, Shards_N, ShardIndex_N>::gather(std::vector<handle_type>& found)
+{
+    return scatter_gather<Tag_T>(NULL, NULL, found);
 }
 
-template <class MultiIndexContainer_T, class Tag_T, class Data_T, class Index_T>
-void MyContainer<MultiIndexContainer_T, Tag_T, Data_T, Index_T>::free()
+template <class MultiIndexContainer_T, size_t Shards_N, size_t ShardIndex_N>
+size_t sharded_container<MultiIndexContainer_T, Shards_N, ShardIndex_N>::size() const
 {
-    typedef typename MultiIndexContainer_T::value_type value_type;
+    size_t count = 0;
+    for (size_t i = 0; i < Shards_N; i++)
+    {
+        boost::mutex::scoped_lock lock(shards[i].mutex);
+        count += shards[i].container.size();
+    }
+    return count;
+}
 
-    while (!theContainer.empty())
+//empty every shard, passing each element to dispose
+template <class MultiIndexContainer_T, size_t Shards_N, size_t ShardIndex_N>
+template <class Disposer_T>
+void sharded_container<MultiIndexContainer_T, Shards_N, ShardIndex_N>::clear_and_dispose(Disposer_T dispose)
+{
+    for (size_t i = 0; i < Shards_N; i++)
     {
-        typename MultiIndexContainer_T::iterator iter = theContainer.begin();
-        if (NULL == (*iter))
-        {
-            theContainer.erase(iter);
-            continue;
-        }
+        boost::mutex::scoped_lock lock(shards[i].mutex);
+        for (typename MultiIndexContainer_T::iterator iter = shards[i].container.begin(); iter != shards[i].container.end(); ++iter)
+            dispose(*iter);
+        shards[i].container.clear();
+    }
+}
 
-        value_type pobj = *iter;
-        theContainer.erase(iter);
-        delete pobj;
+template <class MultiIndexContainer_T, size_t Shards_N, size_t ShardIndex_N>
+template <class Tag_T>
+void sharded_container<MultiIndexContainer_T, Shards_N, ShardIndex_N>::collect(Shard& shard, const typename index_of<Tag_T>::key_type* lower, const typename index_of<Tag_T>::key_type* upper, std::vector<handle_type>& run)
+{
+    typedef typename index_of<Tag_T>::type index_type;
+
+    boost::mutex::scoped_lock lock(shard.mutex);
+    const index_type& indexSet = get<Tag_T>(shard.container);
+    typename index_type::const_iterator first = lower ? indexSet.lower_bound(*lower) : indexSet.begin();
+    typename index_type::const_iterator last = upper ? indexSet.upper_bound(*upper) : indexSet.end();
+    for (; first != last; ++first)
+        run.push_back(element_handle<value_type>::of(*first));
+}
+
+//each shard is in the order of the index already, only the runs are merged
+template <class MultiIndexContainer_T, size_t Shards_N, size_t ShardIndex_N>
+template <class Tag_T>
+size_t sharded_container<MultiIndexContainer_T, Shards_N, ShardIndex_N>::scatter_gather(const typename index_of<Tag_T>::key_type* lower, const typename index_of<Tag_T>::key_type* upper, std::vector<handle_type>& found)
+{
+    std::vector<std::vector<handle_type> > runs(Shards_N);
+    for (size_t i = 0; i < Shards_N; i++)
+        collect<Tag_T>(shards[i], lower, upper, runs[i]);
+
+    merge_runs(runs, KeyLess<typename index_of<Tag_T>::type>(get<Tag_T>(shards[0].container)), found);
+    return found.size();
+}
+
+//MyContainer over a sharded_container: the same insert, find, print and free,
+//made safe to call from many threads at once
+template <class MultiIndexContainer_T, size_t Shards_N, size_t ShardIndex_N, class Tag_T, class Data_T, class Index_T, class Storage_T>
+class MyContainer<sharded_container<MultiIndexContainer_T, Shards_N, ShardIndex_N>, Tag_T, Data_T, Index_T, Storage_T>
+{
+public:
+    typedef sharded_container<MultiIndexContainer_T, Shards_N, ShardIndex_N> sharded_type;
+    typedef typename sharded_type::handle_type handle_type;
+
+private:
+    sharded_type theContainer;
+
+public:
+    //for the lookups MyContainer has no call of its own for, equal_range and range
+    sharded_type& get_container() { return theContainer; }
+    size_t size() const { return theContainer.size(); }
+
+    void insert(Data_T* data) { theContainer.insert(data); }
+    void find(const Index_T& index);
+    void print();
+    void free() { theContainer.clear_and_dispose(delete_disposer()); }
+};
+
+template <class MultiIndexContainer_T, size_t Shards_N, size_t ShardIndex_N, class Tag_T, class Data_T, class Index_T, class Storage_T>
+void MyContainer<sharded_container<MultiIndexContainer_T, Shards_N, ShardIndex_N>, Tag_T, Data_T, Index_T, Storage_T>::find(const Index_T& index)
+{
+    handle_type found = theContainer.template find<Tag_T>(index);
+    if (NULL == found)
+    {
+        index.print("not found");
+        return;
     }
+
+    found->print(", found");
+}
+
+template <class MultiIndexContainer_T, size_t Shards_N, size_t ShardIndex_N, class Tag_T, class Data_T, class Index_T, class Storage_T>
+void MyContainer<sharded_container<MultiIndexContainer_T, Shards_N, ShardIndex_N>, Tag_T, Data_T, Index_T, Storage_T>::print()
+{
+    std::vector<handle_type> all;
+    theContainer.template gather<Tag_T>(all);
+    std::copy(all.begin(), all.end(), std::ostream_iterator<handle_type>(cout));
 }
 
 bool operator<(const MyIndex& lhs, const MyIndex& rhs)
@@ -162,9 +1505,44 @@ std::ostream& operator<<(std::ostream& os, const MyTest* mytest)
     return os;
 }
 
+std::ostream& operator<<(std::ostream& os, const MyTest& mytest)
+{
+    mytest.print();
+    return os;
+}
+
 //instantiate a instance for this template class
 MyContainer<MyContainer_T, MyIndexTag, MyTest, MyIndex> mycontainer;
 
+//the same index with its nodes in an arena
+typedef multi_index_container<
+    MyTest*,
+    indexed_by<
+        ordered_unique<
+            tag<MyIndexTag>,  member<MyTest, MyIndex, &MyTest::myIndex> > >,
+    arena_allocator<MyTest*>
+>MyArenaContainer_T;
+
+//the same index over MyTest itself, each one made in its node
+typedef multi_index_container<
+    MyTest,
+    indexed_by<
+        ordered_unique<
+            tag<MyIndexTag>,  member<MyTest, MyIndex, &MyTest::myIndex> > >
+>MyValueContainer_T;
+
+//the opt-in indexes of MyIndex: packed words, and the SIMD compare
+struct MyPackedTag{};
+struct MySimdTag{};
+typedef multi_index_container<
+    MyTest*,
+    indexed_by<
+        ordered_unique<
+            tag<MyPackedTag>,  packed_index_key>,
+        ordered_unique<
+            tag<MySimdTag>,  member<MyTest, MyIndex, &MyTest::myIndex>, MyIndexSimdLess> >
+>MyFastContainer_T;
+
 void test1()
 {
     MyTest *a = new MyTest(1,1,1,10,100);
@@ -225,6 +1603,17 @@ void test6()
     mycontainer.insert(c);
 }
 
+//all at once, merged into what test1..test6 inserted
+void test_bulk()
+{
+    MyTest* data[] = {
+        new MyTest(3,2,1,1100,10000),
+        new MyTest(3,1,1,1200,20000),
+        new MyTest(1,3,4,1300,30000)
+    };
+    mycontainer.bulk_insert(data, data + sizeof(data) / sizeof(data[0]));
+}
+
 void test_find()
 {
     mycontainer.find(MyIndex(1,1,1));
@@ -250,6 +1639,168 @@ void test_find()
     mycontainer.find(MyIndex(2,3,1));
     mycontainer.find(MyIndex(2,3,2));
     mycontainer.find(MyIndex(2,3,3));
+
+    mycontainer.find(MyIndex(1,3,4));
+    mycontainer.find(MyIndex(3,1,1));
+    mycontainer.find(MyIndex(3,2,1));
+}
+
+//a frozen copy of mycontainer, for many lookups and no more changes
+void test_frozen()
+{
+    MyContainer<MyContainer_T, MyIndexTag, MyTest, MyIndex>::flat_type frozen;
+    mycontainer.freeze(frozen);
+
+    MyIndex keys[] = { MyIndex(2,2,2), MyIndex(1,3,4), MyIndex(3,3,3) };
+    for (size_t i = 0; i < sizeof(keys) / sizeof(keys[0]); i++)
+    {
+        MyContainer<MyContainer_T, MyIndexTag, MyTest, MyIndex>::flat_type::const_iterator iter = frozen.find(keys[i]);
+        if (frozen.end() == iter)
+            keys[i].print("not found");
+        else
+            (*iter)->print(", found");
+    }
+    cout << frozen.size() << " in the frozen copy" << endl;
+}
+
+//the keys of test_find in one call, out of order and with some not there
+void test_find_many_sorted()
+{
+    MyIndex keys[] = {
+        MyIndex(2,3,3), MyIndex(1,1,1), MyIndex(3,2,1), MyIndex(1,2,2),
+        MyIndex(4,1,1), MyIndex(2,1,1), MyIndex(1,3,4), MyIndex(0,0,0),
+        MyIndex(2,2,2), MyIndex(1,1,3)
+    };
+
+    std::vector<MyTest*> found;
+    size_t count = mycontainer.find_many_sorted(keys, keys + sizeof(keys) / sizeof(keys[0]), found);
+    for (size_t i = 0; i < found.size(); i++)
+    {
+        if (NULL == found[i])
+            keys[i].print("not found");
+        else
+            found[i]->print(", found");
+    }
+    cout << count << " of " << found.size() << " found" << endl;
+}
+
+//elements and nodes in one arena; free() releases it, so no element is destructed
+//both opt-in indexes keep the order of operator< and find the same elements
+void test_fast_keys()
+{
+    MyFastContainer_T fastcontainer;
+    fastcontainer.insert(new MyTest(2,1,1,2010,20100));
+    fastcontainer.insert(new MyTest(-1,5,0,2020,20200));
+    fastcontainer.insert(new MyTest(2,0,9,2030,20300));
+    fastcontainer.insert(new MyTest(2,1,0,2040,20400));
+
+    const MyFastContainer_T::index<MySimdTag>::type& simd = fastcontainer.get<MySimdTag>();
+    const MyFastContainer_T::index<MyPackedTag>::type& packed = fastcontainer.get<MyPackedTag>();
+    std::copy(simd.begin(), simd.end(), std::ostream_iterator<MyTest*>(cout));
+    if (!std::equal(simd.begin(), simd.end(), packed.begin()))
+        cout << "the packed order is different" << endl;
+
+    MyIndex keys[] = { MyIndex(2,1,0), MyIndex(-1,5,0), MyIndex(2,1,2) };
+    for (size_t i = 0; i < sizeof(keys) / sizeof(keys[0]); i++)
+    {
+        MyFastContainer_T::index<MySimdTag>::type::const_iterator iter = simd.find(keys[i]);
+        MyFastContainer_T::index<MyPackedTag>::type::const_iterator packedIter = packed.find(pack_index(keys[i]));
+        if ((simd.end() == iter) != (packed.end() == packedIter) || (iter != simd.end() && *iter != *packedIter))
+            keys[i].print("found differently");
+        else if (simd.end() == iter)
+            keys[i].print("not found");
+        else
+            (*iter)->print(", found");
+    }
+
+    for (MyFastContainer_T::iterator iter = fastcontainer.begin(); iter != fastcontainer.end(); ++iter)
+        delete *iter;
+    fastcontainer.clear();
+}
+
+void test_arena()
+{
+    MyContainer<MyArenaContainer_T, MyIndexTag, MyTest, MyIndex, ArenaStorage> arenacontainer;
+    MonotonicArena& arena = arenacontainer.get_storage().arena;
+
+    for (int x = 1; x <= 2; x++)
+        for (int y = 1; y <= 3; y++)
+            for (int z = 1; z <= 3; z++)
+                arenacontainer.insert(new (arena) MyTest(x, y, z, x * 100 + y * 10 + z, x * 1000 + y * 100 + z * 10));
+
+    arenacontainer.find(MyIndex(2,2,2));
+    arenacontainer.find(MyIndex(3,3,3));
+    cout << arenacontainer.size() << " in the arena" << endl;
+
+    arenacontainer.free();
+    cout << arenacontainer.size() << " after free" << endl;
+}
+
+//MyTest stored in the nodes: made there by emplace, destructed when erased
+void test_emplace()
+{
+    MyContainer<MyValueContainer_T, MyIndexTag, MyTest, MyIndex> valuecontainer;
+
+    valuecontainer.emplace(3,1,2,1010,10100);
+    valuecontainer.emplace(3,1,1,1020,10200);
+    valuecontainer.emplace(3,1,3,1030,10300);
+    if (!valuecontainer.emplace(3,1,1,1040,10400))
+        MyIndex(3,1,1).print("already there");
+
+    valuecontainer.print();
+    valuecontainer.find(MyIndex(3,1,1));
+    valuecontainer.find(MyIndex(3,1,4));
+
+    valuecontainer.free();
+    cout << valuecontainer.size() << " after free" << endl;
+}
+
+//the calls of ConcurrentContainer, from one thread; a reader keeps what it
+//found alive until release(), erased elements are deleted by a later write or free()
+void test_concurrent()
+{
+    ConcurrentContainer<MyContainer_T, MyIndexTag, MyTest, MyIndex, 4> concurrentcontainer;
+    ConcurrentContainer<MyContainer_T, MyIndexTag, MyTest, MyIndex, 4>::reader reader(concurrentcontainer);
+
+    concurrentcontainer.insert(new MyTest(4,1,1,2010,20100));
+    concurrentcontainer.insert(new MyTest(4,1,2,2020,20200));
+    concurrentcontainer.insert(new MyTest(4,2,1,2030,20300));
+
+    MyTest* found = reader.find(MyIndex(4,1,2));
+    cout << concurrentcontainer.erase(MyIndex(4,1,2)) << " erased while a reader holds it" << endl;
+    found->print(", still readable");
+    if (NULL == reader.find(MyIndex(4,1,2)))
+        MyIndex(4,1,2).print("not found");
+    reader.release();
+
+    std::vector<MyTest*> range;
+    reader.equal_range(MyIndex(4,2,1), range);
+    reader.release();
+    cout << range.size() << " in range, " << concurrentcontainer.size() << " in the container" << endl;
+
+    concurrentcontainer.free();
+}
+
+//the MyContainer calls over 4 shards; a range is gathered from all of them, in index order
+void test_sharded()
+{
+    MyContainer<sharded_container<MyContainer_T, 4>, MyIndexTag, MyTest, MyIndex> shardedcontainer;
+
+    for (int z = 2; z >= 1; z--)
+        for (int y = 1; y <= 3; y++)
+            shardedcontainer.insert(new MyTest(5, y, z, 3000 + y * 10 + z, 30000 + y * 100 + z * 10));
+
+    shardedcontainer.print();
+    shardedcontainer.find(MyIndex(5,2,1));
+    shardedcontainer.find(MyIndex(5,4,1));
+
+    std::vector<MyTest*> range;
+    shardedcontainer.get_container().range<MyIndexTag>(MyIndex(5,1,2), MyIndex(5,3,1), range);
+    for (size_t i = 0; i < range.size(); i++)
+        range[i]->print(", in range");
+
+    shardedcontainer.free();
+    cout << shardedcontainer.size() << " after free" << endl;
 }
 
 int main()
@@ -260,12 +1811,34 @@ int main()
     test1();
     test3();
     test5();
+    test_bulk();
 
     mycontainer.print();
 
     cout<<endl;
     test_find();
 
+    cout<<endl;
+    test_frozen();
+
+    cout<<endl;
+    test_find_many_sorted();
+
+    cout<<endl;
+    test_fast_keys();
+
+    cout<<endl;
+    test_arena();
+
+    cout<<endl;
+    test_emplace();
+
+    cout<<endl;
+    test_concurrent();
+
+    cout<<endl;
+    test_sharded();
+
     cout<<endl;
     mycontainer.free();
 
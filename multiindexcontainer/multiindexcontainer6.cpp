@@ -0,0 +1,267 @@
+/**
+ * boost multi index container test: bulk_insert against a loop of insert
+ * platform: win32, visual studio 2005/2010; Linux, gcc4.1.2
+ * usage: multiindexcontainer6 [records] [threads]
+ */
+
+#include <iostream>
+#include <vector>
+#include <algorithm>
+#include <cstdlib>
+#include "boost/multi_index_container.hpp"
+#include "boost/multi_index/member.hpp"
+#include "boost/multi_index/ordered_index.hpp"
+#include "boost/thread/thread.hpp"
+#include "boost/date_time/posix_time/posix_time.hpp"
+
+using namespace std;
+using namespace boost::multi_index;
+using boost::multi_index_container;
+
+//define multiple index
+typedef struct MyIndex
+{
+    int x;
+    int y;
+    int z;
+
+    MyIndex(int ax = 0, int ay = 0, int az = 0): x(ax), y(ay), z(az){}
+}MyIndex;
+
+bool operator<(const MyIndex& lhs, const MyIndex& rhs)
+{
+    if (lhs.x < rhs.x) return true;
+    else if (lhs.x > rhs.x) return false;
+    else if (lhs.y < rhs.y) return true;
+    else if (lhs.y > rhs.y) return false;
+    else if (lhs.z < rhs.z) return true;
+    else if (lhs.z > rhs.z) return false;
+    else return false;
+}
+
+//define object to be indexed; unlike MyTest it prints nothing when destructed
+class MyRecord
+{
+public:
+    MyIndex myIndex;
+    int a;
+    int b;
+
+    MyRecord(int x, int y, int z, int aa, int ab): myIndex(x, y, z), a(aa), b(ab){}
+
+private:
+    MyRecord(const MyRecord&);
+    MyRecord& operator= (const MyRecord&);
+};
+
+//define index tag, multi_index_container, and its type
+struct MyIndexTag{};
+typedef multi_index_container<
+    MyRecord*,
+    indexed_by<
+        ordered_unique<
+            tag<MyIndexTag>,  member<MyRecord, MyIndex, &MyRecord::myIndex> > >
+>MyContainer_T;
+
+//ranges shorter than this are sorted by the calling thread
+const size_t PARALLEL_SORT_MIN = 16384;
+
+//sort [first, last) on up to threads threads: the halves are sorted at the same time, then merged
+template <class RandomIterator_T, class Compare_T>
+void parallel_sort(RandomIterator_T first, RandomIterator_T last, Compare_T comp, unsigned threads)
+{
+    if (threads < 2 || (size_t)(last - first) < PARALLEL_SORT_MIN)
+    {
+        std::sort(first, last, comp);
+        return;
+    }
+
+    RandomIterator_T middle = first + (last - first) / 2;
+    boost::thread left(parallel_sort<RandomIterator_T, Compare_T>, first, middle, comp, threads / 2);
+    parallel_sort(middle, last, comp, threads - threads / 2);
+    left.join();
+    std::inplace_merge(first, middle, last, comp);
+}
+
+//compare two elements by the key of an index, to sort them in its order
+template <class Index_T>
+struct KeyLess
+{
+    KeyLess(const Index_T& index): key(index.key_extractor()), comp(index.key_comp()){}
+
+    template <class Value_T>
+    bool operator()(const Value_T& lhs, const Value_T& rhs) const
+    {
+        return comp(key(lhs), key(rhs));
+    }
+
+    typename Index_T::key_from_value key;
+    typename Index_T::key_compare comp;
+};
+
+//the MyContainer of multiindexcontainer5, with what the benchmark needs
+template <class MultiIndexContainer_T, class Tag_T, class Data_T, class Index_T>
+class MyContainer
+{
+    MultiIndexContainer_T theContainer;
+
+public:
+    void insert(Data_T* data);
+    template <class InputIterator_T>
+    size_t bulk_insert(InputIterator_T first, InputIterator_T last, unsigned threads = 0);
+    bool find(const Index_T& index);
+    bool check();
+    size_t size() const { return theContainer.size(); }
+    void clear() { theContainer.clear(); }
+};
+
+template <class MultiIndexContainer_T, class Tag_T, class Data_T, class Index_T>
+void MyContainer<MultiIndexContainer_T, Tag_T, Data_T, Index_T>::insert(Data_T* data)
+{
+    theContainer.insert(data);
+}
+
+//insert [first, last) at once, returns the number inserted. The elements are
+//sorted by the key of Tag_T on threads threads (0: one per core) and go in in
+//that order, each one with the element after it as hint: appended to an empty
+//index or merged into a filled one, no insert searches the tree from the root
+template <class MultiIndexContainer_T, class Tag_T, class Data_T, class Index_T>
+template <class InputIterator_T>
+size_t MyContainer<MultiIndexContainer_T, Tag_T, Data_T, Index_T>::bulk_insert(InputIterator_T first, InputIterator_T last, unsigned threads)
+{
+    typedef typename boost::multi_index::index<MultiIndexContainer_T, Tag_T>::type index_type;
+    typedef typename MultiIndexContainer_T::value_type value_type;
+
+    index_type& indexSet = get<Tag_T>(theContainer);
+    KeyLess<index_type> less(indexSet);
+
+    std::vector<value_type> sorted(first, last);
+    if (0 == threads)
+        threads = boost::thread::hardware_concurrency();
+    parallel_sort(sorted.begin(), sorted.end(), less, threads);
+
+    size_t before = indexSet.size();
+    typename index_type::iterator hint = indexSet.begin();
+    for (typename std::vector<value_type>::iterator iter = sorted.begin(); iter != sorted.end(); ++iter)
+    {
+        //skip what is already in the index and goes before this one
+        while (hint != indexSet.end() && !less(*iter, *hint))
+            ++hint;
+        indexSet.insert(hint, *iter);
+    }
+    return indexSet.size() - before;
+}
+
+template <class MultiIndexContainer_T, class Tag_T, class Data_T, class Index_T>
+bool MyContainer<MultiIndexContainer_T, Tag_T, Data_T, Index_T>::find(const Index_T& index)
+{
+    const typename boost::multi_index::index<MultiIndexContainer_T, Tag_T>::type& indexSet = get<Tag_T>(theContainer);
+    return indexSet.find(index) != indexSet.end();
+}
+
+//the index is in strictly ascending order
+template <class MultiIndexContainer_T, class Tag_T, class Data_T, class Index_T>
+bool MyContainer<MultiIndexContainer_T, Tag_T, Data_T, Index_T>::check()
+{
+    typedef typename boost::multi_index::index<MultiIndexContainer_T, Tag_T>::type index_type;
+    const index_type& indexSet = get<Tag_T>(theContainer);
+    KeyLess<index_type> less(indexSet);
+
+    typename index_type::const_iterator prev = indexSet.begin();
+    if (prev == indexSet.end())
+        return true;
+    for (typename index_type::const_iterator iter = prev; ++iter != indexSet.end(); prev = iter)
+    {
+        if (!less(*prev, *iter))
+            return false;
+    }
+    return true;
+}
+
+typedef MyContainer<MyContainer_T, MyIndexTag, MyRecord, MyIndex> MyRecordContainer;
+
+//milliseconds since start
+long elapsed(const boost::posix_time::ptime& start)
+{
+    return (long)(boost::posix_time::microsec_clock::universal_time() - start).total_milliseconds();
+}
+
+//the same random order on every platform
+unsigned next_random(unsigned& seed)
+{
+    seed = seed * 1103515245 + 12345;
+    return (seed >> 8) & 0xffffff;
+}
+
+void report(const char* name, long ms, long base, MyRecordContainer& container, size_t expected)
+{
+    cout << name << ms << " ms";
+    if (ms > 0)
+        cout << ", speedup " << (double)base / ms;
+    cout << ((container.size() == expected && container.check()) ? "" : ", WRONG RESULT") << endl;
+}
+
+int main(int argc, char* argv[])
+{
+    size_t count = argc > 1 ? (size_t)atol(argv[1]) : 1000000;
+    unsigned threads = argc > 2 ? (unsigned)atoi(argv[2]) : boost::thread::hardware_concurrency();
+    if (0 == threads)
+        threads = 1;
+
+    //(x, y, z) unique, in random order
+    vector<MyRecord*> records;
+    records.reserve(count);
+    for (size_t i = 0; i < count; i++)
+        records.push_back(new MyRecord((int)(i / 10000), (int)(i / 100 % 100), (int)(i % 100), (int)i, (int)(i * 10)));
+    unsigned seed = 1;
+    for (size_t i = count; i > 1; i--)
+        std::swap(records[i - 1], records[next_random(seed) % i]);
+
+    cout << count << " records, " << threads << " threads" << endl;
+
+    MyRecordContainer container;
+    boost::posix_time::ptime start = boost::posix_time::microsec_clock::universal_time();
+    for (size_t i = 0; i < count; i++)
+        container.insert(records[i]);
+    long loop = elapsed(start);
+    report("insert loop:                       ", loop, loop, container, count);
+    container.clear();
+
+    start = boost::posix_time::microsec_clock::universal_time();
+    container.bulk_insert(records.begin(), records.end(), 1);
+    report("bulk_insert, 1 thread:             ", elapsed(start), loop, container, count);
+    container.clear();
+
+    start = boost::posix_time::microsec_clock::universal_time();
+    container.bulk_insert(records.begin(), records.end(), threads);
+    report("bulk_insert, all threads:          ", elapsed(start), loop, container, count);
+    container.clear();
+
+    //the second half into a container which holds the first half
+    size_t half = count / 2;
+    for (size_t i = 0; i < half; i++)
+        container.insert(records[i]);
+    start = boost::posix_time::microsec_clock::universal_time();
+    for (size_t i = half; i < count; i++)
+        container.insert(records[i]);
+    long merge_loop = elapsed(start);
+    report("insert loop into half full:        ", merge_loop, merge_loop, container, count);
+    container.clear();
+
+    for (size_t i = 0; i < half; i++)
+        container.insert(records[i]);
+    start = boost::posix_time::microsec_clock::universal_time();
+    container.bulk_insert(records.begin() + half, records.end(), threads);
+    report("bulk_insert merge into half full:  ", elapsed(start), merge_loop, container, count);
+
+    size_t found = 0;
+    for (size_t i = 0; i < count; i += count / 100 + 1)
+        found += container.find(records[i]->myIndex) ? 1 : 0;
+    cout << "sample finds: " << found << " of " << (count - 1) / (count / 100 + 1) + 1 << endl;
+    container.clear();
+
+    for (size_t i = 0; i < count; i++)
+        delete records[i];
+
+    return 0;
+}
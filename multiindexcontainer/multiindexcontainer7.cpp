@@ -0,0 +1,318 @@
+/**
+ * boost multi index container test: find_many_sorted against a loop of find
+ * platform: win32, visual studio 2005/2010; Linux, gcc4.1.2
+ * usage: multiindexcontainer7 [records] [probes]
+ */
+
+#include <iostream>
+#include <vector>
+#include <algorithm>
+#include <cstdlib>
+#include "boost/multi_index_container.hpp"
+#include "boost/multi_index/member.hpp"
+#include "boost/multi_index/ordered_index.hpp"
+#include "boost/date_time/posix_time/posix_time.hpp"
+
+using namespace std;
+using namespace boost::multi_index;
+using boost::multi_index_container;
+
+//define multiple index
+typedef struct MyIndex
+{
+    int x;
+    int y;
+    int z;
+
+    MyIndex(int ax = 0, int ay = 0, int az = 0): x(ax), y(ay), z(az){}
+}MyIndex;
+
+bool operator<(const MyIndex& lhs, const MyIndex& rhs)
+{
+    if (lhs.x < rhs.x) return true;
+    else if (lhs.x > rhs.x) return false;
+    else if (lhs.y < rhs.y) return true;
+    else if (lhs.y > rhs.y) return false;
+    else if (lhs.z < rhs.z) return true;
+    else if (lhs.z > rhs.z) return false;
+    else return false;
+}
+
+//define object to be indexed; unlike MyTest it prints nothing when destructed
+class MyRecord
+{
+public:
+    MyIndex myIndex;
+    int a;
+    int b;
+
+    MyRecord(int x, int y, int z, int aa, int ab): myIndex(x, y, z), a(aa), b(ab){}
+
+private:
+    MyRecord(const MyRecord&);
+    MyRecord& operator= (const MyRecord&);
+};
+
+//define index tag, multi_index_container, and its type
+struct MyIndexTag{};
+typedef multi_index_container<
+    MyRecord*,
+    indexed_by<
+        ordered_unique<
+            tag<MyIndexTag>,  member<MyRecord, MyIndex, &MyRecord::myIndex> > >
+>MyContainer_T;
+
+//ask the cache for the memory at p before it is read
+#if defined(__GNUC__)
+#define PREFETCH(p) __builtin_prefetch(p)
+#elif defined(_MSC_VER)
+#include <xmmintrin.h>
+#define PREFETCH(p) _mm_prefetch((const char*)(p), _MM_HINT_T0)
+#else
+#define PREFETCH(p)
+#endif
+
+//an index of pointers keeps its keys in the objects pointed to
+template <class Value_T>
+inline void prefetch_value(Value_T* const& value)
+{
+    PREFETCH(value);
+}
+
+template <class Value_T>
+inline void prefetch_value(const Value_T& value)
+{
+    PREFETCH(&value);
+}
+
+//find_many_sorted walks this many elements from the last one found before it searches from the root
+const int FINGER_STEPS = 8;
+
+//compare positions in an array of keys by the keys, to visit them in order
+template <class Key_T, class Compare_T>
+struct ProbeLess
+{
+    ProbeLess(const Key_T* akeys, const Compare_T& acomp): keys(akeys), comp(acomp){}
+
+    bool operator()(size_t lhs, size_t rhs) const
+    {
+        return comp(keys[lhs], keys[rhs]);
+    }
+
+    const Key_T* keys;
+    Compare_T comp;
+};
+
+//the MyContainer of multiindexcontainer5, with what the benchmark needs
+template <class MultiIndexContainer_T, class Tag_T, class Data_T, class Index_T>
+class MyContainer
+{
+    MultiIndexContainer_T theContainer;
+
+public:
+    void insert(Data_T* data);
+    Data_T* find(const Index_T& index);
+    template <class KeyIterator_T>
+    size_t find_many_sorted(KeyIterator_T first, KeyIterator_T last, std::vector<Data_T*>& found, bool prefetch = true);
+    size_t size() const { return theContainer.size(); }
+    void clear() { theContainer.clear(); }
+};
+
+template <class MultiIndexContainer_T, class Tag_T, class Data_T, class Index_T>
+void MyContainer<MultiIndexContainer_T, Tag_T, Data_T, Index_T>::insert(Data_T* data)
+{
+    theContainer.insert(data);
+}
+
+template <class MultiIndexContainer_T, class Tag_T, class Data_T, class Index_T>
+Data_T* MyContainer<MultiIndexContainer_T, Tag_T, Data_T, Index_T>::find(const Index_T& index)
+{
+    const typename boost::multi_index::index<MultiIndexContainer_T, Tag_T>::type& indexSet = get<Tag_T>(theContainer);
+    const typename boost::multi_index::index<MultiIndexContainer_T, Tag_T>::type::iterator iter = indexSet.find(index);
+    return indexSet.end() == iter ? NULL : *iter;
+}
+
+//look up the keys [first, last) at once, returns the number found. found[i] is
+//the element of the i-th key, NULL if there is none. The gain is the order:
+//the keys are sorted and visited in index order, so each search finds the
+//upper levels of the tree (and the elements between near keys) still in the
+//cache from the one before. The next one is looked for by walking on from the
+//last one found, and only when it is more than FINGER_STEPS away is the tree
+//searched from the root again. The nodes of the tree are not reachable
+//through the index, so nothing prefetches the path of a search; with prefetch
+//the walk asks for the object of the element after the finger, which holds
+//the key of an index of pointers. compare() measures it against no prefetch,
+//the way multiindexcontainer5 walks
+template <class MultiIndexContainer_T, class Tag_T, class Data_T, class Index_T>
+template <class KeyIterator_T>
+size_t MyContainer<MultiIndexContainer_T, Tag_T, Data_T, Index_T>::find_many_sorted(KeyIterator_T first, KeyIterator_T last, std::vector<Data_T*>& found, bool prefetch)
+{
+    typedef typename boost::multi_index::index<MultiIndexContainer_T, Tag_T>::type index_type;
+    typedef typename index_type::key_compare key_compare;
+
+    const index_type& indexSet = get<Tag_T>(theContainer);
+    const typename index_type::key_from_value key = indexSet.key_extractor();
+    const key_compare comp = indexSet.key_comp();
+
+    std::vector<Index_T> keys(first, last);
+    found.assign(keys.size(), (Data_T*)NULL);
+    if (keys.empty())
+        return 0;
+
+    std::vector<size_t> order(keys.size());
+    for (size_t i = 0; i < order.size(); i++)
+        order[i] = i;
+    std::sort(order.begin(), order.end(), ProbeLess<Index_T, key_compare>(&keys[0], comp));
+
+    size_t count = 0;
+    int limit = FINGER_STEPS;
+    typename index_type::const_iterator finger = indexSet.begin();
+    for (std::vector<size_t>::const_iterator pos = order.begin(); pos != order.end(); ++pos)
+    {
+        const Index_T& index = keys[*pos];
+
+        //after a search from the root the keys are far apart, only look at the next element
+        int steps = 0;
+        while (finger != indexSet.end() && comp(key(*finger), index))
+        {
+            if (++steps > limit)
+            {
+                finger = indexSet.lower_bound(index);
+                break;
+            }
+
+            ++finger;
+            typename index_type::const_iterator next = finger;
+            if (prefetch && next != indexSet.end() && ++next != indexSet.end())
+                prefetch_value(*next);
+        }
+
+        limit = steps > limit ? 1 : FINGER_STEPS;
+
+        if (finger != indexSet.end() && !comp(index, key(*finger)))
+        {
+            found[*pos] = *finger;
+            count++;
+        }
+    }
+    return count;
+}
+
+typedef MyContainer<MyContainer_T, MyIndexTag, MyRecord, MyIndex> MyRecordContainer;
+
+//milliseconds since start
+long elapsed(const boost::posix_time::ptime& start)
+{
+    return (long)(boost::posix_time::microsec_clock::universal_time() - start).total_milliseconds();
+}
+
+//the same random order on every platform
+unsigned next_random(unsigned& seed)
+{
+    seed = seed * 1103515245 + 12345;
+    return (seed >> 8) & 0xffffff;
+}
+
+//the key of record i; z of 100 and more is never inserted
+MyIndex record_index(size_t i)
+{
+    return MyIndex((int)(i / 10000), (int)(i / 100 % 100), (int)(i % 100));
+}
+
+//the same probes through find, through find on the sorted probes (what the
+//order alone is worth), and through find_many_sorted without and with prefetch
+void compare(const char* name, MyRecordContainer& container, const vector<MyIndex>& keys)
+{
+    boost::posix_time::ptime start = boost::posix_time::microsec_clock::universal_time();
+    vector<MyRecord*> single(keys.size());
+    size_t single_count = 0;
+    for (size_t i = 0; i < keys.size(); i++)
+    {
+        single[i] = container.find(keys[i]);
+        single_count += single[i] ? 1 : 0;
+    }
+    long loop = elapsed(start);
+
+    start = boost::posix_time::microsec_clock::universal_time();
+    vector<MyIndex> sorted(keys);
+    std::sort(sorted.begin(), sorted.end());
+    size_t sorted_count = 0;
+    for (size_t i = 0; i < sorted.size(); i++)
+        sorted_count += container.find(sorted[i]) ? 1 : 0;
+    long sorted_loop = elapsed(start);
+
+    start = boost::posix_time::microsec_clock::universal_time();
+    vector<MyRecord*> plain;
+    size_t plain_count = container.find_many_sorted(keys.begin(), keys.end(), plain, false);
+    long walk = elapsed(start);
+
+    start = boost::posix_time::microsec_clock::universal_time();
+    vector<MyRecord*> many;
+    size_t many_count = container.find_many_sorted(keys.begin(), keys.end(), many);
+    long batch = elapsed(start);
+
+    bool same = sorted_count == single_count && plain_count == single_count && plain == single &&
+        many_count == single_count && many == single;
+    cout << name << keys.size() << " probes, " << single_count << " found" << endl;
+    cout << "    find loop: " << loop << " ms, sorted find loop: " << sorted_loop << " ms" << endl;
+    cout << "    find_many_sorted: " << walk << " ms without prefetch, " << batch << " ms with it";
+    if (batch > 0)
+        cout << ", speedup " << (double)loop / batch;
+    cout << (same ? "" : ", WRONG RESULT") << endl;
+}
+
+int main(int argc, char* argv[])
+{
+    size_t count = argc > 1 ? (size_t)atol(argv[1]) : 1000000;
+    size_t probes = argc > 2 ? (size_t)atol(argv[2]) : count;
+    if (0 == count || 0 == probes)
+    {
+        cout << "usage: multiindexcontainer7 [records] [probes]" << endl;
+        return 1;
+    }
+
+    //(x, y, z) unique, inserted in random order
+    vector<MyRecord*> records;
+    records.reserve(count);
+    for (size_t i = 0; i < count; i++)
+    {
+        MyIndex index = record_index(i);
+        records.push_back(new MyRecord(index.x, index.y, index.z, (int)i, (int)(i * 10)));
+    }
+    unsigned seed = 1;
+    for (size_t i = count; i > 1; i--)
+        std::swap(records[i - 1], records[next_random(seed) % i]);
+
+    MyRecordContainer container;
+    for (size_t i = 0; i < count; i++)
+        container.insert(records[i]);
+    cout << count << " records" << endl;
+
+    //random keys, one in eight of them not in the container
+    vector<MyIndex> keys(probes);
+    for (size_t i = 0; i < probes; i++)
+    {
+        keys[i] = record_index(next_random(seed) % count);
+        if (0 == next_random(seed) % 8)
+            keys[i].z += 100;
+    }
+    compare("random:      ", container, keys);
+
+    //every key, in order
+    keys.resize(count);
+    for (size_t i = 0; i < count; i++)
+        keys[i] = record_index(i);
+    compare("in order:    ", container, keys);
+
+    //a few random keys spread over the whole container
+    keys.resize(count / 100 + 1);
+    for (size_t i = 0; i < keys.size(); i++)
+        keys[i] = record_index(next_random(seed) % count);
+    compare("sparse:      ", container, keys);
+
+    container.clear();
+    for (size_t i = 0; i < count; i++)
+        delete records[i];
+
+    return 0;
+}
@@ -0,0 +1,277 @@
+/**
+ * boost multi index container test: flat_index against the ordered index it copies
+ * platform: win32, visual studio 2005/2010; Linux, gcc4.1.2
+ * usage: multiindexcontainer8 [records] [probes]
+ */
+
+#include <iostream>
+#include <vector>
+#include <algorithm>
+#include <cstdlib>
+#include "boost/multi_index_container.hpp"
+#include "boost/multi_index/member.hpp"
+#include "boost/multi_index/ordered_index.hpp"
+#include "boost/date_time/posix_time/posix_time.hpp"
+
+using namespace std;
+using namespace boost::multi_index;
+using boost::multi_index_container;
+
+//define multiple index
+typedef struct MyIndex
+{
+    int x;
+    int y;
+    int z;
+
+    MyIndex(int ax = 0, int ay = 0, int az = 0): x(ax), y(ay), z(az){}
+}MyIndex;
+
+bool operator<(const MyIndex& lhs, const MyIndex& rhs)
+{
+    if (lhs.x < rhs.x) return true;
+    else if (lhs.x > rhs.x) return false;
+    else if (lhs.y < rhs.y) return true;
+    else if (lhs.y > rhs.y) return false;
+    else if (lhs.z < rhs.z) return true;
+    else if (lhs.z > rhs.z) return false;
+    else return false;
+}
+
+//define object to be indexed; unlike MyTest it prints nothing when destructed
+class MyRecord
+{
+public:
+    MyIndex myIndex;
+    int a;
+    int b;
+
+    MyRecord(int x, int y, int z, int aa, int ab): myIndex(x, y, z), a(aa), b(ab){}
+
+private:
+    MyRecord(const MyRecord&);
+    MyRecord& operator= (const MyRecord&);
+};
+
+//define index tag, multi_index_container, and its type
+struct MyIndexTag{};
+typedef multi_index_container<
+    MyRecord*,
+    indexed_by<
+        ordered_unique<
+            tag<MyIndexTag>,  member<MyRecord, MyIndex, &MyRecord::myIndex> > >
+>MyContainer_T;
+
+//a read only copy of an ordered index: the keys in one sorted array, the
+//elements in another one beside it. A lookup is a binary search over the
+//keys alone, no node or element is read until the key is there
+template <class Key_T, class Value_T, class Compare_T = std::less<Key_T> >
+class flat_index
+{
+public:
+    typedef Key_T key_type;
+    typedef Value_T value_type;
+    typedef Compare_T key_compare;
+    typedef typename std::vector<Value_T>::const_iterator const_iterator;
+    typedef const_iterator iterator;
+
+    flat_index(const Compare_T& acomp = Compare_T()): comp(acomp){}
+
+    //copy an ordered index with the same key, it is in order already
+    template <class OrderedIndex_T>
+    void assign(const OrderedIndex_T& index)
+    {
+        const typename OrderedIndex_T::key_from_value key = index.key_extractor();
+
+        keys.clear();
+        values.clear();
+        keys.reserve(index.size());
+        values.reserve(index.size());
+        for (typename OrderedIndex_T::const_iterator iter = index.begin(); iter != index.end(); ++iter)
+        {
+            keys.push_back(key(*iter));
+            values.push_back(*iter);
+        }
+        comp = index.key_comp();
+    }
+
+    const_iterator begin() const { return values.begin(); }
+    const_iterator end() const { return values.end(); }
+    size_t size() const { return values.size(); }
+    bool empty() const { return values.empty(); }
+
+    const_iterator lower_bound(const Key_T& key) const
+    {
+        return at(std::lower_bound(keys.begin(), keys.end(), key, comp));
+    }
+
+    const_iterator upper_bound(const Key_T& key) const
+    {
+        return at(std::upper_bound(keys.begin(), keys.end(), key, comp));
+    }
+
+    std::pair<const_iterator, const_iterator> equal_range(const Key_T& key) const
+    {
+        std::pair<typename std::vector<Key_T>::const_iterator, typename std::vector<Key_T>::const_iterator> range =
+            std::equal_range(keys.begin(), keys.end(), key, comp);
+        return std::make_pair(at(range.first), at(range.second));
+    }
+
+    const_iterator find(const Key_T& key) const
+    {
+        typename std::vector<Key_T>::const_iterator iter = std::lower_bound(keys.begin(), keys.end(), key, comp);
+        if (iter == keys.end() || comp(key, *iter))
+            return end();
+        return at(iter);
+    }
+
+    size_t count(const Key_T& key) const
+    {
+        std::pair<const_iterator, const_iterator> range = equal_range(key);
+        return range.second - range.first;
+    }
+
+private:
+    const_iterator at(typename std::vector<Key_T>::const_iterator iter) const
+    {
+        return values.begin() + (iter - keys.begin());
+    }
+
+    std::vector<Key_T> keys;
+    std::vector<Value_T> values;
+    Compare_T comp;
+};
+
+typedef MyContainer_T::index<MyIndexTag>::type MyContainerIndex_T;
+typedef flat_index<MyIndex, MyRecord*> MyFlatIndex_T;
+
+//milliseconds since start
+long elapsed(const boost::posix_time::ptime& start)
+{
+    return (long)(boost::posix_time::microsec_clock::universal_time() - start).total_milliseconds();
+}
+
+//the same random order on every platform
+unsigned next_random(unsigned& seed)
+{
+    seed = seed * 1103515245 + 12345;
+    return (seed >> 8) & 0xffffff;
+}
+
+//a larger random number, for more than 16M records
+size_t next_random_large(unsigned& seed)
+{
+    size_t high = next_random(seed);
+    return (high << 24) | next_random(seed);
+}
+
+//the key of record i; z of 100 and more is never inserted
+MyIndex record_index(size_t i)
+{
+    return MyIndex((int)(i / 10000), (int)(i / 100 % 100), (int)(i % 100));
+}
+
+void report(const char* name, long tree, long flat, size_t probes, bool same)
+{
+    cout << name << "ordered_unique " << tree << " ms (" << tree * 1000000.0 / probes << " ns each), ";
+    cout << "flat_index " << flat << " ms (" << flat * 1000000.0 / probes << " ns each)";
+    if (flat > 0)
+        cout << ", speedup " << (double)tree / flat;
+    cout << (same ? "" : ", WRONG RESULT") << endl;
+}
+
+int main(int argc, char* argv[])
+{
+    size_t count = argc > 1 ? (size_t)atol(argv[1]) : 10000000;
+    size_t probes = argc > 2 ? (size_t)atol(argv[2]) : 1000000;
+    if (0 == count || 0 == probes)
+    {
+        cout << "usage: multiindexcontainer8 [records] [probes]" << endl;
+        return 1;
+    }
+
+    //(x, y, z) unique, inserted in random order so that the tree nodes are spread over the heap
+    vector<MyRecord*> records;
+    records.reserve(count);
+    for (size_t i = 0; i < count; i++)
+    {
+        MyIndex index = record_index(i);
+        records.push_back(new MyRecord(index.x, index.y, index.z, (int)i, (int)(i * 10)));
+    }
+    unsigned seed = 1;
+    for (size_t i = count; i > 1; i--)
+        std::swap(records[i - 1], records[next_random_large(seed) % i]);
+
+    MyContainer_T container;
+    for (size_t i = 0; i < count; i++)
+        container.insert(records[i]);
+    const MyContainerIndex_T& tree = container.get<MyIndexTag>();
+
+    boost::posix_time::ptime start = boost::posix_time::microsec_clock::universal_time();
+    MyFlatIndex_T flat;
+    flat.assign(tree);
+    cout << count << " records, flat_index built in " << elapsed(start) << " ms" << endl;
+
+    //random keys, one in eight of them not in the container
+    vector<MyIndex> keys(probes);
+    for (size_t i = 0; i < probes; i++)
+    {
+        keys[i] = record_index(next_random_large(seed) % count);
+        if (0 == next_random(seed) % 8)
+            keys[i].z += 100;
+    }
+
+    vector<MyRecord*> tree_found(probes), flat_found(probes);
+    start = boost::posix_time::microsec_clock::universal_time();
+    for (size_t i = 0; i < probes; i++)
+    {
+        MyContainerIndex_T::const_iterator iter = tree.find(keys[i]);
+        tree_found[i] = tree.end() == iter ? NULL : *iter;
+    }
+    long tree_ms = elapsed(start);
+    start = boost::posix_time::microsec_clock::universal_time();
+    for (size_t i = 0; i < probes; i++)
+    {
+        MyFlatIndex_T::const_iterator iter = flat.find(keys[i]);
+        flat_found[i] = flat.end() == iter ? NULL : *iter;
+    }
+    report("find:         ", tree_ms, elapsed(start), probes, tree_found == flat_found);
+
+    start = boost::posix_time::microsec_clock::universal_time();
+    for (size_t i = 0; i < probes; i++)
+    {
+        MyContainerIndex_T::const_iterator iter = tree.lower_bound(keys[i]);
+        tree_found[i] = tree.end() == iter ? NULL : *iter;
+    }
+    tree_ms = elapsed(start);
+    start = boost::posix_time::microsec_clock::universal_time();
+    for (size_t i = 0; i < probes; i++)
+    {
+        MyFlatIndex_T::const_iterator iter = flat.lower_bound(keys[i]);
+        flat_found[i] = flat.end() == iter ? NULL : *iter;
+    }
+    report("lower_bound:  ", tree_ms, elapsed(start), probes, tree_found == flat_found);
+
+    //how many of each key, the same on both
+    size_t tree_count = 0, flat_count = 0;
+    start = boost::posix_time::microsec_clock::universal_time();
+    for (size_t i = 0; i < probes; i++)
+    {
+        std::pair<MyContainerIndex_T::const_iterator, MyContainerIndex_T::const_iterator> range = tree.equal_range(keys[i]);
+        tree_count += std::distance(range.first, range.second);
+    }
+    tree_ms = elapsed(start);
+    start = boost::posix_time::microsec_clock::universal_time();
+    for (size_t i = 0; i < probes; i++)
+    {
+        std::pair<MyFlatIndex_T::const_iterator, MyFlatIndex_T::const_iterator> range = flat.equal_range(keys[i]);
+        flat_count += range.second - range.first;
+    }
+    report("equal_range:  ", tree_ms, elapsed(start), probes, tree_count == flat_count);
+
+    container.clear();
+    for (size_t i = 0; i < count; i++)
+        delete records[i];
+
+    return 0;
+}
@@ -0,0 +1,404 @@
+/**
+ * boost multi index container test: packed keys and the SIMD compare against the three field compare of MyIndex
+ * platform: win32, visual studio 2005/2010; Linux, gcc4.1.2
+ * usage: multiindexcontainer9 [records] [rounds]
+ */
+
+#include <iostream>
+#include <vector>
+#include <algorithm>
+#include <cstdlib>
+#include "boost/multi_index_container.hpp"
+#include "boost/multi_index/member.hpp"
+#include "boost/multi_index/ordered_index.hpp"
+#include "boost/cstdint.hpp"
+#include "boost/date_time/posix_time/posix_time.hpp"
+
+using namespace std;
+using namespace boost::multi_index;
+using boost::multi_index_container;
+
+//define multiple index
+typedef struct MyIndex
+{
+    int x;
+    int y;
+    int z;
+
+    MyIndex(int ax = 0, int ay = 0, int az = 0): x(ax), y(ay), z(az){}
+}MyIndex;
+
+//up to three 32 bit fields in one 128 bit word which sorts in the same order:
+//the sign bits are flipped so that unsigned order is signed order, and the
+//first field goes highest. Comparing two is two compares of 64 bits, no branch
+struct PackedIndex
+{
+    boost::uint64_t high;
+    boost::uint64_t low;
+
+    PackedIndex(boost::uint64_t ahigh = 0, boost::uint64_t alow = 0): high(ahigh), low(alow){}
+};
+
+inline boost::uint32_t pack_field(int field)
+{
+    return (boost::uint32_t)field ^ 0x80000000u;
+}
+
+inline PackedIndex pack_index(int x, int y, int z)
+{
+    return PackedIndex(((boost::uint64_t)pack_field(x) << 32) | pack_field(y), pack_field(z));
+}
+
+inline PackedIndex pack_index(const MyIndex& index)
+{
+    return pack_index(index.x, index.y, index.z);
+}
+
+//when every field is in [-PACK64_LIMIT, PACK64_LIMIT) 21 bits each are enough,
+//and the whole key is one 64 bit word, compared by a single instruction
+const int PACK64_BITS = 21;
+const int PACK64_LIMIT = 1 << (PACK64_BITS - 1);
+
+inline bool fits_pack64(int x, int y, int z)
+{
+    return x >= -PACK64_LIMIT && x < PACK64_LIMIT && y >= -PACK64_LIMIT && y < PACK64_LIMIT && z >= -PACK64_LIMIT && z < PACK64_LIMIT;
+}
+
+inline boost::uint64_t pack_index64(int x, int y, int z)
+{
+    return ((boost::uint64_t)(x + PACK64_LIMIT) << (2 * PACK64_BITS)) |
+        ((boost::uint64_t)(y + PACK64_LIMIT) << PACK64_BITS) | (boost::uint64_t)(z + PACK64_LIMIT);
+}
+
+inline bool operator<(const PackedIndex& lhs, const PackedIndex& rhs)
+{
+    return (lhs.high < rhs.high) | ((lhs.high == rhs.high) & (lhs.low < rhs.low));
+}
+
+inline bool operator==(const PackedIndex& lhs, const PackedIndex& rhs)
+{
+    return (lhs.high == rhs.high) & (lhs.low == rhs.low);
+}
+
+//a read only copy of an ordered index: the keys in one sorted array, the
+//elements in another one beside it. A lookup is a binary search over the
+//keys alone, no node or element is read until the key is there
+template <class Key_T, class Value_T, class Compare_T = std::less<Key_T> >
+class flat_index
+{
+public:
+    typedef Key_T key_type;
+    typedef Value_T value_type;
+    typedef Compare_T key_compare;
+    typedef typename std::vector<Value_T>::const_iterator const_iterator;
+    typedef const_iterator iterator;
+
+    flat_index(const Compare_T& acomp = Compare_T()): comp(acomp){}
+
+    //copy an ordered index with the same key, it is in order already
+    template <class OrderedIndex_T>
+    void assign(const OrderedIndex_T& index)
+    {
+        const typename OrderedIndex_T::key_from_value key = index.key_extractor();
+
+        keys.clear();
+        values.clear();
+        keys.reserve(index.size());
+        values.reserve(index.size());
+        for (typename OrderedIndex_T::const_iterator iter = index.begin(); iter != index.end(); ++iter)
+        {
+            keys.push_back(key(*iter));
+            values.push_back(*iter);
+        }
+        comp = index.key_comp();
+    }
+
+    const_iterator begin() const { return values.begin(); }
+    const_iterator end() const { return values.end(); }
+    size_t size() const { return values.size(); }
+    bool empty() const { return values.empty(); }
+
+    const_iterator lower_bound(const Key_T& key) const
+    {
+        return values.begin() + position(KeyBefore(comp, key));
+    }
+
+    const_iterator upper_bound(const Key_T& key) const
+    {
+        return values.begin() + position(KeyNotAfter(comp, key));
+    }
+
+    std::pair<const_iterator, const_iterator> equal_range(const Key_T& key) const
+    {
+        return std::make_pair(lower_bound(key), upper_bound(key));
+    }
+
+    const_iterator find(const Key_T& key) const
+    {
+        size_t pos = position(KeyBefore(comp, key));
+        if (pos == keys.size() || comp(key, keys[pos]))
+            return end();
+        return values.begin() + pos;
+    }
+
+    size_t count(const Key_T& key) const
+    {
+        std::pair<const_iterator, const_iterator> range = equal_range(key);
+        return range.second - range.first;
+    }
+
+private:
+    //a range this short is searched by counting the keys before the one looked for
+    enum { SCAN_KEYS = 16 };
+
+    //the keys of lower_bound and upper_bound
+    struct KeyBefore
+    {
+        KeyBefore(const Compare_T& acomp, const Key_T& akey): comp(acomp), key(akey){}
+        bool operator()(const Key_T& element) const { return comp(element, key); }
+        const Compare_T& comp;
+        const Key_T& key;
+    };
+
+    struct KeyNotAfter
+    {
+        KeyNotAfter(const Compare_T& acomp, const Key_T& akey): comp(acomp), key(akey){}
+        bool operator()(const Key_T& element) const { return !comp(key, element); }
+        const Compare_T& comp;
+        const Key_T& key;
+    };
+
+    //the number of keys for which before is true, they are all at the front.
+    //Each halving step picks the half with a conditional move instead of a
+    //branch, and the last SCAN_KEYS are counted in a loop without one, which
+    //the compiler can turn into a compare of several keys at once
+    template <class Before_T>
+    size_t position(const Before_T& before) const
+    {
+        if (keys.empty())
+            return 0;
+
+        const Key_T* base = &keys[0];
+        size_t length = keys.size();
+        while (length > SCAN_KEYS)
+        {
+            size_t half = length / 2;
+            base = before(base[half - 1]) ? base + half : base;
+            length -= half;
+        }
+
+        size_t count = 0;
+        for (size_t i = 0; i < length; i++)
+            count += before(base[i]) ? 1 : 0;
+        return (base - &keys[0]) + count;
+    }
+
+    std::vector<Key_T> keys;
+    std::vector<Value_T> values;
+    Compare_T comp;
+};
+
+//the compare multiindexcontainer5 had, field by field
+struct MyIndexLess
+{
+    bool operator()(const MyIndex& lhs, const MyIndex& rhs) const
+    {
+        if (lhs.x < rhs.x) return true;
+        else if (lhs.x > rhs.x) return false;
+        else if (lhs.y < rhs.y) return true;
+        else if (lhs.y > rhs.y) return false;
+        else if (lhs.z < rhs.z) return true;
+        else if (lhs.z > rhs.z) return false;
+        else return false;
+    }
+};
+
+//the three fields compared at once in SSE2 lanes: one mask of the lanes where
+//lhs is less, one where it is greater, and the lowest lane set in either (the
+//first field which differs) decides. The fourth lane is 0 on both sides
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+
+inline bool simd_less(const MyIndex& lhs, const MyIndex& rhs)
+{
+    __m128i l = _mm_set_epi32(0, lhs.z, lhs.y, lhs.x);
+    __m128i r = _mm_set_epi32(0, rhs.z, rhs.y, rhs.x);
+    int less = _mm_movemask_ps(_mm_castsi128_ps(_mm_cmplt_epi32(l, r)));
+    int greater = _mm_movemask_ps(_mm_castsi128_ps(_mm_cmpgt_epi32(l, r)));
+    int differ = less | greater;
+    return (less & differ & -differ) != 0;
+}
+#else
+inline bool simd_less(const MyIndex& lhs, const MyIndex& rhs)
+{
+    return lhs.x != rhs.x ? lhs.x < rhs.x : (lhs.y != rhs.y ? lhs.y < rhs.y : lhs.z < rhs.z);
+}
+#endif
+
+//the compare of an ordered index of MyIndex, the same order as MyIndexLess
+struct MyIndexSimdLess
+{
+    bool operator()(const MyIndex& lhs, const MyIndex& rhs) const
+    {
+        return simd_less(lhs, rhs);
+    }
+};
+
+//define object to be indexed; unlike MyTest it prints nothing when destructed
+class MyRecord
+{
+public:
+    MyIndex myIndex;
+    PackedIndex packedIndex;
+    boost::uint64_t packedIndex64;
+    int a;
+    int b;
+
+    MyRecord(int x, int y, int z, int aa, int ab): myIndex(x, y, z), packedIndex(pack_index(x, y, z)), packedIndex64(pack_index64(x, y, z)), a(aa), b(ab){}
+
+private:
+    MyRecord(const MyRecord&);
+    MyRecord& operator= (const MyRecord&);
+};
+
+//the same records in order of MyIndex, compared field by field or packed
+struct MyIndexTag{};
+struct MySimdTag{};
+struct MyPackedTag{};
+struct MyPacked64Tag{};
+typedef multi_index_container<
+    MyRecord*,
+    indexed_by<
+        ordered_unique<
+            tag<MyIndexTag>,  member<MyRecord, MyIndex, &MyRecord::myIndex>, MyIndexLess >,
+        ordered_unique<
+            tag<MySimdTag>,  member<MyRecord, MyIndex, &MyRecord::myIndex>, MyIndexSimdLess >,
+        ordered_unique<
+            tag<MyPackedTag>,  member<MyRecord, PackedIndex, &MyRecord::packedIndex> >,
+        ordered_unique<
+            tag<MyPacked64Tag>,  member<MyRecord, boost::uint64_t, &MyRecord::packedIndex64> > >
+>MyContainer_T;
+
+typedef MyContainer_T::index<MyIndexTag>::type MyContainerIndex_T;
+typedef flat_index<MyIndex, MyRecord*, MyIndexLess> MyFlatIndex_T;
+typedef flat_index<MyIndex, MyRecord*, MyIndexSimdLess> MyFlatSimd_T;
+typedef flat_index<PackedIndex, MyRecord*> MyFlatPacked_T;
+typedef flat_index<boost::uint64_t, MyRecord*> MyFlatPacked64_T;
+
+//milliseconds since start
+long elapsed(const boost::posix_time::ptime& start)
+{
+    return (long)(boost::posix_time::microsec_clock::universal_time() - start).total_milliseconds();
+}
+
+//the same random order on every platform
+unsigned next_random(unsigned& seed)
+{
+    seed = seed * 1103515245 + 12345;
+    return (seed >> 8) & 0xffffff;
+}
+
+//the key of record i, like the ones of test_find; z of 100 and more is never inserted
+MyIndex record_index(size_t i)
+{
+    return MyIndex((int)(i / 10000) - 50, (int)(i / 100 % 100), (int)(i % 100));
+}
+
+//find every key rounds times, returns the elements found, in order
+template <class Index_T, class Key_T>
+vector<MyRecord*> find_all(const char* name, const Index_T& index, const vector<Key_T>& keys, int rounds, long base)
+{
+    vector<MyRecord*> found(keys.size());
+    boost::posix_time::ptime start = boost::posix_time::microsec_clock::universal_time();
+    for (int round = 0; round < rounds; round++)
+    {
+        for (size_t i = 0; i < keys.size(); i++)
+        {
+            typename Index_T::const_iterator iter = index.find(keys[i]);
+            found[i] = index.end() == iter ? NULL : *iter;
+        }
+    }
+    long ms = elapsed(start);
+
+    cout << name << ms << " ms (" << ms * 1000000.0 / keys.size() / rounds << " ns each)";
+    if (base > 0 && ms > 0)
+        cout << ", speedup " << (double)base / ms;
+    cout << endl;
+    return found;
+}
+
+int main(int argc, char* argv[])
+{
+    size_t count = argc > 1 ? (size_t)atol(argv[1]) : 1000000;
+    int rounds = argc > 2 ? atoi(argv[2]) : 1;
+    if (0 == count || rounds <= 0)
+    {
+        cout << "usage: multiindexcontainer9 [records] [rounds]" << endl;
+        return 1;
+    }
+
+    //(x, y, z) unique, some x negative, inserted in random order
+    vector<MyRecord*> records;
+    records.reserve(count);
+    for (size_t i = 0; i < count; i++)
+    {
+        MyIndex index = record_index(i);
+        records.push_back(new MyRecord(index.x, index.y, index.z, (int)i, (int)(i * 10)));
+    }
+    unsigned seed = 1;
+    for (size_t i = count; i > 1; i--)
+        std::swap(records[i - 1], records[next_random(seed) % i]);
+
+    MyContainer_T container;
+    for (size_t i = 0; i < count; i++)
+        container.insert(records[i]);
+
+    MyFlatIndex_T flat;
+    flat.assign(container.get<MyIndexTag>());
+    MyFlatSimd_T flatSimd;
+    flatSimd.assign(container.get<MySimdTag>());
+    MyFlatPacked_T flatPacked;
+    flatPacked.assign(container.get<MyPackedTag>());
+    MyFlatPacked64_T flatPacked64;
+    flatPacked64.assign(container.get<MyPacked64Tag>());
+
+    //every key in random order, and one in eight more which are not there
+    vector<MyIndex> keys;
+    for (size_t i = 0; i < count; i++)
+    {
+        keys.push_back(record_index(i));
+        if (0 == i % 8)
+            keys.push_back(MyIndex(keys.back().x, keys.back().y, keys.back().z + 100));
+    }
+    for (size_t i = keys.size(); i > 1; i--)
+        std::swap(keys[i - 1], keys[next_random(seed) % i]);
+    vector<PackedIndex> packedKeys(keys.size());
+    vector<boost::uint64_t> packedKeys64(keys.size());
+    for (size_t i = 0; i < keys.size(); i++)
+    {
+        packedKeys[i] = pack_index(keys[i]);
+        packedKeys64[i] = pack_index64(keys[i].x, keys[i].y, keys[i].z);
+    }
+
+    cout << count << " records, " << keys.size() << " keys, " << rounds << " rounds" << endl;
+
+    boost::posix_time::ptime start = boost::posix_time::microsec_clock::universal_time();
+    vector<MyRecord*> expected = find_all("ordered_unique, MyIndex:       ", container.get<MyIndexTag>(), keys, rounds, 0);
+    long base = elapsed(start);
+
+    bool same = true;
+    same = find_all("ordered_unique, MyIndex SIMD:  ", container.get<MySimdTag>(), keys, rounds, base) == expected && same;
+    same = find_all("ordered_unique, PackedIndex:   ", container.get<MyPackedTag>(), packedKeys, rounds, base) == expected && same;
+    same = find_all("ordered_unique, 64 bit packed: ", container.get<MyPacked64Tag>(), packedKeys64, rounds, base) == expected && same;
+    same = find_all("flat_index, MyIndex:           ", flat, keys, rounds, base) == expected && same;
+    same = find_all("flat_index, MyIndex SIMD:      ", flatSimd, keys, rounds, base) == expected && same;
+    same = find_all("flat_index, PackedIndex:       ", flatPacked, packedKeys, rounds, base) == expected && same;
+    same = find_all("flat_index, 64 bit packed:     ", flatPacked64, packedKeys64, rounds, base) == expected && same;
+    cout << (same ? "same results" : "WRONG RESULT") << endl;
+
+    container.clear();
+    for (size_t i = 0; i < count; i++)
+        delete records[i];
+
+    return 0;
+}
@@ -26,6 +26,46 @@ echo.
 echo multiindexcontainer5 running ...
 multiindexcontainer5 > result5_win32.txt
 echo     result is in result5_win32.txt
+echo.
+
+echo multiindexcontainer6 running ...
+multiindexcontainer6 > result6_win32.txt
+echo     result is in result6_win32.txt
+echo.
+
+echo multiindexcontainer7 running ...
+multiindexcontainer7 > result7_win32.txt
+echo     result is in result7_win32.txt
+echo.
+
+echo multiindexcontainer8 running ...
+multiindexcontainer8 > result8_win32.txt
+echo     result is in result8_win32.txt
+echo.
+
+echo multiindexcontainer9 running ...
+multiindexcontainer9 > result9_win32.txt
+echo     result is in result9_win32.txt
+echo.
+
+echo multiindexcontainer10 running ...
+multiindexcontainer10 > result10_win32.txt
+echo     result is in result10_win32.txt
+echo.
+
+echo multiindexcontainer15 running ...
+multiindexcontainer15 > result15_win32.txt
+echo     result is in result15_win32.txt
+echo.
+
+echo multiindexcontainer16 running ...
+multiindexcontainer16 > result16_win32.txt
+echo     result is in result16_win32.txt
+echo.
+
+echo multiindexcontainer17 running ...
+multiindexcontainer17 > result17_win32.txt
+echo     result is in result17_win32.txt
 
 echo.
 echo done. bye.
@@ -20,4 +20,36 @@ echo "multiindexcontainer5 running ..."
 ./multiindexcontainer5 > result5_linux.txt
 echo -e "    result is in result5_linux.txt\n"
 
+echo "multiindexcontainer6 running ..."
+./multiindexcontainer6 > result6_linux.txt
+echo -e "    result is in result6_linux.txt\n"
+
+echo "multiindexcontainer7 running ..."
+./multiindexcontainer7 > result7_linux.txt
+echo -e "    result is in result7_linux.txt\n"
+
+echo "multiindexcontainer8 running ..."
+./multiindexcontainer8 > result8_linux.txt
+echo -e "    result is in result8_linux.txt\n"
+
+echo "multiindexcontainer9 running ..."
+./multiindexcontainer9 > result9_linux.txt
+echo -e "    result is in result9_linux.txt\n"
+
+echo "multiindexcontainer10 running ..."
+./multiindexcontainer10 > result10_linux.txt
+echo -e "    result is in result10_linux.txt\n"
+
+echo "multiindexcontainer15 running ..."
+./multiindexcontainer15 > result15_linux.txt
+echo -e "    result is in result15_linux.txt\n"
+
+echo "multiindexcontainer16 running ..."
+./multiindexcontainer16 > result16_linux.txt
+echo -e "    result is in result16_linux.txt\n"
+
+echo "multiindexcontainer17 running ..."
+./multiindexcontainer17 > result17_linux.txt
+echo -e "    result is in result17_linux.txt\n"
+
 echo "done. bye."
@@ -0,0 +1,52 @@
+# measure the latency of the staged pipeline of server99 (-x) per stage and
+# end to end, against the direct echo of the Handler, at a low and a high
+# packet rate. Every stage reports its latency (queue wait plus processing)
+# and its queue depth when the server ends. The default stages parse the
+# client99 header, checksum the payload and check it again before the send
+# (see Target 15 of server99.cpp), so the stage latencies include that work.
+# server99 and client99 have to be built in this directory (see smoke99.sh).
+# the summary goes to pipeline99_linux.txt, to be kept like the resultN files
+# of the container examples.
+# settings: RATES (pkts/s), DURATION (seconds), PORT
+
+RATES=${RATES:-"10000 100000"}
+DURATION=${DURATION:-10}
+PORT=${PORT:-6540}
+
+RESULT=pipeline99_linux.txt
+
+run()
+{
+    name=$1
+    rate=$2
+    shift 2
+    echo "server99 $* at $rate pkts/s running ..."
+    ./server99 -D -p $PORT -d $((DURATION + 3)) -n 1 "$@" > server_$name.txt 2>&1 &
+    sleep 1
+    ./client99 -p $PORT -r $rate -d $DURATION > client_$name.txt 2>&1
+    wait
+    echo -e "    result is in client_$name.txt and server_$name.txt\n"
+}
+
+echo -e "start to compare the direct echo and the pipeline\n"
+
+for rate in $RATES
+do
+    run direct_$rate $rate
+    run pipeline_$rate $rate -x
+done
+
+echo "server99 pipeline stages, `date`, `uname -sr`, `nproc` cpus, `grep -m 1 "model name" /proc/cpuinfo | cut -d: -f2`" > $RESULT
+echo "rates $RATES pkts/s, $DURATION seconds, 1 shard" >> $RESULT
+for rate in $RATES
+do
+    for name in direct_$rate pipeline_$rate
+    do
+        echo "$name:" >> $RESULT
+        grep -E "thread [0-9]+ (decode|process|encode|send|pipeline) *:" server_$name.txt >> $RESULT
+        grep -E "received|lost|latency" client_$name.txt >> $RESULT
+    done
+done
+cat $RESULT
+
+echo "done. bye."
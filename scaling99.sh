@@ -0,0 +1,59 @@
+# measure how the echo throughput of server99 scales with its shards: the
+# same client99 load against 1, 2, 4 ... threads up to the cpu count, and
+# one pinned shard per cpu (-n 0). Run it on 4 cpus or more; with fewer the
+# summary says that it does not show scaling.
+# server99 and client99 have to be built in this directory (see smoke99.sh).
+# the summary goes to scaling99_linux.txt, to be kept like the resultN files
+# of the container examples.
+# settings: RATE (pkts/s, high enough to saturate), DURATION (seconds), PORT,
+# CLIENT_THREADS, SOCKETS (client sockets, spread over the shards by SO_REUSEPORT)
+
+RATE=${RATE:-400000}
+DURATION=${DURATION:-10}
+PORT=${PORT:-6540}
+CLIENT_THREADS=${CLIENT_THREADS:-4}
+SOCKETS=${SOCKETS:-64}
+
+RESULT=scaling99_linux.txt
+CPUS=`nproc`
+
+run()
+{
+    name=$1
+    shift
+    echo "server99 $* running ..."
+    ./server99 -D -p $PORT -d $((DURATION + 3)) -r epoll "$@" > server_$name.txt 2>&1 &
+    sleep 1
+    ./client99 -p $PORT -n $CLIENT_THREADS -c $SOCKETS -r $RATE -d $DURATION > client_$name.txt 2>&1
+    wait
+    echo -e "    result is in client_$name.txt and server_$name.txt\n"
+}
+
+echo -e "start to scale the shards\n"
+
+names=
+threads=1
+while [ $threads -le $CPUS ]
+do
+    run threads_$threads -n $threads
+    names="$names threads_$threads"
+    threads=$((threads * 2))
+done
+run percore -n 0
+names="$names percore"
+
+echo "server99 shard scaling, `date`, `uname -sr`, $CPUS cpus, `grep -m 1 "model name" /proc/cpuinfo | cut -d: -f2`" > $RESULT
+echo "rate $RATE pkts/s, $DURATION seconds, client $CLIENT_THREADS threads $SOCKETS sockets" >> $RESULT
+if [ $CPUS -lt 4 ]
+then
+    echo "only $CPUS cpus: the shards take turns on them, this table does not show scaling" >> $RESULT
+fi
+for name in $names
+do
+    echo "$name:" >> $RESULT
+    grep -E "thread [0-9]+: [0-9]+ packets|total: [0-9]+ threads" server_$name.txt >> $RESULT
+    grep -E "received|lost|latency" client_$name.txt >> $RESULT
+done
+cat $RESULT
+
+echo "done. bye."
@@ -12,7 +12,8 @@
  3. Server receive the data from the port and show them, and send the data back, 
     and go on waiting 
  4. Client receive the back data and show them, then end
- Notation: client will be run manually when sending data.
+ Notation: client will be run manually when sending data. For load tests use
+ client99, which sends at a given rate and reports loss and latency.
 
  Target:
  1. the target is to verify whether it will call notify method when registering
@@ -33,279 +34,4210 @@
     then it will exit from the forever-loop handle_events and server will end.    
  2. provide menu for user on server, to allow user select q (quit from program) 
     and s (restart server)
+ 3. run a pool of N reactor threads (N is given by -n, default 1). Every
+    thread owns its own reactor and its own Handler, whose socket is bound to the same port with SO_REUSEPORT, so
+    the kernel spreads the datagrams of different clients over the threads.
+    Thread 0 (shard 0) still spawns task2, on its reactor.
+    Menu item t starts the pool in throughput mode: no per-packet output, no
+    exit notification, every thread reports its packets/sec once a second and
+    the server ends after -d seconds (default 10) with a per-thread summary.
+ 4. the reactor implementation is selectable with -r: select (ACE_Select_Reactor,
+    default), epoll (ACE_Dev_Poll_Reactor, if ACE is built with epoll or
+    /dev/poll) or tp (ACE_TP_Reactor). The exit path above uses notify only, so
+    it works on every backend. ACE_Dev_Poll_Reactor refuses handles that are
+    not open, so there task2 registers a duplicate of the Handler socket
+    instead of the fake MY_EXIT_HANDLER value.
+
+ 5. with -b K (K > 1) Handler::handle_input drains up to K datagrams per
+    reactor wakeup with one recvmmsg and echoes them with one sendmmsg. Where
+    recvmmsg/sendmmsg are not available (not Linux, or ENOSYS at run time)
+    it falls back to one recv/send per wakeup. The summary reports the
+    average number of datagrams handled per wakeup.
+ 6. datagrams are received into a PacketRing owned by the Handler: one
+    cache-line aligned block of fixed-size slots, allocated once and reused
+    round-robin. Nothing is zero-filled per packet, the payload is handled by
+    its length (not NUL-terminated), and the echo is sent from the slot it was
+    received into.
+ 7. the per-packet output of the reactor threads goes through LogTask: every
+    reactor thread owns a LogChannel, a lock-free single producer/single
+    consumer ring of preformatted records, and the LogTask thread drains all
+    channels in the background. A full channel drops the record instead of
+    blocking. Every category (packet, data, event) has a sampling rate and a
+    records/second limit in LOG_LIMITS: the header of 1 in 16 datagrams and
+    the payload of 1 in 64 are logged, events all. Addresses are printed
+    numerically, so no reverse DNS lookup runs in a reactor thread.
+ 8. with -q task2 does not call register_handler/remove_handler on the reactor
+    itself: it posts the commands into the CommandQueue of reactor thread 0,
+    which applies them once per handle_events iteration. Every producer owns a
+    lock-free lane of the queue, and only the first command after a drain
+    wakes the reactor with notify. Menu item r is the registration benchmark:
+    the throughput mode plus task2 registering/removing its handler -R times a
+    second. It reports the registration latency (from the call to the moment
+    the reactor has applied it) next to packets/sec; run it with and without
+    -q to compare.
+ 9. with -D the server runs headless: no menu, throughput mode on port -p with
+    -n threads, for -d seconds (0: until a signal). SIGINT and SIGTERM are
+    caught by the ShutdownHandler of reactor thread 0, which only sets a
+    sig_atomic_t in the signal handler; a timer of thread 0 finds it within
+    SIGNAL_POLL_MSEC, and the shutdown runs inside the event loop and wakes
+    every reactor thread.
+    Each thread then drains the datagrams already queued on its socket, and
+    the final throughput statistics are printed. -d also sets the length of
+    the menu's throughput mode.
+10. every reactor thread counts packets, bytes, recv and send errors, the
+    batch sizes (power of 2 buckets) and the time spent in handle_input in
+    its own HandlerStats, on cache lines of its own. Only the owner thread
+    writes them, with relaxed atomic loads and stores (StatCounter), so the
+    packet path takes no lock and no locked instruction, and a reader never
+    sees a torn counter. With -S port thread 0 answers every datagram sent to
+    127.0.0.1:port with the per-thread counters and their total, summed at
+    the time of the query (e.g. echo | nc -u -w1 127.0.0.1 port). The same
+    counters make up the summary at the end of a run.
+11. with -P usec the throughput mode busy-polls: every reactor thread spins
+    on non-blocking receives, backing off exponentially (pause instructions)
+    between empty polls, and only falls back to the blocking handle_events()
+    wait when no datagram has come in for usec microseconds. While spinning
+    the reactor is polled with a zero timeout every POLL_REACTOR_SPINS empty
+    polls, so notify, the command queue and the stats socket still work.
+    With -C cpu reactor thread i is pinned to cpu + i. Spinning trades a
+    cpu per thread for skipping the wakeup out of the reactor wait; whether
+    that lowers p50 and p99 has to be measured: latency99.sh runs client99
+    against the blocking path and against -P/-C at the same load and keeps
+    both latency lines in latency99_linux.txt.
+12. with -T K every reactor thread also runs a TCP echo on the same port: a
+    TcpAcceptor with its own listening socket (SO_REUSEPORT again) on the
+    thread's reactor, which accepts in bursts on the non-blocking socket and
+    serves up to K connections from a preallocated pool of TcpConnections.
+    What a connection reads goes into chunks of the thread's BufferPool and
+    is echoed with one writev over all chunks queued. A connection which
+    has TCP_MAX_PENDING chunks unsent stops reading (back-pressure) and
+    waits for WRITE_MASK until its queue is empty again. TCP reads count as
+    packets in the HandlerStats of the thread. connections99.sh compares UDP
+    and TCP with client99 at 1k and 10k sockets; more than FD_SETSIZE
+    connections per thread need -r epoll.
+13. with -U every reactor thread echoes its datagrams through io_uring
+    instead of Handler::handle_input: one multishot recvmsg stays armed on
+    the socket (registered as a fixed file) and picks its buffers from a
+    provided buffer ring of URING_BUFFERS PacketRing slots. Each echo is a
+    sendmsg straight from the slot it arrived in, and the slot goes back to
+    the buffer ring when the send completes. Sends are submitted and
+    completions reaped in one io_uring_submit_and_wait_timeout call per
+    loop, so there is no syscall per datagram. The reactor still runs with
+    a zero timeout after every wait (at most URING_WAIT_MSEC), so notify,
+    the command queue, the stats socket, the signals and the counters work
+    as with the reactor path. At shutdown the queued echoes are sent and
+    waited for and the recv is cancelled before the ring goes, then the
+    socket is drained like on the reactor path. Needs liburing 2.4 and
+    Linux 6.0: build with -DSERVER99_HAS_URING -luring, else -U falls back
+    to the reactor.
+14. the reactor threads are shards: a Server (the coordinator) starts one
+    MyTask per shard, each with one thread, its own reactor, Handler, TCP
+    acceptor, command queue, log channel and HandlerStats, and stops them
+    through their reactors. The exit flag, the options and task2 are members
+    of the Server instead of statics and singletons, and ACE_Reactor::instance()
+    is not used, so one process may run several servers. -n 0 starts one
+    shard per online cpu, pinned to it (from cpu 0, or from -C).
+15. with -x the Handler does not echo: it copies every datagram into a
+    message of its shard's Pipeline, and four PipelineStage tasks (decode,
+    process, encode, send), one thread each, pass the message on through
+    lock-free SpscRings and send the echo. The messages are allocated once
+    and go back to the Handler through a free ring after the send, so the
+    receive thread never blocks (a full pipeline drops the datagram). Every
+    stage runs a MessageProcessor, which Pipeline::set_processor replaces
+    with real request processing. The default ones do work of their own
+    kind on every message, so that the stage latencies mean something:
+    decode parses and checks the client99 header (magic, sequence, send
+    time; other datagrams go on as opaque payload), process computes a
+    FNV-1a checksum of the payload, a stand-in for the request work, and
+    encode writes the reply header back from the decoded fields and checks
+    the payload against that checksum, so a message corrupted between the
+    threads is dropped. The echo stays byte for byte what was received. The
+    copy into the message is one memcpy per datagram in the receive thread,
+    part of what the pipeline costs over the direct echo (pipeline99.sh). The
+    stages take up to PIPELINE_BATCH messages per round, and each one
+    reports its latency (queue wait plus processing) and its queue depth at
+    the end. The io_uring path (-U) echoes by itself and ignores -x.
+16. every reactor thread owns a TimerWheel, a hierarchical timing wheel of
+    4 levels with 256 slots each and 1 ms ticks. The timers are TimerNodes
+    kept by their owners, so the wheel allocates nothing, and schedule and
+    cancel are O(1) list operations. The event loop waits no longer than
+    until the next due slot (found in a bitmap of level 0) or the next
+    cascade of a higher level, and runs expire() after every iteration. The
+    once-a-second report and the end of the throughput mode are timers, so
+    are the register/remove actions of task2: the timer of shard 0 puts them
+    into the message queue of task2, whose thread still calls the reactor,
+    but nobody sleeps between them any more. With -I seconds every TCP
+    connection has an idle timer, and a connection which has read nothing
+    for that long is closed; reads only stamp the connection, the timer
+    checks the stamp when it fires and reschedules itself for the rest.
+    While timers are pending handle_events has a timeout (see Target 1).
+17. with -L rate every reactor thread keeps a SessionTable of its peers (IPv4
+    address and port): packets, bytes, last-seen tick and a token bucket of
+    rate datagrams/sec with a burst of one second. It is a multi_index_container
+    with a hashed_unique index on the address, for the lookup per datagram,
+    and an ordered_non_unique index on last-seen, so a sweep timer expires the
+    sessions idle for -I seconds (default SESSION_IDLE_SECONDS) from the front
+    in O(log n) each. A datagram of a peer without tokens is dropped and
+    counted as throttled, -L 0 keeps the table without a limit. Only a new
+    session allocates (one node); at SESSION_MAX the oldest one is evicted.
+    SO_REUSEPORT hashes a peer always to the same thread, so its bucket is
+    not split. -I still sets the idle timeout of TCP connections, too.
+
+ Usage: server99 [-D] [-p port] [-n threads] [-d seconds] [-r select|epoll|tp]
+                 [-b batch] [-q] [-R rate] [-S stats port] [-P usec] [-C cpu]
+                 [-T connections] [-U] [-x] [-I seconds] [-L rate]
 ************************************************************************/
 
 //#define ACE_NTRACE 0
 #include <ace/Log_Msg.h>
 
 #include <ace/OS_NS_time.h>
+#include <ace/High_Res_Timer.h>
 #include <ace/SOCK_Dgram.h>
+#include <ace/SOCK_Acceptor.h>
+#include <ace/SOCK_Stream.h>
 #include <ace/Reactor.h>
 #include <ace/Select_Reactor.h>
+#include <ace/TP_Reactor.h>
+#include <ace/Dev_Poll_Reactor.h>
+#include <ace/Get_Opt.h>
+#include <ace/Signal.h>
 #include <ace/Task.h>
+#include <ace/Atomic_Op.h>
+#include <ace/Thread_Mutex.h>
+#include <ace/OS_NS_sys_socket.h>
+#include <ace/OS_NS_stdlib.h>
+#include <ace/OS_NS_unistd.h>
+#include <ace/OS_NS_stdio.h>
+#include <ace/OS_NS_strings.h>
+#include <ace/OS_NS_sys_uio.h>
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <stdarg.h>
+#include <signal.h>
+#include <new>
+
+#include <boost/atomic.hpp>
+#include <boost/multi_index_container.hpp>
+#include <boost/multi_index/member.hpp>
+#include <boost/multi_index/hashed_index.hpp>
+#include <boost/multi_index/ordered_index.hpp>
+
+using boost::multi_index_container;
+using boost::multi_index::indexed_by;
+using boost::multi_index::hashed_unique;
+using boost::multi_index::ordered_non_unique;
+using boost::multi_index::tag;
+using boost::multi_index::member;
+
+//recvmmsg/sendmmsg, Linux 2.6.33 (recvmmsg) and 3.0 (sendmmsg) and later
+#if defined (__linux__) && defined (MSG_WAITFORONE)
+#  define SERVER99_HAS_MMSG
+#endif
+
+//io_uring is not detected, define SERVER99_HAS_URING and link with -luring
+#if defined (SERVER99_HAS_URING)
+#  include <liburing.h>
+#endif
+
+#if defined (_MSC_VER)
+#  include <intrin.h>
+#endif
+
+static const u_short UDP_PORT = 6540;
+static const int         REGISTER_COUNT = 2;
+static const int         RECV_COUNT = 2;
+static const int         MY_EXIT_HANDLER = 1023;
+static const int         MAX_REACTOR_THREADS = 64;
+static const int         THROUGHPUT_SECONDS = 10;
+static const int         MAX_BATCH = 64;
+static const int         BATCH_BUCKETS = 7;        //batch sizes 1, 2-3, 4-7, ..., 64
+static const int         DRAIN_LIMIT = 100000;     //datagrams drained per thread at shutdown
+static const int         CACHE_LINE_SIZE = 64;
+static const int         PACKET_SIZE = BUFSIZ;     //multiple of CACHE_LINE_SIZE
+static const ACE_UINT32  ECHO_MAGIC = 0x39394543;  //PACKET_MAGIC of client99
+static const int         RING_SLOTS = MAX_BATCH;
+static const int         LOG_RING_SIZE = 1024;     //power of 2
+static const int         LOG_TEXT_SIZE = 192;
+static const int         COMMAND_RING_SIZE = 256;  //power of 2
+static const int         REGISTER_RATE = 1000;     //register/remove pairs per second
+static const int         STATS_REPLY_SIZE = 16384; //one line per reactor thread plus the total
+static const int         MAX_BACKOFF_SPINS = 1024; //pause instructions between two empty polls, at most
+static const int         POLL_REACTOR_SPINS = 64;  //empty polls between two zero-timeout handle_events
+static const int         TCP_CHUNK_SIZE = 2048;    //BufferPool chunk, one read of a connection
+static const int         TCP_MAX_PENDING = 8;      //unsent chunks of a connection before it stops reading
+static const int         TCP_ACCEPT_BURST = 64;    //accepts per TcpAcceptor::handle_input
+static const int         TCP_BACKLOG = 1024;
+static const int         URING_ENTRIES = 1024;     //submission queue size
+static const int         URING_BUFFERS = 256;      //provided receive buffers per thread, power of 2
+static const int         URING_BGID = 0;           //buffer group of the provided buffers
+static const int         URING_WAIT_MSEC = 100;    //longest wait for completions before the reactor runs
+static const int         URING_DRAIN_WAITS = 50;   //waits of URING_WAIT_MSEC for the sends at shutdown
+static const int         PIPELINE_MESSAGES = 512;  //messages of a shard's pipeline, power of 2
+static const int         PIPELINE_BATCH = 32;      //messages a stage takes per round
+static const int         PIPELINE_SPINS = 1000;    //empty rounds of a stage before it sleeps
+static const int         PIPELINE_IDLE_USEC = 100;
+static const int         TIMER_BITS = 8;           //slots per wheel level: 1 << TIMER_BITS
+static const int         TIMER_SLOTS = 1 << TIMER_BITS;
+static const int         TIMER_LEVELS = 4;         //1 ms ticks, 2^32 ms at most
+static const int         REPORT_MSEC = 1000;       //throughput report interval
+static const int         SIGNAL_POLL_MSEC = 100;   //how often thread 0 looks for SIGINT/SIGTERM
+static const int         ACTION_MSEC = 1000;       //pause between two actions of task2
+static const int         SESSION_MAX = 65536;      //peers per reactor thread
+static const int         SESSION_IDLE_SECONDS = 60;
+static const int         SESSION_SWEEP_MSEC = 1000;
+static const ACE_UINT64  SESSION_TOKEN = 1000;     //token bucket units per datagram
+
+//reactor implementations selectable with -r
+enum ReactorType
+{
+    SELECT_REACTOR,
+    DEV_POLL_REACTOR,
+    TP_REACTOR
+};
+
+//microseconds from start until now
+static ACE_UINT64 usec_since(const ACE_Time_Value& start)
+{
+    ACE_Time_Value elapsed = ACE_OS::gettimeofday() - start;
+    return (ACE_UINT64)elapsed.sec() * 1000000 + elapsed.usec();
+}
+
+//options given to MyTask::open()
+struct ServerOptions
+{
+    int daemon;        //1: headless, no menu, run until -d seconds or a signal
+    u_short port;
+    int duration;      //seconds of the throughput mode, 0: until a signal
+    int threads;       //number of reactor threads, each one with its own socket
+    int throughput;    //1: throughput mode, report packets/sec per thread
+    int reactor_type;  //one of ReactorType
+    int batch;         //max datagrams per handle_input, 1: no recvmmsg/sendmmsg
+    int queue_commands;  //1: task2 posts into the CommandQueue instead of calling the reactor
+    int register_bench;  //1: task2 registers/removes register_rate times a second
+    int register_rate;
+    u_short stats_port;  //0: no stats query socket
+    int busy_poll;     //usec to spin without datagrams before blocking, 0: never spin
+    int cpu;           //reactor thread i runs on cpu + i, -1: no pinning
+    int tcp_connections;  //TCP connections per reactor thread, 0: no TCP echo
+    int uring;         //1: echo the datagrams through io_uring instead of handle_input
+    int pipeline;      //1: hand the datagrams to the staged pipeline instead of echoing them
+    int idle_timeout;  //seconds a TCP connection may stay silent, 0: forever
+    int session_rate;  //datagrams/sec per peer, 0: no limit, -1: no session table
+};
+
+//spin-wait hint, lets the sibling hyper-thread run and saves power
+static inline void cpu_relax(void)
+{
+#if defined (__i386__) || defined (__x86_64__)
+    __asm__ __volatile__ ("pause");
+#elif defined (__aarch64__)
+    __asm__ __volatile__ ("yield");
+#endif
+}
+
+//the index of the lowest set bit, bits must not be 0
+static inline int lowest_bit(ACE_UINT64 bits)
+{
+#if defined (__GNUC__)
+    return __builtin_ctzll(bits);
+#elif defined (_MSC_VER) && defined (_WIN64)
+    unsigned long index;
+    _BitScanForward64(&index, bits);
+    return (int)index;
+#elif defined (_MSC_VER)
+    unsigned long index;
+    if (_BitScanForward(&index, (unsigned long)bits))
+        return (int)index;
+    _BitScanForward(&index, (unsigned long)(bits >> 32));
+    return (int)index + 32;
+#else
+    int index = 0;
+    while (0 == (bits & 1))
+    {
+        bits >>= 1;
+        ++index;
+    }
+    return index;
+#endif
+}
+
+//run the calling thread on the given cpu only
+static int pin_thread(int cpu)
+{
+#if defined (ACE_HAS_CPU_SET_T)
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    ACE_hthread_t self;
+    ACE_OS::thr_self(self);
+    if (ACE_OS::thr_setaffinity(self, sizeof set, &set) == -1)
+        ACE_ERROR_RETURN((LM_ERROR, "(%t) %p\n", "pin_thread: thr_setaffinity failed"), -1);
+    ACE_DEBUG ((LM_INFO, ACE_TEXT ("(%t) pinned to cpu %d\n"), cpu));
+    return 0;
+#else
+    ACE_ERROR_RETURN((LM_WARNING, "(%t) no cpu affinity on this platform, cpu %d ignored\n", cpu), -1);
+#endif
+}
+
+//////////////////////////////////////////////////////////////////////////
+
+//a counter with a single writer, read by any thread: relaxed atomic loads
+//and stores, so a reader never sees a torn value (not even on 32 bit
+//platforms) and the writer pays no locked instruction for an increment.
+//Only the owner thread may change it
+class StatCounter
+{
+public:
+    StatCounter(): value_(0)
+    {
+    }
+
+    StatCounter(const StatCounter& other): value_(other.load())
+    {
+    }
+
+    StatCounter& operator= (const StatCounter& other)
+    {
+        store(other.load());
+        return *this;
+    }
+
+    StatCounter& operator= (ACE_UINT64 value)
+    {
+        store(value);
+        return *this;
+    }
+
+    StatCounter& operator+= (ACE_UINT64 n)
+    {
+        store(load() + n);
+        return *this;
+    }
+
+    StatCounter& operator++ ()
+    {
+        return *this += 1;
+    }
+
+    operator ACE_UINT64 () const
+    {
+        return load();
+    }
+
+    ACE_UINT64 load(void) const
+    {
+        return value_.load(boost::memory_order_relaxed);
+    }
+
+private:
+    void store(ACE_UINT64 value)
+    {
+        value_.store(value, boost::memory_order_relaxed);
+    }
+
+    boost::atomic<ACE_UINT64> value_;
+};
+
+//counters of one Handler. Only its reactor thread writes them; the stats
+//query reads them at any time and may see values a few packets old, each
+//counter on its own (a snapshot is not consistent across counters)
+struct HandlerStats
+{
+    StatCounter packets;
+    StatCounter bytes;
+    StatCounter recv_errors;
+    StatCounter send_errors;
+    StatCounter batches;      //handle_input calls which received something
+    StatCounter batch_sizes[BATCH_BUCKETS];
+    StatCounter input_ticks;  //ACE_OS::gethrtime() ticks in handle_input
+    StatCounter input_max_ticks;
+    StatCounter throttled;    //datagrams dropped by the rate limit of their peer
+
+    void reset(void);
+    void add(const HandlerStats& other);
+    void record_batch(int n);
+    int  format(char* buf, size_t size, const char* name) const;
+};
+
+//the HandlerStats of every reactor thread, each one on cache lines of its own
+//so that no two threads write to the same line
+class StatsTable
+{
+public:
+    StatsTable(): raw_(NULL), base_(NULL), count_(0)
+    {
+    }
+
+    ~StatsTable()
+    {
+        delete [] raw_;
+    }
+
+    //count zeroed entries, the old ones are freed (HandlerStats needs no
+    //destructor)
+    void open(int count);
+
+    HandlerStats& at(int i)
+    {
+        return *(HandlerStats*)(base_ + (size_t)i * STRIDE);
+    }
+
+    const HandlerStats& at(int i) const
+    {
+        return *(const HandlerStats*)(base_ + (size_t)i * STRIDE);
+    }
+
+    int count(void) const
+    {
+        return count_;
+    }
+
+    void total(HandlerStats& sum) const;
+
+    //one line per thread and the total, returns the length
+    int format(char* buf, size_t size) const;
+
+private:
+    StatsTable(const StatsTable&);
+    StatsTable& operator= (const StatsTable&);
+
+    static const size_t STRIDE = (sizeof(HandlerStats) + CACHE_LINE_SIZE - 1) / CACHE_LINE_SIZE * CACHE_LINE_SIZE;
+
+    char* raw_;
+    char* base_;
+    int   count_;
+};
+
+//////////////////////////////////////////////////////////////////////////
+
+//a timer of a TimerWheel; it belongs to whoever schedules it and is linked
+//into one slot of the wheel while it is pending
+struct TimerNode
+{
+    TimerNode(): prev(NULL), next(NULL), expires(0), interval(0), slot(0), handler(NULL), act(NULL)
+    {
+    }
+
+    int pending(void) const
+    {
+        return next != NULL;
+    }
+
+    TimerNode* prev;
+    TimerNode* next;
+    ACE_UINT64 expires;      //tick
+    ACE_UINT32 interval;     //ticks, 0: once
+    int slot;                //level * TIMER_SLOTS + index
+    ACE_Event_Handler* handler;
+    const void* act;
+};
+
+//hierarchical timing wheel of one reactor thread, 1 ms ticks. A timer goes
+//into the level whose range holds its delay, and is moved down a level when
+//the level below wraps around (cascade). Not thread safe: schedule, cancel
+//and expire are called by the owner thread only.
+class TimerWheel
+{
+public:
+    TimerWheel();
+    ~TimerWheel();
+
+    //handler->handle_timeout(now, act) in delay msec, then every interval msec
+    //(0: once). A pending node is moved; -1 from handle_timeout cancels it.
+    void schedule(TimerNode* node, ACE_Event_Handler* handler, const void* act, 
+        ACE_UINT32 delay_msec, ACE_UINT32 interval_msec = 0);
+    void cancel(TimerNode* node);
+
+    //run the timers which are due at now, returns how many ran
+    int expire(const ACE_Time_Value& now);
+
+    //how long the event loop may wait, NULL: no timer pending
+    ACE_Time_Value* timeout(const ACE_Time_Value& now, ACE_Time_Value& timeout) const;
+
+    //the last tick expire() has reached
+    ACE_UINT64 now(void) const
+    {
+        return now_;
+    }
+
+    //the tick of the clock, ahead of now() while the loop waits
+    ACE_UINT64 tick(void) const
+    {
+        return ticks(ACE_OS::gettimeofday());
+    }
+
+    size_t count(void) const
+    {
+        return count_;
+    }
+
+private:
+    TimerWheel(const TimerWheel&);
+    TimerWheel& operator= (const TimerWheel&);
+
+    void insert(TimerNode* node);
+    void unlink(TimerNode* node);
+    void cascade(int level);
+    ACE_UINT64 ticks(const ACE_Time_Value& time) const;
+
+    TimerNode slots_[TIMER_LEVELS * TIMER_SLOTS];  //list heads
+    ACE_UINT64 occupied_[TIMER_SLOTS / 64];        //level 0 slots which hold timers
+    ACE_Time_Value origin_;                        //tick 0
+    ACE_UINT64 now_;
+    size_t count_;
+};
+
+//////////////////////////////////////////////////////////////////////////
+
+class Handler;
+class CommandQueue;
+class Server;
+class Pipeline;
+class SessionTable;
+
+//one shard: one thread with its own reactor, Handler, TCP acceptor, command
+//queue and log channel; it shares nothing with the other shards but the
+//Server which started it
+class MyTask: public ACE_Task<ACE_NULL_SYNCH>
+{
+public:
+    static const int MAX_USER_THREAD = 1;
+    MyTask(Server& server, int index);
+    ~MyTask();
+
+    int open(void *);
+    virtual int svc();
+
+    //wake up the reactor, so that it sees the exit flag of the server
+    void wakeup(void);
+
+    CommandQueue* command_queue(void);
+
+    //written when svc() leaves
+    const ACE_Time_Value& elapsed(void) const
+    {
+        return elapsed_;
+    }
+
+    //the report and the end of the throughput mode
+    virtual int handle_timeout(const ACE_Time_Value& now, const void* act);
+
+private:
+    int  run_reactor(ACE_Reactor* reactor, Handler& handler, CommandQueue& commands, TimerWheel& timers);
+    int  poll_events(ACE_Reactor* reactor, Handler& handler, ACE_Time_Value* timeout, ACE_Time_Value& last_packet);
+    int  uring_events(ACE_Reactor* reactor, Handler& handler, ACE_Time_Value* timeout);
+
+    Server& server_;
+    const ServerOptions& options_;
+    const int index_;
+
+    //set while svc() runs, for wakeup() and command_queue() from other threads
+    ACE_Thread_Mutex lock_;
+    ACE_Reactor* running_reactor_;
+    CommandQueue* queue_;
+
+    //timers of this thread's wheel, while run_reactor() runs
+    TimerNode report_timer_;
+    TimerNode stop_timer_;
+    Handler* handler_;
+    int last_count_;
+
+    ACE_Time_Value elapsed_;
+};
+
+//////////////////////////////////////////////////////////////////////////
+
+//fixed-size packet buffers in one cache-line aligned block, allocated once
+//and handed out round-robin; a slot is valid until the ring wraps around
+class PacketRing
+{
+public:
+    PacketRing(int slots): slots_(slots), head_(0)
+    {
+        raw_ = new char[(size_t)slots_ * PACKET_SIZE + CACHE_LINE_SIZE];
+        size_t misalign = (size_t)raw_ % CACHE_LINE_SIZE;
+        base_ = misalign ? raw_ + (CACHE_LINE_SIZE - misalign) : raw_;
+    }
+
+    ~PacketRing()
+    {
+        delete [] raw_;
+    }
+
+    char* slot(int i) const
+    {
+        return base_ + (size_t)i * PACKET_SIZE;
+    }
+
+    char* next(void)
+    {
+        char* p = slot(head_);
+        if (++head_ == slots_)
+            head_ = 0;
+        return p;
+    }
+
+    int slots(void) const
+    {
+        return slots_;
+    }
+
+private:
+    PacketRing(const PacketRing&);
+    PacketRing& operator= (const PacketRing&);
+
+    char* raw_;
+    char* base_;
+    int   slots_;
+    int   head_;
+};
+
+//////////////////////////////////////////////////////////////////////////
+
+//lock-free ring for one producer thread and one consumer thread, N is a power
+//of 2; the indices only grow, and each one is written by a single thread.
+//A thread stores its own index with release after it is done with the slot,
+//and loads the other one with acquire before it touches a slot, so an item
+//is complete when the consumer sees it and read when the producer reuses it
+template <class T, int N>
+class SpscRing
+{
+public:
+    SpscRing(): head_(0), tail_(0)
+    {
+        items_ = new T[N];
+    }
+
+    ~SpscRing()
+    {
+        delete [] items_;
+    }
+
+    //producer: the slot to fill, NULL if the ring is full
+    T* reserve(void)
+    {
+        long tail = tail_.load(boost::memory_order_relaxed);
+        if (tail - head_.load(boost::memory_order_acquire) == N)
+            return NULL;
+        return &items_[tail & (N - 1)];
+    }
+
+    //producer: publish the slot returned by reserve()
+    void commit(void)
+    {
+        tail_.store(tail_.load(boost::memory_order_relaxed) + 1, boost::memory_order_release);
+    }
+
+    //consumer: the oldest item, NULL if the ring is empty
+    T* front(void)
+    {
+        long head = head_.load(boost::memory_order_relaxed);
+        if (head == tail_.load(boost::memory_order_acquire))
+            return NULL;
+        return &items_[head & (N - 1)];
+    }
+
+    //consumer: release the item returned by front()
+    void pop(void)
+    {
+        head_.store(head_.load(boost::memory_order_relaxed) + 1, boost::memory_order_release);
+    }
+
+    long size(void) const
+    {
+        return tail_.load(boost::memory_order_acquire) - head_.load(boost::memory_order_acquire);
+    }
+
+private:
+    SpscRing(const SpscRing&);
+    SpscRing& operator= (const SpscRing&);
+
+    T* items_;
+
+    //producer and consumer indices on separate cache lines
+    boost::atomic<long> head_;
+    char pad_[CACHE_LINE_SIZE];
+    boost::atomic<long> tail_;
+};
+
+//////////////////////////////////////////////////////////////////////////
+
+enum LogCategory
+{
+    LOG_PACKET,   //one line per received datagram
+    LOG_DATA,     //payload of a received datagram
+    LOG_EVENT,    //everything else
+    LOG_CATEGORIES
+};
+
+//log 1 of every sample records, and at most rate records per second (0: no limit).
+//A datagram logs one LOG_PACKET and one LOG_DATA record, so with the data
+//sample a multiple of the packet sample every payload logged has its header
+struct LogLimit
+{
+    int sample;
+    int rate;
+};
+
+static const LogLimit LOG_LIMITS[LOG_CATEGORIES] =
+{
+    {16, 1000},   //LOG_PACKET
+    {64, 100},    //LOG_DATA
+    {1, 0}        //LOG_EVENT
+};
+
+struct LogRecord
+{
+    ACE_Log_Priority priority;
+    char text[LOG_TEXT_SIZE];
+};
+
+//the log of one reactor thread: formats into its own ring and never blocks;
+//records are dropped when the ring is full or the category is over its limit
+class LogChannel
+{
+public:
+    LogChannel();
+
+    int log(int category, ACE_Log_Priority priority, const char* format, ...);
+
+    SpscRing<LogRecord, LOG_RING_SIZE>& ring(void)
+    {
+        return ring_;
+    }
+
+    int get_dropped(void) const
+    {
+        return dropped_;
+    }
+
+    int get_limited(void) const
+    {
+        return limited_;
+    }
+
+private:
+    int allowed(int category);
+
+    SpscRing<LogRecord, LOG_RING_SIZE> ring_;
+
+    //only touched by the producer thread
+    int  seen_[LOG_CATEGORIES];
+    int  logged_[LOG_CATEGORIES];
+    long window_[LOG_CATEGORIES];  //second of logged_
+    int  dropped_;                 //ring full
+    int  limited_;                 //sampled out or over the rate
+};
+
+//background thread that drains every attached LogChannel into ACE_Log_Msg
+class LogTask: public ACE_Task<ACE_NULL_SYNCH>
+{
+public:
+    static const int MAX_CHANNELS = 64;
+    LogTask();
+
+    int open(void *);
+    virtual int svc();
+    void stop(void);
+
+    int attach(LogChannel* channel);
+    void detach(LogChannel* channel);
+
+private:
+    int drain(LogChannel* channel);
+
+    ACE_Thread_Mutex lock_;
+    LogChannel* channels_[MAX_CHANNELS];
+    ACE_Atomic_Op<ACE_Thread_Mutex, int> stop_flag_;
+    int dropped_;
+    int limited_;
+};
+
+typedef ACE_Singleton <LogTask, ACE_SYNCH_MUTEX> logtask;
+
+//////////////////////////////////////////////////////////////////////////
+
+enum CommandOp
+{
+    CMD_REGISTER,  //register_handler(handle, handler, mask)
+    CMD_REMOVE,    //remove_handler(handle, mask)
+    CMD_NOTIFY     //handler->handle_exception(ACE_INVALID_HANDLE), like notify()
+};
+
+struct ReactorCommand
+{
+    int op;
+    ACE_HANDLE handle;
+    ACE_Event_Handler* handler;
+    ACE_Reactor_Mask mask;
+    ACE_Time_Value posted;
+};
+
+//registrations and notifications from other threads for one reactor. Every
+//producer thread posts into its own lane (a SpscRing), and the reactor thread
+//applies all lanes once per handle_events iteration, so the reactor token is
+//never taken by another thread. Only the first command after a drain wakes
+//the reactor with notify, the commands behind it ride along. The counters
+//are boost::atomic, lock-free like the lanes; ACE_Atomic_Op may take a mutex.
+class CommandQueue
+{
+public:
+    static const int MAX_LANES = 8;
+    CommandQueue(ACE_Reactor* reactor);
+
+    int open_lane(void);
+    int post(int lane, int op, ACE_HANDLE handle, ACE_Event_Handler* handler, ACE_Reactor_Mask mask);
+    int drain(void);
+    void report(void) const;
+
+private:
+    int apply(const ReactorCommand& command);
+
+    ACE_Reactor* reactor_;
+    SpscRing<ReactorCommand, COMMAND_RING_SIZE> lanes_[MAX_LANES];
+    boost::atomic<int> lanes_used_;
+    boost::atomic<long> pending_;  //commands posted since the last drain
+    boost::atomic<int> full_;      //posts refused, lane full
+
+    //reactor thread only
+    int applied_;
+    int failed_;
+    ACE_UINT64 latency_sum_;
+    ACE_UINT64 latency_max_;
+};
+
+//////////////////////////////////////////////////////////////////////////
+
+class Handler: public ACE_Event_Handler
+{
+public:
+    Handler(u_short udp_port, HandlerStats& stats, int verbose = 1, int batch = 1, LogChannel* log = NULL);
+    ~Handler(void);
+
+    int open(void);
+
+    virtual int handle_input(ACE_HANDLE);
+    virtual int handle_exception (ACE_HANDLE);
+
+    virtual ACE_HANDLE get_handle(void) const
+    {
+        return this->dgramt_.get_handle();
+    }
+
+    int get_count(void) const
+    {
+        return recv_count_;
+    }
+
+    int get_flag(void) const
+    {
+        return exit_flag_;
+    }
+
+    int get_packets(void) const
+    {
+        return (int)stats_.packets;
+    }
+
+    int poll(void);
+    int drain(void);
+
+    void enable_nonblock(void)
+    {
+        this->dgramt_.enable(ACE_NONBLOCK);
+    }
+
+    //io_uring path, instead of registering with the reactor
+    int open_uring(void);
+    int run_uring(const ACE_Time_Value& wait);
+    //sends what is queued and waits for it before the ring goes
+    void close_uring(void);
+
+    int has_uring(void) const
+    {
+        return uring_open_;
+    }
+
+    //hand the datagrams to the pipeline instead of echoing them, NULL: echo
+    void set_pipeline(Pipeline* pipeline)
+    {
+        pipeline_ = pipeline;
+    }
+
+    //account every datagram to its peer, and drop it when the peer is over its rate
+    void set_sessions(SessionTable* sessions)
+    {
+        sessions_ = sessions;
+    }
+
+private:
+    int handle_input_single(void);
+#if defined (SERVER99_HAS_MMSG)
+    int handle_input_batch(void);
+#endif
+#if defined (SERVER99_HAS_URING)
+    struct io_uring_sqe* get_sqe(void);
+    int  reap_uring(const ACE_Time_Value& wait);
+    int  arm_uring(void);
+    int  echo_uring(int bid, int length);
+    void recycle_uring(int bid);
+#endif
+
+    ACE_SOCK_Dgram dgramt_;
+    ACE_INET_Addr  addr_;
+    PacketRing     ring_;
+
+    //one Handler per reactor thread, so the counters are not shared
+    int recv_count_;
+    HandlerStats& stats_;  //like recv_count_, but never reset by handle_exception
+    int exit_flag_;
+    int verbose_;
+    int batch_;
+    LogChannel* log_;
+    Pipeline* pipeline_;
+    SessionTable* sessions_;
+
+#if defined (SERVER99_HAS_MMSG)
+    //recvmmsg/sendmmsg state, batch_ entries each, buffers come from ring_
+    struct mmsghdr *msgs_;
+    struct iovec   *iovs_;
+    sockaddr_in    *peers_;
+#endif
+
+    int uring_open_;
+#if defined (SERVER99_HAS_URING)
+    //a buffer has at most one send in flight, so the sends are indexed by buffer id
+    struct io_uring uring_;
+    struct io_uring_buf_ring* buf_ring_;
+    PacketRing*    uring_buffers_;
+    struct msghdr  recv_msg_;   //layout of the multishot recvmsg, name length only
+    struct msghdr* send_msgs_;
+    struct iovec*  send_iovs_;
+    int            uring_armed_;
+    int            uring_sending_;  //sends queued or in flight, each holds its buffer
+#endif
+};
+
+//////////////////////////////////////////////////////////////////////////
+
+//answers every datagram on 127.0.0.1:port with the counters of all threads
+class StatsHandler: public ACE_Event_Handler
+{
+public:
+    StatsHandler(const StatsTable& stats): stats_(stats)
+    {
+    }
+
+    ~StatsHandler(void);
+
+    int open(u_short port);
+
+    virtual int handle_input(ACE_HANDLE);
+
+    virtual ACE_HANDLE get_handle(void) const
+    {
+        return this->dgramt_.get_handle();
+    }
+
+private:
+    const StatsTable& stats_;
+    ACE_SOCK_Dgram dgramt_;
+};
+
+//////////////////////////////////////////////////////////////////////////
+
+//fixed-size buffers of the TCP connections of one reactor thread, so never
+//shared between threads. Grows when it runs dry and keeps every released
+//chunk for reuse, so after warming up no read allocates.
+class BufferPool
+{
+public:
+    BufferPool(): free_(NULL), allocated_(0)
+    {
+    }
+
+    ~BufferPool();
+
+    char* get(void);
+    void put(char* chunk);
+
+    int allocated(void) const
+    {
+        return allocated_;
+    }
+
+private:
+    BufferPool(const BufferPool&);
+    BufferPool& operator= (const BufferPool&);
+
+    //a free chunk holds the link to the next one
+    struct FreeChunk
+    {
+        FreeChunk* next;
+    };
+
+    FreeChunk* free_;
+    int allocated_;
+};
+
+class TcpAcceptor;
+
+//one accepted TCP connection, echoes what it reads with gathered writes
+class TcpConnection: public ACE_Event_Handler
+{
+public:
+    TcpConnection();
+
+    int open(TcpAcceptor* owner, ACE_Reactor* reactor);
+    void close(void);
+
+    virtual int handle_input(ACE_HANDLE);
+    virtual int handle_output(ACE_HANDLE);
+    virtual int handle_close(ACE_HANDLE, ACE_Reactor_Mask);
+
+    //the idle timer: close, or wait for the rest of the idle time
+    virtual int handle_timeout(const ACE_Time_Value&, const void*);
+
+    virtual ACE_HANDLE get_handle(void) const
+    {
+        return this->stream_.get_handle();
+    }
+
+    ACE_SOCK_Stream& stream(void)
+    {
+        return stream_;
+    }
+
+    int is_open(void) const
+    {
+        return owner_ != NULL;
+    }
+
+    TcpConnection* next_;  //free list of the TcpAcceptor
+
+private:
+    int flush(void);
+
+    TcpAcceptor* owner_;   //NULL: in the free list
+    ACE_SOCK_Stream stream_;
+
+    //unsent data, oldest first; iov_base points into chunks_[i]
+    char*  chunks_[TCP_MAX_PENDING];
+    iovec  pending_[TCP_MAX_PENDING];
+    int    count_;
+    int    reading_;       //0: back-pressure, READ_MASK cancelled
+
+    TimerNode idle_timer_;
+    ACE_UINT64 last_read_;  //wheel tick of the last read
+};
+
+//the TCP listening socket of one reactor thread and its connections
+class TcpAcceptor: public ACE_Event_Handler
+{
+public:
+    TcpAcceptor(HandlerStats& stats, int max_connections);
+    ~TcpAcceptor(void);
+
+    //idle_seconds > 0: connections silent that long are closed by timers
+    int open(u_short port, ACE_Reactor* reactor, TimerWheel& timers, int idle_seconds);
+    void close(void);
+
+    virtual int handle_input(ACE_HANDLE);
+
+    virtual ACE_HANDLE get_handle(void) const
+    {
+        return this->acceptor_.get_handle();
+    }
+
+    TimerWheel* timers(void)
+    {
+        return timers_;
+    }
+
+    ACE_UINT32 idle_msec(void) const
+    {
+        return idle_msec_;
+    }
+
+    void count_idle(void)
+    {
+        ++idle_closed_;
+    }
+
+    void release(TcpConnection* connection);
+    void report(int index) const;
+
+    BufferPool& pool(void)
+    {
+        return pool_;
+    }
+
+    HandlerStats& stats(void)
+    {
+        return stats_;
+    }
+
+    void count_backpressure(void)
+    {
+        ++backpressure_;
+    }
+
+private:
+    ACE_SOCK_Acceptor acceptor_;
+    HandlerStats& stats_;
+    BufferPool pool_;
+    TcpConnection* connections_;
+    TcpConnection* free_;
+    int max_;
+    int open_;
+    int peak_;
+    int accepted_;
+    int refused_;       //no free connection or no reactor slot
+    int backpressure_;  //reads stopped because of a full output queue
+    TimerWheel* timers_;
+    ACE_UINT32 idle_msec_;  //0: no idle timers
+    int idle_closed_;
+};
+
+//////////////////////////////////////////////////////////////////////////
+
+enum PipelineStageId
+{
+    STAGE_DECODE,
+    STAGE_PROCESS,
+    STAGE_ENCODE,
+    STAGE_SEND,
+    PIPELINE_STAGES
+};
+
+//head of a client99 packet (PacketHeader there), the rest is payload
+struct EchoHeader
+{
+    ACE_UINT32 magic;
+    ACE_UINT32 seq;
+    ACE_UINT64 send_usec;
+};
+
+//a datagram on its way through the pipeline, length 0: dropped by a stage
+struct PipelineMessage
+{
+    char data[PACKET_SIZE];
+    int length;
+    sockaddr_in peer;
+    ACE_hrtime_t queued;  //when it entered the queue of its current stage
+
+    //set by decode and process
+    int framed;           //1: data starts with an EchoHeader
+    EchoHeader header;
+    ACE_UINT32 checksum;  //of the payload behind the header
+};
+
+//the work of one stage on one message, returns -1 to drop the message;
+//runs in the thread of the stage, so it may take its time
+class MessageProcessor
+{
+public:
+    virtual ~MessageProcessor()
+    {
+    }
+
+    virtual int process(PipelineMessage& message) = 0;
+};
+
+//decode: parse the client99 header; a datagram without it (the interactive
+//client) goes on as opaque payload
+class DecodeProcessor: public MessageProcessor
+{
+public:
+    virtual int process(PipelineMessage& message);
+};
+
+//process: a FNV-1a checksum of the payload, the stand-in for the work on a
+//request; it reads every byte behind the header once
+class ChecksumProcessor: public MessageProcessor
+{
+public:
+    virtual int process(PipelineMessage& message);
+
+    static ACE_UINT32 checksum(const char* data, int length);
+};
+
+//encode: write the reply header from the decoded fields, and drop the message
+//if its payload no longer matches the checksum of process
+class EncodeProcessor: public MessageProcessor
+{
+public:
+    virtual int process(PipelineMessage& message);
+};
+
+//the send stage: the echo goes out on the socket of the Handler
+class SendProcessor: public MessageProcessor
+{
+public:
+    SendProcessor(): socket_(ACE_INVALID_HANDLE)
+    {
+    }
+
+    void socket(ACE_HANDLE socket)
+    {
+        socket_ = socket;
+    }
+
+    virtual int process(PipelineMessage& message);
+
+private:
+    ACE_HANDLE socket_;
+};
+
+typedef SpscRing<PipelineMessage*, PIPELINE_MESSAGES> MessageRing;
+
+//one thread which takes messages from in, runs its processor on them and
+//passes them to out; it leaves when its upstream is done and in is empty
+class PipelineStage: public ACE_Task<ACE_NULL_SYNCH>
+{
+public:
+    PipelineStage();
+
+    void init(Pipeline* pipeline, int id, MessageRing* in, MessageRing* out, MessageProcessor* processor);
+    int open(void *);
+    virtual int svc();
+
+    int done(void) const
+    {
+        return done_.value();
+    }
+
+    void report(int shard) const;
+
+private:
+    Pipeline* pipeline_;
+    int id_;
+    MessageRing* in_;
+    MessageRing* out_;
+    MessageProcessor* processor_;
+    ACE_Atomic_Op<ACE_Thread_Mutex, int> done_;
+
+    //stage thread only, read by report() after the stage is done
+    ACE_UINT64 messages_;
+    ACE_UINT64 dropped_;
+    ACE_UINT64 rounds_;
+    ACE_UINT64 latency_ticks_;
+    ACE_UINT64 latency_max_;
+    ACE_UINT64 depth_sum_;
+    long depth_max_;
+};
+
+//decode -> process -> encode -> send for the datagrams of one shard. The
+//Handler takes a free message, the stages pass it on, and the send stage
+//gives it back; every ring has one producer and one consumer.
+class Pipeline
+{
+public:
+    Pipeline();
+    ~Pipeline();
+
+    //before open(), the processor stays owned by the caller
+    void set_processor(int stage, MessageProcessor* processor);
+
+    int open(ACE_HANDLE socket);
+    //let the stages finish what is queued, and wait for them
+    void close(void);
+
+    //receive thread: copy the datagram into a free message, -1: pipeline full
+    int submit(const char* data, int length, const sockaddr_in& peer);
+
+    //whether the stage before stage id has left
+    int upstream_done(int id) const;
+
+    void report(int shard) const;
+
+private:
+    Pipeline(const Pipeline&);
+    Pipeline& operator= (const Pipeline&);
+
+    PipelineMessage* messages_;
+    MessageRing free_;                     //send stage -> Handler
+    MessageRing queues_[PIPELINE_STAGES];  //the input of every stage
+    PipelineStage stages_[PIPELINE_STAGES];
+    MessageProcessor* processors_[PIPELINE_STAGES];
+    DecodeProcessor decode_;
+    ChecksumProcessor checksum_;
+    EncodeProcessor encode_;
+    SendProcessor send_;
+    ACE_Atomic_Op<ACE_Thread_Mutex, int> stop_flag_;
+    int open_;
+
+    //receive thread only
+    int submitted_;
+    int full_;
+};
+
+//////////////////////////////////////////////////////////////////////////
+
+//one peer of a reactor thread; only peer and last_seen are keys, the rest
+//is updated in place, last_seen by modify()
+struct Session
+{
+    ACE_UINT64 peer;                 //IPv4 address << 16 | port
+    ACE_UINT64 last_seen;            //TimerWheel tick
+    mutable ACE_UINT64 tokens;       //SESSION_TOKEN per datagram
+    mutable ACE_UINT64 packets;
+    mutable ACE_UINT64 bytes;
+    mutable ACE_UINT64 throttled;
+};
+
+struct by_peer {};
+struct by_last_seen {};
+
+typedef multi_index_container<
+    Session,
+    indexed_by<
+        hashed_unique<tag<by_peer>, member<Session, ACE_UINT64, &Session::peer> >,
+        ordered_non_unique<tag<by_last_seen>, member<Session, ACE_UINT64, &Session::last_seen> >
+    >
+> SessionSet;
+
+//the peers of one reactor thread, with a token bucket each; only the
+//reactor thread uses it
+class SessionTable: public ACE_Event_Handler
+{
+public:
+    SessionTable();
+    ~SessionTable();
+
+    //rate datagrams/sec per peer (0: no limit), sessions expire after idle_seconds
+    void open(TimerWheel& timers, int rate, int idle_seconds);
+    void close(void);
+
+    //read once per batch for admit()
+    ACE_UINT64 clock(void) const
+    {
+        return timers_->tick();
+    }
+
+    //account a datagram of peer, -1: the peer is out of tokens, drop it
+    int admit(const sockaddr_in& peer, size_t bytes, ACE_UINT64 now);
+
+    //the sweep: erase the sessions idle for too long, oldest first
+    virtual int handle_timeout(const ACE_Time_Value&, const void*);
+
+    void report(int shard) const;
+
+private:
+    SessionTable(const SessionTable&);
+    SessionTable& operator= (const SessionTable&);
+
+    SessionSet sessions_;
+    TimerWheel* timers_;
+    TimerNode sweep_timer_;
+    ACE_UINT64 rate_;       //token units per tick (1 ms)
+    ACE_UINT64 burst_;      //one second of tokens, 0: no limit
+    ACE_UINT64 idle_msec_;
+
+    int created_;
+    int expired_;
+    int evicted_;           //the oldest session, for a new one at SESSION_MAX
+    size_t peak_;
+    ACE_UINT64 throttled_;
+};
+
+//////////////////////////////////////////////////////////////////////////
+
+//SIGINT/SIGTERM: handle_signal runs in signal context and only sets a
+//sig_atomic_t. notify() is not async-signal-safe with every reactor (the TP
+//and dev poll reactors and a notify queue take locks), so a timer of thread 0
+//looks at the flag every SIGNAL_POLL_MSEC and shuts down in the event loop
+class ShutdownHandler: public ACE_Event_Handler
+{
+public:
+    ShutdownHandler(Server& server): server_(server), timers_(NULL), signaled_(0)
+    {
+    }
+
+    //start and stop the polling timer, thread 0 only
+    void open(TimerWheel& timers);
+    void close(void);
+
+    virtual int handle_signal(int signum, siginfo_t* = 0, ucontext_t* = 0);
+    virtual int handle_timeout(const ACE_Time_Value& now, const void* act);
+
+private:
+    Server& server_;
+    TimerWheel* timers_;
+    TimerNode timer_;
+    volatile sig_atomic_t signaled_;
+};
+
+//////////////////////////////////////////////////////////////////////////
+
+//the register/remove actions come from the timer wheel of shard 0 through
+//the message queue, so getq() blocks: ACE_MT_SYNCH
+class MyTask2:public ACE_Task<ACE_MT_SYNCH>
+{
+public:
+    static const int MAX_USER_THREAD = 1;
+    MyTask2(Server& server);
+
+    int open(void *);
+    virtual int svc();
+    void stop(void);
+
+    //called by shard 0 after open(): one action every ACTION_MSEC on its wheel
+    void schedule_actions(TimerWheel& timers);
+
+    //shard 0: queue the next action for svc()
+    virtual int handle_timeout(const ACE_Time_Value& now, const void* act);
+
+private:
+    int register_exit_handler(void);
+    int remove_exit_handler(void);
+    int run_bench(void);
+    void account(const ACE_Time_Value& start);
+
+    Server& server_;
+    Handler* handler_;        //registered on the reactor of shard 0
+    ACE_HANDLE exit_handle_;  //MY_EXIT_HANDLER, or a real handle for epoll or the benchmark
+    CommandQueue* queue_;     //NULL: call the reactor directly
+    int lane_;
+    int register_bench_;
+    int register_rate_;
+    ACE_Atomic_Op<ACE_Thread_Mutex, int> stop_flag_;
+
+    //owned by shard 0
+    TimerWheel* timers_;
+    TimerNode action_timer_;
+    int actions_;
+
+    //latency of the direct calls
+    int calls_;
+    ACE_UINT64 latency_sum_;
+    ACE_UINT64 latency_max_;
+};
+
+//////////////////////////////////////////////////////////////////////////
+
+//the coordinator: starts the shards and task2, stops them, and owns what the
+//shards share; nothing is static, so a process may run several servers
+class Server
+{
+public:
+    Server();
+    ~Server();
+
+    int start(const ServerOptions& options);
+    void wait(void);
+    void report(void) const;
+
+    //stop every shard, called in the event loop of shard 0 (or of any thread)
+    void shutdown(void);
+
+    int stopping(void) const
+    {
+        return exit_flag_.value();
+    }
+
+    const ServerOptions& options(void) const
+    {
+        return options_;
+    }
+
+    StatsTable& stats(void)
+    {
+        return stats_;
+    }
+
+    MyTask2& task2(void)
+    {
+        return task2_;
+    }
+
+    CommandQueue* command_queue(int index);
+
+private:
+    Server(const Server&);
+    Server& operator= (const Server&);
+
+    void close(void);
+
+    ServerOptions options_;
+    ACE_Atomic_Op<ACE_Thread_Mutex, int> exit_flag_;
+
+    //counters of every Handler, kept until the next start() for report()
+    StatsTable stats_;
+
+    MyTask* shards_[MAX_REACTOR_THREADS];
+    int count_;
+    MyTask2 task2_;
+};
+
+//////////////////////////////////////////////////////////////////////////
+
+static const char* reactor_name(int type)
+{
+    switch (type)
+    {
+    case DEV_POLL_REACTOR:
+        return "epoll";
+    case TP_REACTOR:
+        return "tp";
+    default:
+        return "select";
+    }
+}
+
+static int reactor_type(const char* name)
+{
+    if (ACE_OS::strcmp(name, "select") == 0)
+        return SELECT_REACTOR;
+    if (ACE_OS::strcmp(name, "epoll") == 0 || ACE_OS::strcmp(name, "dev_poll") == 0)
+    {
+#if defined (ACE_HAS_EVENT_POLL) || defined (ACE_HAS_DEV_POLL)
+        return DEV_POLL_REACTOR;
+#else
+        ACE_ERROR((LM_WARNING, "(%t) ACE is built without epoll and /dev/poll, use select\n"));
+        return SELECT_REACTOR;
+#endif
+    }
+    if (ACE_OS::strcmp(name, "tp") == 0)
+        return TP_REACTOR;
+
+    ACE_ERROR((LM_WARNING, "(%t) unknown reactor %s, use select\n", name));
+    return SELECT_REACTOR;
+}
+
+static ACE_Reactor_Impl* make_reactor_impl(int type)
+{
+    switch (type)
+    {
+#if defined (ACE_HAS_EVENT_POLL) || defined (ACE_HAS_DEV_POLL)
+    case DEV_POLL_REACTOR:
+        return new ACE_Dev_Poll_Reactor;
+#endif
+    case TP_REACTOR:
+        return new ACE_TP_Reactor;
+    default:
+        return new ACE_Select_Reactor;
+    }
+}
+
+//////////////////////////////////////////////////////////////////////////
+
+Server::Server(): task2_(*this)
+{
+    options_.daemon = 0;
+    options_.port = UDP_PORT;
+    options_.duration = THROUGHPUT_SECONDS;
+    options_.threads = MyTask::MAX_USER_THREAD;
+    options_.throughput = 0;
+    options_.reactor_type = SELECT_REACTOR;
+    options_.batch = 1;
+    options_.queue_commands = 0;
+    options_.register_bench = 0;
+    options_.register_rate = REGISTER_RATE;
+    options_.stats_port = 0;
+    options_.busy_poll = 0;
+    options_.cpu = -1;
+    options_.tcp_connections = 0;
+    options_.uring = 0;
+    options_.pipeline = 0;
+    options_.idle_timeout = 0;
+    options_.session_rate = -1;
+    exit_flag_ = 0;
+    count_ = 0;
+    for (int i = 0; i < MAX_REACTOR_THREADS; i++)
+        shards_[i] = NULL;
+}
+
+Server::~Server()
+{
+    close();
+}
+
+int Server::start(const ServerOptions& options)
+{
+    close();
+    options_ = options;
+
+    //thread per core: one shard per online cpu, each one pinned to its cpu
+    if (0 == options_.threads)
+    {
+        options_.threads = (int)ACE_OS::num_processors_online();
+        if (options_.cpu < 0)
+            options_.cpu = 0;
+    }
+    if (options_.threads < 1)
+        options_.threads = 1;
+    if (options_.threads > MAX_REACTOR_THREADS)
+        options_.threads = MAX_REACTOR_THREADS;
+    if (options_.batch < 1)
+        options_.batch = 1;
+    if (options_.batch > MAX_BATCH)
+        options_.batch = MAX_BATCH;
+
+    if (!options_.throughput)
+        options_.busy_poll = 0;  //the exit path of the normal mode waits in the reactor
+#if !defined (SERVER99_HAS_URING)
+    if (options_.uring)
+    {
+        ACE_ERROR((LM_WARNING, "(%t) built without SERVER99_HAS_URING, use the reactor\n"));
+        options_.uring = 0;
+    }
+#endif
+    if (options_.uring)
+        options_.busy_poll = 0;
+    if (options_.uring && options_.pipeline)
+    {
+        ACE_ERROR((LM_WARNING, "(%t) the io_uring path echoes by itself, no pipeline\n"));
+        options_.pipeline = 0;
+    }
+
+    ACE_DEBUG ((LM_INFO, "(%t) Server start, port %d, %d shards, %s reactor, batch %d, busy poll %d usec\n", 
+        options_.port, options_.threads, reactor_name(options_.reactor_type), options_.batch, options_.busy_poll));
+
+    exit_flag_ = 0;
+    stats_.open(options_.threads);
+    for (count_ = 0; count_ < options_.threads; count_++)
+    {
+        shards_[count_] = new MyTask(*this, count_);
+        if (shards_[count_]->open(0) == -1)
+        {
+            delete shards_[count_];
+            shards_[count_] = NULL;
+            shutdown();
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+//until every shard has left svc(), shard 0 stops task2 before it leaves
+void Server::wait(void)
+{
+    for (int i = 0; i < count_; i++)
+        shards_[i]->wait();
+    task2_.wait();
+}
+
+//the shards of the last run, after wait()
+void Server::close(void)
+{
+    for (int i = 0; i < count_; i++)
+    {
+        delete shards_[i];
+        shards_[i] = NULL;
+    }
+    count_ = 0;
+}
+
+void Server::shutdown(void)
+{
+    exit_flag_ = 1;
+    for (int i = 0; i < count_; i++)
+        shards_[i]->wakeup();
+}
+
+CommandQueue* Server::command_queue(int index)
+{
+    return index < count_ ? shards_[index]->command_queue() : NULL;
+}
+
+void Server::report(void) const
+{
+    double total_pps = 0;
+    char line[512];
+    char name[32];
+    for (int i = 0; i < stats_.count() && i < count_; i++)
+    {
+        const HandlerStats& s = stats_.at(i);
+        double seconds = shards_[i]->elapsed().msec() / 1000.0;
+        double pps = seconds > 0 ? s.packets / seconds : 0;
+        double avg_batch = s.batches > 0 ? (double)s.packets / s.batches : 0;
+        ACE_DEBUG ((LM_INFO, ACE_TEXT ("(%t) thread %d: %Q packets, %.0f pkts/s, avg batch %.2f\n"), 
+            i, (ACE_UINT64)s.packets, pps, avg_batch));
+        total_pps += pps;
+
+        ACE_OS::snprintf(name, sizeof name, "thread %d", i);
+        s.format(line, sizeof line, name);
+        ACE_DEBUG ((LM_INFO, ACE_TEXT ("(%t) %s"), line));
+    }
+
+    HandlerStats total;
+    stats_.total(total);
+    total.format(line, sizeof line, "total");
+    ACE_DEBUG ((LM_INFO, ACE_TEXT ("(%t) %s"), line));
+    ACE_DEBUG ((LM_INFO, ACE_TEXT ("(%t) total: %d threads, %Q packets, %.0f pkts/s\n\n"), 
+        stats_.count(), (ACE_UINT64)total.packets, total_pps));
+}
+
+//////////////////////////////////////////////////////////////////////////
+
+MyTask:: MyTask(Server& server, int index): server_(server), options_(server.options()), index_(index)
+{
+    ACE_DEBUG ((LM_INFO, "(%t) in MyTask:: MyTask() %d\n", index));
+    running_reactor_ = NULL;
+    queue_ = NULL;
+    handler_ = NULL;
+    last_count_ = 0;
+}
+
+MyTask::~MyTask()
+{
+    ACE_DEBUG ((LM_INFO, "(%t) in MyTask::~MyTask() %d\n", index_));
+}
+
+int MyTask::open(void *)
+{
+    elapsed_ = ACE_Time_Value::zero;
+    if(this->activate(THR_NEW_LWP, MAX_USER_THREAD) == -1)
+    {
+        ACE_DEBUG((LM_ERROR, "activate MyTask failed"));
+        return -1;
+    }
+
+    return 0;
+}
+
+int MyTask::svc()
+{
+    ACE_DEBUG ((LM_INFO, ACE_TEXT ("(%t) enter MyTask::svc()\n\n")));
+
+    const int index = index_;
+    if (options_.cpu >= 0)
+        pin_thread(options_.cpu + index);
+
+    //initialization, every shard owns its reactor and deletes the implementation with it
+    ACE_Reactor* reactor = new ACE_Reactor(make_reactor_impl(options_.reactor_type), true);
+    this->reactor(reactor);
+
+    //the packet log of this thread, drained by logtask
+    LogChannel log;
+    logtask::instance()->attach(&log);
+
+    //register socket handler, all threads share the port by SO_REUSEPORT
+    Handler handler(options_.port, server_.stats().at(index), !options_.throughput, options_.batch, &log);
+    handler.reactor(reactor);  //task2 calls this reactor, also when the socket is on io_uring
+    //with io_uring the socket is not registered, unless the ring can't be set up
+    int opened = handler.open();
+    const int use_uring = 0 == opened && options_.uring && handler.open_uring() == 0;
+    if (opened == -1 || 
+        (!use_uring && reactor->register_handler(&handler, ACE_Event_Handler::READ_MASK) == -1))
+    {
+        ACE_ERROR((LM_ERROR, "%p\n", "can't register with Reactor in MyTask::svc()\n"));
+        logtask::instance()->detach(&log);
+        delete reactor;
+        return -1;
+    }
+    if (options_.busy_poll > 0)
+        handler.enable_nonblock();
+
+    //the staged pipeline of this shard answers instead of the Handler
+    Pipeline pipeline;
+    if (options_.pipeline)
+    {
+        if (pipeline.open(handler.get_handle()) == -1)
+            ACE_ERROR((LM_ERROR, "(%t) can't start the pipeline, echo directly\n"));
+        else
+            handler.set_pipeline(&pipeline);
+    }
+
+    //periodic jobs, idle expiry and delayed actions of this thread
+    TimerWheel timers;
+
+    //the peers of this thread, for the rate limit
+    SessionTable sessions;
+    if (options_.session_rate >= 0)
+    {
+        sessions.open(timers, options_.session_rate, 
+            options_.idle_timeout > 0 ? options_.idle_timeout : SESSION_IDLE_SECONDS);
+        handler.set_sessions(&sessions);
+    }
+
+    //TCP echo on the same port, with a listening socket of its own per thread
+    TcpAcceptor acceptor(server_.stats().at(index), options_.tcp_connections);
+    if (options_.tcp_connections > 0 && 
+        acceptor.open(options_.port, reactor, timers, options_.idle_timeout) == -1)
+        ACE_ERROR((LM_ERROR, "%p\n", "can't open the TCP acceptor\n"));
+
+    //registrations posted by other threads, applied by this one
+    CommandQueue commands(reactor);
+
+    //graceful shutdown on SIGINT/SIGTERM, handled by the reactor of thread 0
+    ShutdownHandler shutdown_handler(server_);
+    ACE_Sig_Set signals;
+    signals.sig_add(SIGINT);
+    signals.sig_add(SIGTERM);
+    if (0 == index)
+    {
+        if (reactor->register_handler(signals, &shutdown_handler) == -1)
+            ACE_ERROR((LM_ERROR, "%p\n", "can't register the signal handler\n"));
+        else
+            shutdown_handler.open(timers);
+    }
+
+    //stats queries, answered by thread 0 between its packets
+    StatsHandler stats_handler(server_.stats());
+    int stats_registered = 0;
+    if (0 == index && options_.stats_port != 0)
+    {
+        if (stats_handler.open(options_.stats_port) == -1 || 
+            reactor->register_handler(&stats_handler, ACE_Event_Handler::READ_MASK) == -1)
+            ACE_ERROR((LM_ERROR, "%p\n", "can't register the stats handler\n"));
+        else
+            stats_registered = 1;
+    }
+
+    {
+        ACE_GUARD_RETURN(ACE_Thread_Mutex, guard, lock_, -1);
+        running_reactor_ = reactor;
+        queue_ = &commands;
+    }
+
+    //a shutdown before the reactor was published did not wake it up
+    if (server_.stopping())
+        reactor->notify();
+
+    //spawn task2, its actions are timers of this thread
+    if (0 == index && (!options_.throughput || options_.register_bench) && 
+        server_.task2().open(&handler) == 0 && !options_.register_bench)
+        server_.task2().schedule_actions(timers);
+
+    int result = run_reactor(reactor, handler, commands, timers);
+
+    //the Handler has drained its socket, the stages finish what it has submitted
+    if (options_.pipeline)
+    {
+        handler.set_pipeline(NULL);
+        pipeline.close();
+        pipeline.report(index);
+    }
+
+    if (options_.session_rate >= 0)
+    {
+        handler.set_sessions(NULL);
+        sessions.report(index);
+        sessions.close();
+    }
+
+    //task2 uses this reactor and its queue, let it finish before they go away
+    if (0 == index)
+    {
+        server_.task2().stop();
+        commands.drain();
+        commands.report();
+        shutdown_handler.close();
+        reactor->remove_handler(signals);
+        if (stats_registered)
+            reactor->remove_handler(&stats_handler, ACE_Event_Handler::READ_MASK | ACE_Event_Handler::DONT_CALL);
+    }
+
+    {
+        ACE_GUARD_RETURN(ACE_Thread_Mutex, guard, lock_, -1);
+        running_reactor_ = NULL;
+        queue_ = NULL;
+    }
+
+    if (options_.tcp_connections > 0)
+    {
+        acceptor.close();
+        acceptor.report(index);
+    }
+
+    if (!use_uring && reactor->remove_handler(&handler, ACE_Event_Handler::READ_MASK | 
+        ACE_Event_Handler::DONT_CALL) == -1)
+    {
+        ACE_ERROR((LM_ERROR, "%p\n", "can't remove handler from Reactor\n"));
+        result = -1;
+    }
+
+    logtask::instance()->detach(&log);
+
+    this->reactor(NULL);
+    delete reactor;
+    reactor = NULL;
+    ACE_DEBUG ((LM_INFO, ACE_TEXT ("(%t) exit MyTask::svc()\n\n")));
+    return result;
+}
+
+int MyTask::run_reactor(ACE_Reactor* reactor, Handler& handler, CommandQueue& commands, TimerWheel& timers)
+{
+    const int index = index_;
+    const ACE_Time_Value start = ACE_OS::gettimeofday();
+    ACE_Time_Value last_packet = start;
+    int notified = 0;
+    int result = 0;
+
+    //wake up once a second to report, even if no packet arrives, and stop after -d seconds
+    handler_ = &handler;
+    last_count_ = 0;
+    if (options_.throughput)
+    {
+        timers.schedule(&report_timer_, this, &report_timer_, REPORT_MSEC, REPORT_MSEC);
+        if (options_.duration > 0)
+            timers.schedule(&stop_timer_, this, &stop_timer_, (ACE_UINT32)options_.duration * 1000);
+    }
+
+    //handle_events in forever-loop until receive two data packets from socket, then, it will notify the MY_EXIT_HANDLER
+    while (!server_.stopping())
+    {
+        //no timer pending: timeout will not occur at all
+        ACE_Time_Value wait;
+        ACE_Time_Value* timeout = timers.timeout(ACE_OS::gettimeofday(), wait);
+        if (handler.has_uring())
+            result = uring_events(reactor, handler, timeout);
+        else if (options_.throughput && options_.busy_poll > 0)
+            result = poll_events(reactor, handler, timeout, last_packet);
+        else
+            result = reactor->handle_events(timeout);
+
+        if (result == -1)
+        {
+            ACE_ERROR((LM_ERROR, "%p\n", "handle_events() failed\n"));
+            break;
+        }
+
+        //registrations from other threads, once per iteration
+        commands.drain();
+
+        timers.expire(ACE_OS::gettimeofday());
+
+        if (options_.throughput)
+            continue;
+
+        if (result > 0)  //io_uring returns 0 after a quiet wait
+            ACE_DEBUG ((LM_INFO, ACE_TEXT ("(%t) handle_events() succeed, result = %d\n\n"), result));
+        //a batch may take the count past RECV_COUNT, so notify once on >=
+        if (!notified && handler.get_count() >= RECV_COUNT)
+        {
+            notified = 1;
+            ACE_DEBUG ((LM_INFO, ACE_TEXT ("(%t) MyTask::svc() notify the exit handler\n")));
+            reactor->notify(&handler, ACE_Event_Handler::EXCEPT_MASK);
+        }
+
+        if (handler.get_flag())
+            server_.shutdown();
+    }
+
+    timers.cancel(&report_timer_);
+    timers.cancel(&stop_timer_);
+    handler_ = NULL;
+
+    //echo what is already queued on the socket before the handler goes away;
+    //the ring goes first, its multishot recv would race with the drain
+    handler.close_uring();
+    int drained = handler.drain();
+    if (drained > 0)
+        ACE_DEBUG ((LM_INFO, ACE_TEXT ("(%t) thread %d: %d datagrams drained at exit\n"), index, drained));
+
+    elapsed_ = ACE_OS::gettimeofday() - start;
+    return result == -1 ? -1 : 0;
+}
+
+//busy-poll instead of handle_events: spin on the non-blocking socket, with an
+//exponential back-off between empty polls, and return after every datagram
+//or every POLL_REACTOR_SPINS empty polls (after a zero-timeout handle_events),
+//so that the caller keeps up its reports and the command queue. Once no
+//datagram came in for busy_poll usec, wait in the reactor like the blocking path.
+int MyTask::poll_events(ACE_Reactor* reactor, Handler& handler, ACE_Time_Value* timeout, ACE_Time_Value& last_packet)
+{
+    int spins = 1;
+    int empty = 0;
+    while (!server_.stopping())
+    {
+        int n = handler.poll();
+        if (n == -1)
+            return -1;
+        if (n > 0)
+        {
+            last_packet = ACE_OS::gettimeofday();
+            return n;
+        }
+
+        if (usec_since(last_packet) >= (ACE_UINT64)options_.busy_poll)
+            break;
+
+        if (++empty == POLL_REACTOR_SPINS)
+        {
+            ACE_Time_Value zero = ACE_Time_Value::zero;
+            return reactor->handle_events(zero);
+        }
+
+        for (int i = 0; i < spins; i++)
+            cpu_relax();
+        if (spins < MAX_BACKOFF_SPINS)
+            spins <<= 1;
+    }
+
+    //idle: block until the next datagram, then spin again
+    int result = timeout != NULL ? reactor->handle_events(*timeout) : reactor->handle_events();
+    last_packet = ACE_OS::gettimeofday();
+    return result;
+}
+
+//io_uring instead of the reactor wait: reap completions for URING_WAIT_MSEC at
+//most (less if timeout is shorter), then run the reactor with a zero timeout
+//for notify, the command queue, the stats socket and the signals
+int MyTask::uring_events(ACE_Reactor* reactor, Handler& handler, ACE_Time_Value* timeout)
+{
+    ACE_Time_Value wait(0, URING_WAIT_MSEC * 1000);
+    if (timeout != NULL && *timeout < wait)
+        wait = *timeout;
+
+    int count = handler.run_uring(wait);
+    if (count == -1)
+        return -1;
+
+    ACE_Time_Value zero = ACE_Time_Value::zero;
+    int result = reactor->handle_events(zero);
+    return result == -1 ? -1 : count + result;
+}
+
+int MyTask::handle_timeout(const ACE_Time_Value&, const void* act)
+{
+    if (act == &stop_timer_)
+    {
+        server_.shutdown();
+        return 0;
+    }
+
+    int count = handler_->get_packets();
+    ACE_DEBUG ((LM_INFO, ACE_TEXT ("(%t) thread %d: %d pkts/s\n"), index_, count - last_count_));
+    last_count_ = count;
+    return 0;
+}
+
+void MyTask::wakeup(void)
+{
+    ACE_GUARD(ACE_Thread_Mutex, guard, lock_);
+    if (running_reactor_ != NULL)
+        running_reactor_->notify();
+}
+
+CommandQueue* MyTask::command_queue(void)
+{
+    ACE_GUARD_RETURN(ACE_Thread_Mutex, guard, lock_, NULL);
+    return queue_;
+}
+
+//////////////////////////////////////////////////////////////////////////
+
+MyTask2::MyTask2(Server& server): server_(server)
+{
+    handler_ = NULL;
+    exit_handle_ = MY_EXIT_HANDLER;
+    queue_ = NULL;
+    lane_ = -1;
+    register_bench_ = 0;
+    register_rate_ = REGISTER_RATE;
+    stop_flag_ = 0;
+    timers_ = NULL;
+    actions_ = 0;
+    calls_ = 0;
+    latency_sum_ = 0;
+    latency_max_ = 0;
+}
+
+int MyTask2::open(void *p)
+{
+    ACE_DEBUG ((LM_INFO, "(%t) MyTask2 start\n"));
+
+    handler_ = (Handler*)p;
+
+    const ServerOptions& options = server_.options();
+    register_bench_ = options.register_bench;
+    register_rate_ = options.register_rate > 0 ? options.register_rate : REGISTER_RATE;
+    stop_flag_ = 0;
+    calls_ = 0;
+    latency_sum_ = 0;
+    latency_max_ = 0;
+
+    //commands go through the queue of shard 0, the reactor of the Handler
+    queue_ = NULL;
+    lane_ = -1;
+    if (options.queue_commands)
+    {
+        queue_ = server_.command_queue(0);
+        lane_ = queue_ != NULL ? queue_->open_lane() : -1;
+        if (-1 == lane_)
+        {
+            ACE_ERROR((LM_WARNING, "(%t) MyTask2: no command queue lane, call the reactor directly\n"));
+            queue_ = NULL;
+        }
+    }
+
+    //ACE_Dev_Poll_Reactor only accepts handles which are open, and the benchmark
+    //must not have the select reactor drop an invalid handle behind its back
+    exit_handle_ = MY_EXIT_HANDLER;
+    if (DEV_POLL_REACTOR == options.reactor_type || register_bench_)
+        exit_handle_ = ACE_OS::dup(handler_->get_handle());
+
+    //stop() of an earlier run has deactivated the queue
+    this->msg_queue()->activate();
+    timers_ = NULL;
+    actions_ = 0;
+
+    if(this->activate(THR_NEW_LWP, MAX_USER_THREAD) == -1)
+    {
+        ACE_DEBUG((LM_ERROR, "activate MyTask2 failed"));
+        return -1;
+    }
+
+    return 0;
+}
+
+int MyTask2::svc()
+{
+    ACE_DEBUG ((LM_INFO, ACE_TEXT ("(%t) enter MyTask2::svc()\n\n")));
+
+    int result = 0;
+    if (register_bench_)
+        result = run_bench();
+    else
+    {
+        //register, remove, register, remove: one action per timer of shard 0
+        for (int i = 0; i < 2 * REGISTER_COUNT; i++)
+        {
+            ACE_Message_Block* mb = NULL;
+            if (this->getq(mb) == -1)  //deactivated by stop()
+                break;
+            const int op = mb->msg_type() - ACE_Message_Block::MB_USER;
+            mb->release();
+
+            if (CMD_REGISTER == op)
+            {
+                ACE_DEBUG ((LM_INFO, ACE_TEXT ("(%t) MyTask2::svc() register exit handler\n")));
+                if (register_exit_handler() == -1)
+                {
+                    ACE_ERROR((LM_ERROR, "%p\n", "(%t) MyTask2::svc() register exit handler failed\n"));
+                    result = -1;
+                    break;
+                }
+            }
+            else
+            {
+                ACE_DEBUG ((LM_INFO, ACE_TEXT ("(%t) MyTask2::svc() remove exit handler\n\n")));
+                if (remove_exit_handler() == -1)
+                {
+                    ACE_ERROR((LM_ERROR, "%p\n", "(%t) MyTask2::svc() remove exit handler failed\n"));
+                    result = -1;
+                    break;
+                }
+            }
+        }
+    }
+
+    if (exit_handle_ != MY_EXIT_HANDLER)
+        ACE_OS::close(exit_handle_);
+
+    ACE_DEBUG ((LM_INFO, ACE_TEXT ("(%t) exit MyTask2::svc()\n\n")));
+    return result;
+}
+
+//ask svc() to leave, and join its thread; called by shard 0, the owner of the
+//timer, after its event loop (svc() may still call that reactor). Returns at
+//once if the task was not activated; Server::wait() has nothing left to join
+void MyTask2::stop(void)
+{
+    stop_flag_ = 1;
+    if (timers_ != NULL)
+        timers_->cancel(&action_timer_);
+    this->msg_queue()->deactivate();
+    this->wait();
+}
+
+void MyTask2::schedule_actions(TimerWheel& timers)
+{
+    timers_ = &timers;
+    actions_ = 0;
+    timers.schedule(&action_timer_, this, NULL, 0, ACTION_MSEC);
+}
+
+int MyTask2::handle_timeout(const ACE_Time_Value&, const void*)
+{
+    const int op = 0 == actions_ % 2 ? CMD_REGISTER : CMD_REMOVE;
+    ACE_Message_Block* mb = new ACE_Message_Block(0, ACE_Message_Block::MB_USER + op);
+    if (this->putq(mb) == -1)
+    {
+        mb->release();
+        return -1;
+    }
+
+    //-1 cancels the timer after the last action
+    return ++actions_ < 2 * REGISTER_COUNT ? 0 : -1;
+}
+
+int MyTask2::register_exit_handler(void)
+{
+    if (queue_ != NULL)
+        return queue_->post(lane_, CMD_REGISTER, exit_handle_, handler_, ACE_Event_Handler::EXCEPT_MASK);
+
+    ACE_Time_Value start = ACE_OS::gettimeofday();
+    int result = handler_->reactor()->register_handler(exit_handle_, handler_, ACE_Event_Handler::EXCEPT_MASK);
+    account(start);
+    return result;
+}
+
+int MyTask2::remove_exit_handler(void)
+{
+    if (queue_ != NULL)
+        return queue_->post(lane_, CMD_REMOVE, exit_handle_, NULL, ACE_Event_Handler::EXCEPT_MASK);
+
+    ACE_Time_Value start = ACE_OS::gettimeofday();
+    int result = handler_->reactor()->remove_handler(exit_handle_, ACE_Event_Handler::EXCEPT_MASK);
+    account(start);
+    return result;
+}
+
+void MyTask2::account(const ACE_Time_Value& start)
+{
+    ACE_UINT64 usec = usec_since(start);
+    ++calls_;
+    latency_sum_ += usec;
+    if (usec > latency_max_)
+        latency_max_ = usec;
+}
+
+//register/remove register_rate_ times a second while the reactors run in throughput mode
+int MyTask2::run_bench(void)
+{
+    const ACE_Time_Value pause(0, 1000000 / register_rate_);
+    int pairs = 0;
+    int failed = 0;
+
+    while (stop_flag_ == 0)
+    {
+        if (register_exit_handler() == -1 || remove_exit_handler() == -1)
+            ++failed;
+        ++pairs;
+        ACE_OS::sleep(pause);
+    }
+
+    ACE_DEBUG ((LM_INFO, ACE_TEXT ("(%t) MyTask2: %d register/remove pairs, %d failed, %s\n"), 
+        pairs, failed, queue_ != NULL ? "queued" : "direct"));
+    if (calls_ > 0)
+        ACE_DEBUG ((LM_INFO, ACE_TEXT ("(%t) MyTask2: direct call latency avg %d usec, max %d usec\n"), 
+            (int)(latency_sum_ / calls_), (int)latency_max_));
+    return 0;
+}
+
+//////////////////////////////////////////////////////////////////////////
+
+TimerWheel::TimerWheel()
+{
+    for (int i = 0; i < TIMER_LEVELS * TIMER_SLOTS; i++)
+        slots_[i].prev = slots_[i].next = &slots_[i];
+    ACE_OS::memset(occupied_, 0, sizeof occupied_);
+    origin_ = ACE_OS::gettimeofday();
+    now_ = 0;
+    count_ = 0;
+}
+
+//the nodes outlive the wheel, leave them not pending
+TimerWheel::~TimerWheel()
+{
+    for (int i = 0; i < TIMER_LEVELS * TIMER_SLOTS; i++)
+    {
+        while (slots_[i].next != &slots_[i])
+            unlink(slots_[i].next);
+    }
+}
+
+void TimerWheel::schedule(TimerNode* node, ACE_Event_Handler* handler, const void* act, 
+    ACE_UINT32 delay_msec, ACE_UINT32 interval_msec)
+{
+    if (node->pending())
+        unlink(node);
+
+    //from the clock, now_ may be a whole wait behind; at least one tick ahead,
+    //the slot of now_ has already run
+    ACE_UINT64 base = tick();
+    if (base < now_)
+        base = now_;
+    node->expires = base + (delay_msec > 0 ? delay_msec : 1);
+    node->interval = interval_msec;
+    node->handler = handler;
+    node->act = act;
+    insert(node);
+}
+
+void TimerWheel::cancel(TimerNode* node)
+{
+    if (node->pending())
+        unlink(node);
+}
+
+//the level whose range holds the delay, the slot by the bits of that level
+void TimerWheel::insert(TimerNode* node)
+{
+    static const ACE_UINT64 MAX_DELAY = ((ACE_UINT64)1 << (TIMER_BITS * TIMER_LEVELS)) - 1;
+
+    if (node->expires < now_)
+        node->expires = now_;
+    ACE_UINT64 delay = node->expires - now_;
+    if (delay > MAX_DELAY)
+    {
+        delay = MAX_DELAY;
+        node->expires = now_ + MAX_DELAY;
+    }
+
+    int level = 0;
+    while (level < TIMER_LEVELS - 1 && delay >= ((ACE_UINT64)1 << ((level + 1) * TIMER_BITS)))
+        ++level;
+    const int index = (int)(node->expires >> (level * TIMER_BITS)) & (TIMER_SLOTS - 1);
+    node->slot = level * TIMER_SLOTS + index;
+
+    TimerNode* head = &slots_[node->slot];
+    node->next = head;
+    node->prev = head->prev;
+    head->prev->next = node;
+    head->prev = node;
+    if (0 == level)
+        occupied_[index / 64] |= (ACE_UINT64)1 << (index % 64);
+    ++count_;
+}
+
+void TimerWheel::unlink(TimerNode* node)
+{
+    node->prev->next = node->next;
+    node->next->prev = node->prev;
+    node->prev = node->next = NULL;
+    --count_;
+
+    TimerNode* head = &slots_[node->slot];
+    if (node->slot < TIMER_SLOTS && head->next == head)
+        occupied_[node->slot / 64] &= ~((ACE_UINT64)1 << (node->slot % 64));
+}
+
+//move the slot of the current position of a level down to the levels below
+void TimerWheel::cascade(int level)
+{
+    const int index = (int)(now_ >> (level * TIMER_BITS)) & (TIMER_SLOTS - 1);
+    TimerNode* head = &slots_[level * TIMER_SLOTS + index];
+    while (head->next != head)
+    {
+        TimerNode* node = head->next;
+        unlink(node);
+        insert(node);
+    }
+}
+
+int TimerWheel::expire(const ACE_Time_Value& now)
+{
+    const ACE_UINT64 target = ticks(now);
+    int fired = 0;
+    while (now_ < target)
+    {
+        //nothing to run or to cascade, jump to the clock
+        if (0 == count_)
+        {
+            now_ = target;
+            break;
+        }
+
+        ++now_;
+        const int index = (int)now_ & (TIMER_SLOTS - 1);
+        if (0 == index)
+        {
+            for (int level = 1; level < TIMER_LEVELS; level++)
+            {
+                cascade(level);
+                if (((now_ >> (level * TIMER_BITS)) & (TIMER_SLOTS - 1)) != 0)
+                    break;
+            }
+        }
+
+        TimerNode* head = &slots_[index];
+        if (head->next == head)
+            continue;
+
+        //take the whole slot first, the handlers may schedule and cancel
+        TimerNode due;
+        due.next = head->next;
+        due.prev = head->prev;
+        due.next->prev = &due;
+        due.prev->next = &due;
+        head->prev = head->next = head;
+        occupied_[index / 64] &= ~((ACE_UINT64)1 << (index % 64));
+
+        while (due.next != &due)
+        {
+            TimerNode* node = due.next;
+            node->prev->next = node->next;
+            node->next->prev = node->prev;
+            node->prev = node->next = NULL;
+            --count_;
+
+            if (node->interval > 0)
+            {
+                node->expires = now_ + node->interval;
+                insert(node);
+            }
+            ++fired;
+            if (node->handler->handle_timeout(now, node->act) == -1)
+                cancel(node);
+        }
+    }
+    return fired;
+}
+
+//the next level 0 slot with timers in this round, or else the end of the
+//round, where level 1 cascades
+ACE_Time_Value* TimerWheel::timeout(const ACE_Time_Value& now, ACE_Time_Value& timeout) const
+{
+    if (0 == count_)
+        return NULL;
+
+    ACE_UINT64 due = (now_ | (TIMER_SLOTS - 1)) + 1;
+    int index = ((int)now_ & (TIMER_SLOTS - 1)) + 1;
+    while (index < TIMER_SLOTS)
+    {
+        ACE_UINT64 bits = occupied_[index / 64] >> (index % 64);
+        if (bits != 0)
+        {
+            index += lowest_bit(bits);
+            due = (now_ & ~(ACE_UINT64)(TIMER_SLOTS - 1)) + index;
+            break;
+        }
+        index = (index / 64 + 1) * 64;
+    }
+
+    ACE_Time_Value at = origin_ + ACE_Time_Value((time_t)(due / 1000), (suseconds_t)(due % 1000) * 1000);
+    timeout = at > now ? at - now : ACE_Time_Value::zero;
+    return &timeout;
+}
+
+ACE_UINT64 TimerWheel::ticks(const ACE_Time_Value& time) const
+{
+    if (time < origin_)
+        return 0;
+    ACE_Time_Value elapsed = time - origin_;
+    return (ACE_UINT64)elapsed.sec() * 1000 + elapsed.usec() / 1000;
+}
+
+//////////////////////////////////////////////////////////////////////////
+
+void HandlerStats::reset(void)
+{
+    packets = 0;
+    bytes = 0;
+    recv_errors = 0;
+    send_errors = 0;
+    batches = 0;
+    for (int i = 0; i < BATCH_BUCKETS; i++)
+        batch_sizes[i] = 0;
+    input_ticks = 0;
+    input_max_ticks = 0;
+    throttled = 0;
+}
+
+void HandlerStats::add(const HandlerStats& other)
+{
+    packets += other.packets;
+    bytes += other.bytes;
+    recv_errors += other.recv_errors;
+    send_errors += other.send_errors;
+    batches += other.batches;
+    for (int i = 0; i < BATCH_BUCKETS; i++)
+        batch_sizes[i] += other.batch_sizes[i];
+    input_ticks += other.input_ticks;
+    if (other.input_max_ticks > input_max_ticks)
+        input_max_ticks = other.input_max_ticks;
+    throttled += other.throttled;
+}
+
+//n > 0 datagrams received by one handle_input, bucket k holds 2^k .. 2^(k+1)-1
+void HandlerStats::record_batch(int n)
+{
+    int bucket = 0;
+    while ((n >>= 1) != 0 && bucket < BATCH_BUCKETS - 1)
+        ++bucket;
+    ++batch_sizes[bucket];
+    ++batches;
+}
+
+int HandlerStats::format(char* buf, size_t size, const char* name) const
+{
+    //ticks per microsecond
+    double scale = ACE_High_Res_Timer::global_scale_factor();
+    if (scale <= 0)
+        scale = 1;
+    double avg_us = batches > 0 ? input_ticks / scale / batches : 0;
+
+    int len = ACE_OS::snprintf(buf, size, "%s: packets %llu, bytes %llu, recv errors %llu, send errors %llu, "
+        "throttled %llu, handle_input avg %.2f us max %.2f us, batches",
+        name, (unsigned long long)packets, (unsigned long long)bytes, (unsigned long long)recv_errors,
+        (unsigned long long)send_errors, (unsigned long long)throttled, avg_us, input_max_ticks / scale);
+    for (int i = 0; i < BATCH_BUCKETS && len >= 0 && (size_t)len < size; i++)
+        len += ACE_OS::snprintf(buf + len, size - len, " %d:%llu", 1 << i, (unsigned long long)batch_sizes[i]);
+    if (len >= 0 && (size_t)len < size)
+        len += ACE_OS::snprintf(buf + len, size - len, "\n");
+    return len;
+}
+
+void StatsTable::open(int count)
+{
+    delete [] raw_;
+    raw_ = new char[(size_t)count * STRIDE + CACHE_LINE_SIZE];
+    size_t misalign = (size_t)raw_ % CACHE_LINE_SIZE;
+    base_ = misalign ? raw_ + (CACHE_LINE_SIZE - misalign) : raw_;
+    count_ = count;
+    for (int i = 0; i < count_; i++)
+        new (base_ + (size_t)i * STRIDE) HandlerStats;
+}
+
+void StatsTable::total(HandlerStats& sum) const
+{
+    sum.reset();
+    for (int i = 0; i < count_; i++)
+        sum.add(at(i));
+}
+
+int StatsTable::format(char* buf, size_t size) const
+{
+    int len = 0;
+    char name[32];
+    buf[0] = '\0';
+    for (int i = 0; i < count_ && (size_t)len < size; i++)
+    {
+        ACE_OS::snprintf(name, sizeof name, "thread %d", i);
+        int n = at(i).format(buf + len, size - len, name);
+        if (n < 0)
+            return len;
+        len += n;
+    }
+
+    HandlerStats sum;
+    total(sum);
+    if ((size_t)len < size)
+    {
+        int n = sum.format(buf + len, size - len, "total");
+        if (n > 0)
+            len += n;
+    }
+    return (size_t)len < size ? len : (int)size - 1;
+}
+
+//////////////////////////////////////////////////////////////////////////
+
+//local only, the counters are not for the outside
+int StatsHandler::open(u_short port)
+{
+    ACE_INET_Addr addr(port, "127.0.0.1");
+    if (this->dgramt_.open(addr) == -1)
+        ACE_ERROR_RETURN((LM_ERROR, "%p\n", "StatsHandler::open: bind failed"), -1);
+
+    ACE_DEBUG ((LM_INFO, ACE_TEXT ("(%t) stats on 127.0.0.1:%d\n"), port));
+    return 0;
+}
+
+StatsHandler::~StatsHandler(void)
+{
+    this->dgramt_.close();
+}
+
+//the content of the query does not matter, the reply is the whole table
+int StatsHandler::handle_input(ACE_HANDLE)
+{
+    char query[64];
+    ACE_INET_Addr remote_addr;
+    if (this->dgramt_.recv(query, sizeof query, remote_addr) == -1)
+        return 0;
+
+    char reply[STATS_REPLY_SIZE];
+    int len = stats_.format(reply, sizeof reply);
+    this->dgramt_.send(reply, len, remote_addr);
+    return 0;
+}
+
+//////////////////////////////////////////////////////////////////////////
+
+BufferPool::~BufferPool()
+{
+    while (free_ != NULL)
+    {
+        FreeChunk* chunk = free_;
+        free_ = chunk->next;
+        delete [] (char*)chunk;
+    }
+}
+
+char* BufferPool::get(void)
+{
+    if (NULL == free_)
+    {
+        ++allocated_;
+        return new char[TCP_CHUNK_SIZE];
+    }
+
+    FreeChunk* chunk = free_;
+    free_ = chunk->next;
+    return (char*)chunk;
+}
+
+void BufferPool::put(char* chunk)
+{
+    FreeChunk* free_chunk = (FreeChunk*)chunk;
+    free_chunk->next = free_;
+    free_ = free_chunk;
+}
+
+//////////////////////////////////////////////////////////////////////////
+
+TcpConnection::TcpConnection()
+{
+    next_ = NULL;
+    owner_ = NULL;
+    count_ = 0;
+    reading_ = 0;
+    last_read_ = 0;
+}
+
+//the stream is already accepted into stream()
+int TcpConnection::open(TcpAcceptor* owner, ACE_Reactor* reactor)
+{
+    owner_ = owner;
+    count_ = 0;
+    reading_ = 1;
+    this->stream_.enable(ACE_NONBLOCK);
+    if (reactor->register_handler(this, ACE_Event_Handler::READ_MASK) == -1)
+    {
+        owner_ = NULL;
+        this->stream_.close();
+        return -1;
+    }
+
+    if (owner->idle_msec() > 0)
+    {
+        last_read_ = owner->timers()->tick();
+        owner->timers()->schedule(&idle_timer_, this, NULL, owner->idle_msec());
+    }
+    return 0;
+}
+
+//give back the chunks and the socket, then the connection itself
+void TcpConnection::close(void)
+{
+    if (NULL == owner_)
+        return;
+
+    if (this->reactor() != NULL)
+        this->reactor()->remove_handler(this, ACE_Event_Handler::ALL_EVENTS_MASK | ACE_Event_Handler::DONT_CALL);
+    this->stream_.close();
+    if (idle_timer_.pending())
+        owner_->timers()->cancel(&idle_timer_);
+
+    for (int i = 0; i < count_; i++)
+        owner_->pool().put(chunks_[i]);
+    count_ = 0;
+
+    TcpAcceptor* owner = owner_;
+    owner_ = NULL;
+    owner->release(this);
+}
+
+//one read per call, so that the connections of a thread take turns
+int TcpConnection::handle_input(ACE_HANDLE)
+{
+    if (count_ == TCP_MAX_PENDING)
+    {
+        //back-pressure: the peer does not read its echoes, stop reading from it
+        if (reading_)
+        {
+            reading_ = 0;
+            owner_->count_backpressure();
+            this->reactor()->cancel_wakeup(this, ACE_Event_Handler::READ_MASK);
+            this->reactor()->schedule_wakeup(this, ACE_Event_Handler::WRITE_MASK);
+        }
+        return 0;
+    }
+
+    HandlerStats& stats = owner_->stats();
+    char* chunk = owner_->pool().get();
+    ssize_t n = this->stream_.recv(chunk, TCP_CHUNK_SIZE);
+    if (n <= 0)
+    {
+        owner_->pool().put(chunk);
+        if (n == -1 && (EWOULDBLOCK == errno || EAGAIN == errno))
+            return 0;
+        if (n == -1)
+            ++stats.recv_errors;
+        return -1;  //closed by the peer or failed, handle_close cleans up
+    }
+
+    ++stats.packets;
+    stats.bytes += n;
+    stats.record_batch(1);
+
+    //no reschedule per read, the idle timer looks at the stamp when it fires;
+    //the tick of the last expire is at most one wait behind
+    if (owner_->idle_msec() > 0)
+        last_read_ = owner_->timers()->now();
+
+    chunks_[count_] = chunk;
+    pending_[count_].iov_base = chunk;
+    pending_[count_].iov_len = n;
+    ++count_;
+
+    if (flush() == -1)
+        return -1;
+
+    //whatever writev left behind goes out on WRITE_MASK
+    if (count_ > 0)
+        this->reactor()->schedule_wakeup(this, ACE_Event_Handler::WRITE_MASK);
+    return 0;
+}
+
+int TcpConnection::handle_output(ACE_HANDLE)
+{
+    if (flush() == -1)
+        return -1;
+    if (count_ > 0)
+        return 0;
+
+    //all sent, stop waiting for WRITE_MASK and read again
+    this->reactor()->cancel_wakeup(this, ACE_Event_Handler::WRITE_MASK);
+    if (!reading_)
+    {
+        reading_ = 1;
+        this->reactor()->schedule_wakeup(this, ACE_Event_Handler::READ_MASK);
+    }
+    return 0;
+}
+
+int TcpConnection::handle_close(ACE_HANDLE, ACE_Reactor_Mask)
+{
+    close();
+    return 0;
+}
+
+int TcpConnection::handle_timeout(const ACE_Time_Value&, const void*)
+{
+    TimerWheel* timers = owner_->timers();
+    const ACE_UINT32 limit = owner_->idle_msec();
+    ACE_UINT64 idle = timers->now() > last_read_ ? timers->now() - last_read_ : 0;
+    if (idle >= limit)
+    {
+        owner_->count_idle();
+        close();
+        return 0;
+    }
+
+    //read in the meantime: wait for the rest
+    timers->schedule(&idle_timer_, this, NULL, limit - (ACE_UINT32)idle);
+    return 0;
+}
+
+//one writev over all pending chunks, keeps what the socket did not take
+int TcpConnection::flush(void)
+{
+    if (0 == count_)
+        return 0;
+
+    ssize_t n = ACE_OS::writev(this->get_handle(), pending_, count_);
+    if (n == -1)
+    {
+        if (EWOULDBLOCK == errno || EAGAIN == errno)
+            return 0;
+        ++owner_->stats().send_errors;
+        return -1;
+    }
+
+    //drop the chunks which are out, the first one left may be partly sent
+    int done = 0;
+    while (done < count_ && (size_t)n >= pending_[done].iov_len)
+    {
+        n -= pending_[done].iov_len;
+        owner_->pool().put(chunks_[done]);
+        ++done;
+    }
+    if (done < count_ && n > 0)
+    {
+        pending_[done].iov_base = (char*)pending_[done].iov_base + n;
+        pending_[done].iov_len -= n;
+    }
+
+    for (int i = done; i < count_; i++)
+    {
+        chunks_[i - done] = chunks_[i];
+        pending_[i - done] = pending_[i];
+    }
+    count_ -= done;
+    return 0;
+}
+
+//////////////////////////////////////////////////////////////////////////
+
+TcpAcceptor::TcpAcceptor(HandlerStats& stats, int max_connections): stats_(stats)
+{
+    max_ = max_connections > 0 ? max_connections : 0;
+    connections_ = NULL;
+    free_ = NULL;
+    open_ = 0;
+    peak_ = 0;
+    accepted_ = 0;
+    refused_ = 0;
+    backpressure_ = 0;
+    timers_ = NULL;
+    idle_msec_ = 0;
+    idle_closed_ = 0;
+}
+
+TcpAcceptor::~TcpAcceptor(void)
+{
+    close();
+    delete [] connections_;
+}
+
+//the listening socket by hand, like Handler::open, for SO_REUSEPORT before bind
+int TcpAcceptor::open(u_short port, ACE_Reactor* reactor, TimerWheel& timers, int idle_seconds)
+{
+    timers_ = &timers;
+    idle_msec_ = idle_seconds > 0 ? (ACE_UINT32)idle_seconds * 1000 : 0;
+
+    connections_ = new TcpConnection[max_];
+    for (int i = max_ - 1; i >= 0; i--)
+    {
+        connections_[i].next_ = free_;
+        free_ = &connections_[i];
+    }
+
+    ACE_HANDLE h = ACE_OS::socket(AF_INET, SOCK_STREAM, 0);
+    if (ACE_INVALID_HANDLE == h)
+        ACE_ERROR_RETURN((LM_ERROR, "%p\n", "TcpAcceptor::open: socket failed"), -1);
+
+    int one = 1;
+    if (ACE_OS::setsockopt(h, SOL_SOCKET, SO_REUSEADDR, (const char*)&one, sizeof one) == -1)
+        ACE_ERROR((LM_ERROR, "%p\n", "TcpAcceptor::open: SO_REUSEADDR failed"));
+#if defined (SO_REUSEPORT)
+    if (ACE_OS::setsockopt(h, SOL_SOCKET, SO_REUSEPORT, (const char*)&one, sizeof one) == -1)
+        ACE_ERROR((LM_ERROR, "%p\n", "TcpAcceptor::open: SO_REUSEPORT failed"));
+#endif
+
+    ACE_INET_Addr addr(port);
+    if (ACE_OS::bind(h, (sockaddr*)addr.get_addr(), addr.get_size()) == -1 || 
+        ACE_OS::listen(h, TCP_BACKLOG) == -1)
+    {
+        ACE_OS::closesocket(h);
+        ACE_ERROR_RETURN((LM_ERROR, "%p\n", "TcpAcceptor::open: bind/listen failed"), -1);
+    }
+
+    this->acceptor_.set_handle(h);
+    this->acceptor_.enable(ACE_NONBLOCK);
+    if (reactor->register_handler(this, ACE_Event_Handler::READ_MASK) == -1)
+    {
+        this->acceptor_.close();
+        ACE_ERROR_RETURN((LM_ERROR, "%p\n", "TcpAcceptor::open: register_handler failed"), -1);
+    }
+    return 0;
+}
+
+//stop accepting and close every open connection
+void TcpAcceptor::close(void)
+{
+    if (this->acceptor_.get_handle() == ACE_INVALID_HANDLE)
+        return;
+
+    if (this->reactor() != NULL)
+        this->reactor()->remove_handler(this, ACE_Event_Handler::READ_MASK | ACE_Event_Handler::DONT_CALL);
+    this->acceptor_.close();
+
+    for (int i = 0; i < max_; i++)
+        connections_[i].close();
+}
+
+//accept until the backlog is empty or the burst is over; without a free
+//connection the new one is closed at once, so the backlog does not fill up
+int TcpAcceptor::handle_input(ACE_HANDLE)
+{
+    for (int i = 0; i < TCP_ACCEPT_BURST; i++)
+    {
+        ACE_SOCK_Stream stream;
+        if (this->acceptor_.accept(stream) == -1)
+        {
+            if (EWOULDBLOCK == errno || EAGAIN == errno)
+                return 0;
+            ACE_ERROR_RETURN((LM_ERROR, "%p\n", "TcpAcceptor: accept failed"), 0);
+        }
+        ++accepted_;
+
+        TcpConnection* connection = free_;
+        if (NULL == connection)
+        {
+            ++refused_;
+            stream.close();
+            continue;
+        }
+        free_ = connection->next_;
+
+        connection->stream().set_handle(stream.get_handle());
+        if (connection->open(this, this->reactor()) == -1)
+        {
+            //e.g. more handles than the select reactor takes
+            ++refused_;
+            connection->next_ = free_;
+            free_ = connection;
+            continue;
+        }
+
+        if (++open_ > peak_)
+            peak_ = open_;
+    }
+    return 0;
+}
+
+void TcpAcceptor::release(TcpConnection* connection)
+{
+    connection->next_ = free_;
+    free_ = connection;
+    --open_;
+}
+
+void TcpAcceptor::report(int index) const
+{
+    ACE_DEBUG ((LM_INFO, ACE_TEXT ("(%t) thread %d tcp: %d accepted, %d refused, peak %d connections, ")
+        ACE_TEXT ("%d back-pressure stops, %d idle timeouts, %d pool chunks\n"), 
+        index, accepted_, refused_, peak_, backpressure_, idle_closed_, pool_.allocated()));
+}
+
+//////////////////////////////////////////////////////////////////////////
+
+int DecodeProcessor::process(PipelineMessage& message)
+{
+    message.framed = 0;
+    if (message.length < (int)sizeof(EchoHeader))
+        return 0;
+
+    ACE_OS::memcpy(&message.header, message.data, sizeof(EchoHeader));
+    message.framed = ECHO_MAGIC == message.header.magic;
+    return 0;
+}
+
+ACE_UINT32 ChecksumProcessor::checksum(const char* data, int length)
+{
+    ACE_UINT32 hash = 2166136261U;
+    for (int i = 0; i < length; i++)
+    {
+        hash ^= (unsigned char)data[i];
+        hash *= 16777619U;
+    }
+    return hash;
+}
+
+int ChecksumProcessor::process(PipelineMessage& message)
+{
+    int offset = message.framed ? (int)sizeof(EchoHeader) : 0;
+    message.checksum = checksum(message.data + offset, message.length - offset);
+    return 0;
+}
+
+int EncodeProcessor::process(PipelineMessage& message)
+{
+    int offset = message.framed ? (int)sizeof(EchoHeader) : 0;
+    if (ChecksumProcessor::checksum(message.data + offset, message.length - offset) != message.checksum)
+        return -1;
+
+    if (message.framed)
+        ACE_OS::memcpy(message.data, &message.header, sizeof(EchoHeader));
+    return 0;
+}
+
+int SendProcessor::process(PipelineMessage& message)
+{
+    return ACE_OS::sendto(socket_, message.data, message.length, 0, 
+        (const sockaddr*)&message.peer, sizeof message.peer) == -1 ? -1 : 0;
+}
+
+PipelineStage::PipelineStage()
+{
+    pipeline_ = NULL;
+    id_ = 0;
+    in_ = NULL;
+    out_ = NULL;
+    processor_ = NULL;
+    done_ = 0;
+}
+
+void PipelineStage::init(Pipeline* pipeline, int id, MessageRing* in, MessageRing* out, MessageProcessor* processor)
+{
+    pipeline_ = pipeline;
+    id_ = id;
+    in_ = in;
+    out_ = out;
+    processor_ = processor;
+    done_ = 0;
+    messages_ = 0;
+    dropped_ = 0;
+    rounds_ = 0;
+    latency_ticks_ = 0;
+    latency_max_ = 0;
+    depth_sum_ = 0;
+    depth_max_ = 0;
+}
+
+int PipelineStage::open(void *)
+{
+    if(this->activate(THR_NEW_LWP, 1) == -1)
+    {
+        ACE_DEBUG((LM_ERROR, "activate PipelineStage failed"));
+        return -1;
+    }
+    return 0;
+}
+
+int PipelineStage::svc()
+{
+    int idle = 0;
+    for (;;)
+    {
+        //the queue depth seen at the start of a round, before the batch is taken
+        long depth = in_->size();
+        int n = 0;
+        PipelineMessage** slot;
+        while (n < PIPELINE_BATCH && (slot = in_->front()) != NULL)
+        {
+            PipelineMessage* message = *slot;
+            in_->pop();
+
+            if (message->length > 0 && processor_->process(*message) == -1)
+            {
+                message->length = 0;  //the stages behind only pass it on
+                ++dropped_;
+            }
+
+            ACE_hrtime_t now = ACE_OS::gethrtime();
+            ACE_UINT64 ticks = now - message->queued;
+            latency_ticks_ += ticks;
+            if (ticks > latency_max_)
+                latency_max_ = ticks;
+            message->queued = now;
+
+            //never full, the rings hold all messages of the pipeline
+            *out_->reserve() = message;
+            out_->commit();
+            ++n;
+        }
+
+        if (n > 0)
+        {
+            messages_ += n;
+            ++rounds_;
+            depth_sum_ += depth;
+            if (depth > depth_max_)
+                depth_max_ = depth;
+            idle = 0;
+            continue;
+        }
+
+        //upstream first: once it is done, whatever it sent is in the ring
+        if (pipeline_->upstream_done(id_) && in_->front() == NULL)
+            break;
+
+        if (++idle < PIPELINE_SPINS)
+            cpu_relax();
+        else
+            ACE_OS::sleep(ACE_Time_Value(0, PIPELINE_IDLE_USEC));
+    }
+
+    done_ = 1;
+    return 0;
+}
+
+void PipelineStage::report(int shard) const
+{
+    static const char* names[PIPELINE_STAGES] = {"decode", "process", "encode", "send"};
+
+    double scale = ACE_High_Res_Timer::global_scale_factor();
+    if (scale <= 0)
+        scale = 1;
+    double avg_us = messages_ > 0 ? latency_ticks_ / scale / messages_ : 0;
+    double avg_depth = rounds_ > 0 ? (double)depth_sum_ / rounds_ : 0;
+    ACE_DEBUG ((LM_INFO, ACE_TEXT ("(%t) thread %d %-7s: %Q messages, %Q dropped, latency avg %.2f us max %.2f us, ")
+        ACE_TEXT ("queue depth avg %.1f max %d\n"), 
+        shard, names[id_], messages_, dropped_, avg_us, latency_max_ / scale, avg_depth, (int)depth_max_));
+}
+
+//////////////////////////////////////////////////////////////////////////
+
+Pipeline::Pipeline()
+{
+    messages_ = NULL;
+    processors_[STAGE_DECODE] = &decode_;
+    processors_[STAGE_PROCESS] = &checksum_;
+    processors_[STAGE_ENCODE] = &encode_;
+    processors_[STAGE_SEND] = &send_;
+    stop_flag_ = 0;
+    open_ = 0;
+    submitted_ = 0;
+    full_ = 0;
+}
+
+Pipeline::~Pipeline()
+{
+    close();
+    delete [] messages_;
+}
+
+void Pipeline::set_processor(int stage, MessageProcessor* processor)
+{
+    if (stage >= 0 && stage < PIPELINE_STAGES && processor != NULL)
+        processors_[stage] = processor;
+}
+
+int Pipeline::open(ACE_HANDLE socket)
+{
+    messages_ = new PipelineMessage[PIPELINE_MESSAGES];
+    for (int i = 0; i < PIPELINE_MESSAGES; i++)
+    {
+        *free_.reserve() = &messages_[i];
+        free_.commit();
+    }
+
+    send_.socket(socket);
+    stop_flag_ = 0;
+    for (int i = 0; i < PIPELINE_STAGES; i++)
+    {
+        MessageRing* out = i + 1 < PIPELINE_STAGES ? &queues_[i + 1] : &free_;
+        stages_[i].init(this, i, &queues_[i], out, processors_[i]);
+    }
+
+    for (int i = 0; i < PIPELINE_STAGES; i++)
+    {
+        if (stages_[i].open(0) == -1)
+        {
+            open_ = i;
+            close();
+            return -1;
+        }
+    }
+    open_ = PIPELINE_STAGES;
+    return 0;
+}
+
+void Pipeline::close(void)
+{
+    if (0 == open_)
+        return;
+
+    stop_flag_ = 1;
+    for (int i = 0; i < open_; i++)
+        stages_[i].wait();
+    open_ = 0;
+}
+
+int Pipeline::submit(const char* data, int length, const sockaddr_in& peer)
+{
+    PipelineMessage** slot = free_.front();
+    if (NULL == slot)
+    {
+        ++full_;  //every message is in a stage, drop the datagram
+        return -1;
+    }
+    PipelineMessage* message = *slot;
+    free_.pop();
+
+    ACE_OS::memcpy(message->data, data, length);
+    message->length = length;
+    message->peer = peer;
+    message->queued = ACE_OS::gethrtime();
+
+    *queues_[STAGE_DECODE].reserve() = message;
+    queues_[STAGE_DECODE].commit();
+    ++submitted_;
+    return 0;
+}
+
+int Pipeline::upstream_done(int id) const
+{
+    return 0 == id ? stop_flag_.value() : stages_[id - 1].done();
+}
+
+void Pipeline::report(int shard) const
+{
+    ACE_DEBUG ((LM_INFO, ACE_TEXT ("(%t) thread %d pipeline: %d submitted, %d dropped (full)\n"), 
+        shard, submitted_, full_));
+    for (int i = 0; i < PIPELINE_STAGES; i++)
+        stages_[i].report(shard);
+}
+
+//////////////////////////////////////////////////////////////////////////
+
+//sets the last-seen tick, which moves the session to the end of by_last_seen
+struct touch_session
+{
+    touch_session(ACE_UINT64 now): now_(now)
+    {
+    }
+
+    void operator()(Session& session) const
+    {
+        session.last_seen = now_;
+    }
+
+private:
+    ACE_UINT64 now_;
+};
+
+SessionTable::SessionTable()
+{
+    timers_ = NULL;
+    rate_ = 0;
+    burst_ = 0;
+    idle_msec_ = 0;
+    created_ = 0;
+    expired_ = 0;
+    evicted_ = 0;
+    peak_ = 0;
+    throttled_ = 0;
+}
+
+SessionTable::~SessionTable()
+{
+    close();
+}
+
+void SessionTable::open(TimerWheel& timers, int rate, int idle_seconds)
+{
+    timers_ = &timers;
+    rate_ = rate > 0 ? (ACE_UINT64)rate * SESSION_TOKEN / 1000 : 0;
+    burst_ = rate > 0 ? (ACE_UINT64)rate * SESSION_TOKEN : 0;
+    idle_msec_ = (ACE_UINT64)idle_seconds * 1000;
+    timers.schedule(&sweep_timer_, this, NULL, SESSION_SWEEP_MSEC, SESSION_SWEEP_MSEC);
+}
+
+void SessionTable::close(void)
+{
+    if (timers_ != NULL)
+        timers_->cancel(&sweep_timer_);
+    timers_ = NULL;
+    sessions_.clear();
+}
+
+int SessionTable::admit(const sockaddr_in& peer, size_t bytes, ACE_UINT64 now)
+{
+    const ACE_UINT64 key = ((ACE_UINT64)ntohl(peer.sin_addr.s_addr) << 16) | ntohs(peer.sin_port);
+
+    typedef SessionSet::index<by_peer>::type PeerIndex;
+    PeerIndex& index = sessions_.get<by_peer>();
+    PeerIndex::iterator it = index.find(key);
+    if (it == index.end())
+    {
+        if (sessions_.size() >= (size_t)SESSION_MAX)
+        {
+            sessions_.get<by_last_seen>().erase(sessions_.get<by_last_seen>().begin());
+            ++evicted_;
+        }
+
+        //a new peer starts with a full bucket
+        Session session = {key, now, burst_, 0, 0, 0};
+        it = index.insert(session).first;
+        ++created_;
+        if (sessions_.size() > peak_)
+            peak_ = sessions_.size();
+    }
+    else if (now > it->last_seen)
+    {
+        //refill for the ticks since the last datagram, up to the burst
+        ACE_UINT64 tokens = it->tokens + (now - it->last_seen) * rate_;
+        it->tokens = tokens < burst_ ? tokens : burst_;
+        index.modify(it, touch_session(now));
+    }
+
+    ++it->packets;
+    it->bytes += bytes;
+    if (0 == burst_)
+        return 0;
+
+    if (it->tokens < SESSION_TOKEN)
+    {
+        ++it->throttled;
+        ++throttled_;
+        return -1;
+    }
+    it->tokens -= SESSION_TOKEN;
+    return 0;
+}
+
+int SessionTable::handle_timeout(const ACE_Time_Value&, const void*)
+{
+    typedef SessionSet::index<by_last_seen>::type SeenIndex;
+    SeenIndex& index = sessions_.get<by_last_seen>();
+    const ACE_UINT64 now = timers_->now();
+    while (!index.empty() && index.begin()->last_seen + idle_msec_ <= now)
+    {
+        index.erase(index.begin());
+        ++expired_;
+    }
+    return 0;
+}
+
+void SessionTable::report(int shard) const
+{
+    ACE_DEBUG ((LM_INFO, ACE_TEXT ("(%t) thread %d sessions: %d open, %d created, %d expired, %d evicted, ")
+        ACE_TEXT ("peak %d, %Q datagrams throttled\n"), 
+        shard, (int)sessions_.size(), created_, expired_, evicted_, (int)peak_, throttled_));
+}
+
+//////////////////////////////////////////////////////////////////////////
+
+void ShutdownHandler::open(TimerWheel& timers)
+{
+    timers_ = &timers;
+    timers.schedule(&timer_, this, NULL, SIGNAL_POLL_MSEC, SIGNAL_POLL_MSEC);
+}
+
+void ShutdownHandler::close(void)
+{
+    if (timers_ != NULL)
+        timers_->cancel(&timer_);
+    timers_ = NULL;
+}
+
+//signal context: nothing but the flag
+int ShutdownHandler::handle_signal(int, siginfo_t*, ucontext_t*)
+{
+    signaled_ = 1;
+    return 0;
+}
+
+//the event loop of thread 0: -1 ends the timer after the shutdown
+int ShutdownHandler::handle_timeout(const ACE_Time_Value&, const void*)
+{
+    if (!signaled_)
+        return 0;
+
+    ACE_DEBUG ((LM_INFO, ACE_TEXT ("(%t) ShutdownHandler: signal received, shut down\n")));
+    server_.shutdown();
+    return -1;
+}
+
+//////////////////////////////////////////////////////////////////////////
+
+CommandQueue::CommandQueue(ACE_Reactor* reactor): reactor_(reactor), lanes_used_(0), pending_(0), full_(0)
+{
+    applied_ = 0;
+    failed_ = 0;
+    latency_sum_ = 0;
+    latency_max_ = 0;
+}
+
+//one lane per producer thread; -1 if all lanes are taken
+int CommandQueue::open_lane(void)
+{
+    int lane = lanes_used_.fetch_add(1, boost::memory_order_acq_rel);
+    return lane < MAX_LANES ? lane : -1;
+}
+
+//producer: never blocks, -1 if the lane is full
+int CommandQueue::post(int lane, int op, ACE_HANDLE handle, ACE_Event_Handler* handler, ACE_Reactor_Mask mask)
+{
+    ReactorCommand* command = lanes_[lane].reserve();
+    if (NULL == command)
+    {
+        full_.fetch_add(1, boost::memory_order_relaxed);
+        return -1;
+    }
+
+    command->op = op;
+    command->handle = handle;
+    command->handler = handler;
+    command->mask = mask;
+    command->posted = ACE_OS::gettimeofday();
+    lanes_[lane].commit();
+
+    //the first command since the last drain wakes the reactor up; seq_cst
+    //against the exchange in drain: either drain sees the commit above, or
+    //this post sees the 0 it left and notifies
+    if (pending_.fetch_add(1, boost::memory_order_seq_cst) == 0)
+        reactor_->notify();
+    return 0;
+}
+
+//reactor thread: apply everything posted so far
+int CommandQueue::drain(void)
+{
+    //nothing posted; a post racing with this check notifies the reactor
+    if (pending_.load(boost::memory_order_acquire) == 0)
+        return 0;
+
+    //reset before reading the lanes, so a post racing with us wakes us again
+    pending_.exchange(0, boost::memory_order_seq_cst);
+
+    int count = 0;
+    int lanes = lanes_used_.load(boost::memory_order_acquire);
+    for (int i = 0; i < MAX_LANES && i < lanes; i++)
+    {
+        ReactorCommand* command;
+        while ((command = lanes_[i].front()) != NULL)
+        {
+            if (apply(*command) == -1)
+                ++failed_;
+
+            ACE_UINT64 usec = usec_since(command->posted);
+            latency_sum_ += usec;
+            if (usec > latency_max_)
+                latency_max_ = usec;
+            ++applied_;
+
+            lanes_[i].pop();
+            ++count;
+        }
+    }
+
+    return count;
+}
+
+int CommandQueue::apply(const ReactorCommand& command)
+{
+    switch (command.op)
+    {
+    case CMD_REGISTER:
+        return reactor_->register_handler(command.handle, command.handler, command.mask);
+    case CMD_REMOVE:
+        return reactor_->remove_handler(command.handle, command.mask);
+    case CMD_NOTIFY:
+        return command.handler->handle_exception(ACE_INVALID_HANDLE) < 0 ? -1 : 0;
+    default:
+        return -1;
+    }
+}
+
+void CommandQueue::report(void) const
+{
+    int full = full_.load(boost::memory_order_relaxed);
+    if (0 == applied_ && 0 == full)
+        return;
+
+    ACE_DEBUG ((LM_INFO, ACE_TEXT ("(%t) CommandQueue: %d commands applied, %d failed, %d refused (lane full)\n"), 
+        applied_, failed_, full));
+    if (applied_ > 0)
+        ACE_DEBUG ((LM_INFO, ACE_TEXT ("(%t) CommandQueue: post to apply latency avg %d usec, max %d usec\n"), 
+            (int)(latency_sum_ / applied_), (int)latency_max_));
+}
+
+//////////////////////////////////////////////////////////////////////////
+
+LogChannel::LogChannel()
+{
+    for (int i = 0; i < LOG_CATEGORIES; i++)
+    {
+        seen_[i] = 0;
+        logged_[i] = 0;
+        window_[i] = 0;
+    }
+    dropped_ = 0;
+    limited_ = 0;
+}
+
+int LogChannel::allowed(int category)
+{
+    const LogLimit& limit = LOG_LIMITS[category];
+    if (limit.sample > 1 && (seen_[category]++ % limit.sample) != 0)
+        return 0;
+
+    if (limit.rate > 0)
+    {
+        long now = ACE_OS::gettimeofday().sec();
+        if (now != window_[category])
+        {
+            window_[category] = now;
+            logged_[category] = 0;
+        }
+        if (logged_[category] >= limit.rate)
+            return 0;
+        ++logged_[category];
+    }
+
+    return 1;
+}
+
+int LogChannel::log(int category, ACE_Log_Priority priority, const char* format, ...)
+{
+    if (!allowed(category))
+    {
+        ++limited_;
+        return -1;
+    }
 
-#include <stdio.h>
-#include <string.h>
+    LogRecord* record = ring_.reserve();
+    if (NULL == record)
+    {
+        ++dropped_;
+        return -1;
+    }
 
-static const char*    IP_ADDR  = "127.0.0.1";
-static const u_short UDP_PORT = 6540;
-static const int         REGISTER_COUNT = 2;
-static const int         RECV_COUNT = 2;
-static const int         MY_EXIT_HANDLER = 1023;
+    record->priority = priority;
+    va_list args;
+    va_start(args, format);
+    ACE_OS::vsnprintf(record->text, sizeof record->text, format, args);
+    va_end(args);
+
+    ring_.commit();
+    return 0;
+}
 
 //////////////////////////////////////////////////////////////////////////
 
-class MyTask: public ACE_Task<ACE_NULL_SYNCH>
+LogTask::LogTask()
 {
-public:
-    static const int MAX_USER_THREAD = 1;
-    MyTask();
-    ~MyTask();
+    for (int i = 0; i < MAX_CHANNELS; i++)
+        channels_[i] = NULL;
+    stop_flag_ = 0;
+    dropped_ = 0;
+    limited_ = 0;
+}
 
-    int open(void *);
-    virtual int svc();
+int LogTask::open(void *)
+{
+    stop_flag_ = 0;
+    dropped_ = 0;
+    limited_ = 0;
+    if(this->activate(THR_NEW_LWP, 1) == -1)
+    {
+        ACE_DEBUG((LM_ERROR, "activate LogTask failed"));
+        return -1;
+    }
 
-private:
-    static int exit_flag;
-    static ACE_Select_Reactor *selector;
-};
+    return 0;
+}
 
-int MyTask::exit_flag = 0;
-ACE_Select_Reactor* MyTask::selector = 0;
+int LogTask::svc()
+{
+    ACE_DEBUG ((LM_INFO, ACE_TEXT ("(%t) enter LogTask::svc()\n\n")));
 
-typedef ACE_Singleton <MyTask, ACE_SYNCH_MUTEX> mytask;
+    const ACE_Time_Value idle(0, 1000);
+    for (;;)
+    {
+        //read the flag before draining, so nothing logged before stop() is lost
+        int stopping = stop_flag_.value();
 
-//////////////////////////////////////////////////////////////////////////
+        int count = 0;
+        {
+            ACE_GUARD_RETURN(ACE_Thread_Mutex, guard, lock_, -1);
+            for (int i = 0; i < MAX_CHANNELS; i++)
+            {
+                if (channels_[i] != NULL)
+                    count += drain(channels_[i]);
+            }
+        }
 
-class Handler: public ACE_Event_Handler
-{
-public:
-    Handler(u_short udp_port);
-    ~Handler(void);
+        if (stopping)
+            break;
+        if (0 == count)
+            ACE_OS::sleep(idle);
+    }
 
-    virtual int handle_input(ACE_HANDLE);
-    virtual int handle_exception (ACE_HANDLE);
+    if (dropped_ || limited_)
+        ACE_DEBUG ((LM_INFO, ACE_TEXT ("(%t) LogTask: %d records dropped (channel full), %d limited\n"), 
+            dropped_, limited_));
+    ACE_DEBUG ((LM_INFO, ACE_TEXT ("(%t) exit LogTask::svc()\n\n")));
+    return 0;
+}
 
-    virtual ACE_HANDLE get_handle(void) const
+void LogTask::stop(void)
+{
+    stop_flag_ = 1;
+}
+
+int LogTask::attach(LogChannel* channel)
+{
+    ACE_GUARD_RETURN(ACE_Thread_Mutex, guard, lock_, -1);
+    for (int i = 0; i < MAX_CHANNELS; i++)
     {
-        return this->dgramt_.get_handle();
+        if (NULL == channels_[i])
+        {
+            channels_[i] = channel;
+            return 0;
+        }
     }
 
-    int get_count(void) const
+    return -1;  //not attached, records stay in the ring and are dropped when it is full
+}
+
+//flush what is left in the channel, it is about to be destroyed
+void LogTask::detach(LogChannel* channel)
+{
+    ACE_GUARD(ACE_Thread_Mutex, guard, lock_);
+    for (int i = 0; i < MAX_CHANNELS; i++)
     {
-        return recv_count;
+        if (channels_[i] == channel)
+        {
+            drain(channel);
+            dropped_ += channel->get_dropped();
+            limited_ += channel->get_limited();
+            channels_[i] = NULL;
+        }
     }
+}
 
-    int get_flag(void) const
+int LogTask::drain(LogChannel* channel)
+{
+    int count = 0;
+    LogRecord* record;
+    while ((record = channel->ring().front()) != NULL)
     {
-        return exit_flag;
+        ACE_DEBUG ((record->priority, "%s", record->text));
+        channel->ring().pop();
+        ++count;
     }
 
-private:
-    ACE_SOCK_Dgram dgramt_;
-    ACE_INET_Addr  addr_;
-
-    static int recv_count;
-    static int exit_flag;
-};
-
-int Handler::recv_count = 0;
-int Handler::exit_flag = 0;
+    return count;
+}
 
 //////////////////////////////////////////////////////////////////////////
 
-class MyTask2:public ACE_Task<ACE_NULL_SYNCH>
+Handler::Handler(u_short udp_port, HandlerStats& stats, int verbose, int batch, LogChannel* log): 
+    addr_(udp_port), ring_(RING_SLOTS), stats_(stats)
 {
-public:
-    static const int MAX_USER_THREAD = 1;
+    ACE_DEBUG ((LM_INFO, ACE_TEXT ("(%t) in Handler()\n\n")));
+    recv_count_ = 0;
+    exit_flag_ = 0;
+    verbose_ = verbose && log != NULL;
+    batch_ = batch;
+    log_ = log;
+    pipeline_ = NULL;
+    sessions_ = NULL;
 
-    int open(void *);
-    virtual int svc();
+#if defined (SERVER99_HAS_MMSG)
+    msgs_ = NULL;
+    iovs_ = NULL;
+    peers_ = NULL;
+    uring_open_ = 0;
+    if (batch_ > 1)
+    {
+        msgs_ = new struct mmsghdr[batch_];
+        iovs_ = new struct iovec[batch_];
+        peers_ = new sockaddr_in[batch_];
 
-private:
-    Handler* handler_;
-};
+        //the headers are set up once, handle_input only resets the lengths
+        ACE_OS::memset(msgs_, 0, batch_ * sizeof msgs_[0]);
+        for (int i = 0; i < batch_; i++)
+        {
+            msgs_[i].msg_hdr.msg_name = &peers_[i];
+            msgs_[i].msg_hdr.msg_iov = &iovs_[i];
+            msgs_[i].msg_hdr.msg_iovlen = 1;
+        }
+    }
+#else
+    batch_ = 1;
+    uring_open_ = 0;
+#endif
+}
 
-typedef ACE_Singleton <MyTask2, ACE_SYNCH_MUTEX> mytask2;
+//open the socket by hand instead of ACE_SOCK_Dgram(addr_), because SO_REUSEPORT
+//has to be set before bind, so that every reactor thread can bind the same port
+int Handler::open(void)
+{
+    ACE_HANDLE h = ACE_OS::socket(AF_INET, SOCK_DGRAM, 0);
+    if (ACE_INVALID_HANDLE == h)
+        ACE_ERROR_RETURN((LM_ERROR, "%p\n", "Handler::open: socket failed"), -1);
 
-//////////////////////////////////////////////////////////////////////////
+    int one = 1;
+    if (ACE_OS::setsockopt(h, SOL_SOCKET, SO_REUSEADDR, (const char*)&one, sizeof one) == -1)
+        ACE_ERROR((LM_ERROR, "%p\n", "Handler::open: SO_REUSEADDR failed"));
+#if defined (SO_REUSEPORT)
+    if (ACE_OS::setsockopt(h, SOL_SOCKET, SO_REUSEPORT, (const char*)&one, sizeof one) == -1)
+        ACE_ERROR((LM_ERROR, "%p\n", "Handler::open: SO_REUSEPORT failed"));
+#endif
+
+    if (ACE_OS::bind(h, (sockaddr*)addr_.get_addr(), addr_.get_size()) == -1)
+    {
+        ACE_OS::closesocket(h);
+        ACE_ERROR_RETURN((LM_ERROR, "%p\n", "Handler::open: bind failed"), -1);
+    }
+
+    this->dgramt_.set_handle(h);
+    return 0;
+}
 
-MyTask:: MyTask()
+Handler::~Handler(void)
 {
-    ACE_DEBUG ((LM_INFO, "(%t) in MyTask:: MyTask()\n"));
-    exit_flag = 0;
-    selector = NULL;
+    ACE_DEBUG ((LM_INFO, ACE_TEXT ("(%t) in ~Handler()\n\n")));
+    close_uring();
+#if defined (SERVER99_HAS_MMSG)
+    delete [] msgs_;
+    delete [] iovs_;
+    delete [] peers_;
+#endif
+    if (this->dgramt_.close() == -1)
+    {
+        ACE_ERROR((LM_ERROR, "%p\n", "ACE_SOCK_Dgram close failed"));
+    }
 }
 
-MyTask::~MyTask()
+int Handler::handle_input(ACE_HANDLE)
 {
-    ACE_DEBUG ((LM_INFO, "(%t) in MyTask::~MyTask() 1\n"));
+    ACE_hrtime_t start = ACE_OS::gethrtime();
+    ACE_UINT64 packets = stats_.packets;
+    int result;
+
+#if defined (SERVER99_HAS_MMSG)
+    if (batch_ > 1)
+        result = handle_input_batch();
+    else
+#endif
+        result = handle_input_single();
 
-    delete selector;
-    selector = NULL;
-    ACE_DEBUG ((LM_INFO, "(%t) in MyTask::~MyTask() 2\n"));
+    //empty polls of the busy-poll mode are not counted
+    if (stats_.packets != packets)
+    {
+        ACE_UINT64 ticks = ACE_OS::gethrtime() - start;
+        stats_.input_ticks += ticks;
+        if (ticks > stats_.input_max_ticks)
+            stats_.input_max_ticks = ticks;
+    }
+    return result;
 }
 
-int MyTask::open(void *)
+int Handler::handle_input_single(void)
 {
-    ACE_DEBUG ((LM_INFO, "(%t) MyTask start\n"));    
+    char* buf = ring_.next();  //no zero fill, the payload is used by length
+    ACE_INET_Addr remote_addr;
 
-    exit_flag = 0;
-    if(this->activate(THR_NEW_LWP, MAX_USER_THREAD) == -1)
+    ssize_t result = this->dgramt_.recv(buf, PACKET_SIZE, remote_addr);
+    if (result == -1)
     {
-        ACE_DEBUG((LM_ERROR, "activate MyTask failed"));
-        return -1;
+        if (EWOULDBLOCK == errno || EAGAIN == errno)
+            return 0;  //non-blocking socket, see drain()
+        ++stats_.recv_errors;
+        ACE_ERROR_RETURN((LM_ERROR, "%p\n", "handle_input: recv failed"), -1);
+    }
+
+    //receive successfully
+    ++recv_count_;
+    ++stats_.packets;
+    stats_.bytes += result;
+    stats_.record_batch(1);
+    if (verbose_)
+    {
+        //numeric address only, get_host_name() may block on reverse DNS
+        ACE_UINT32 ip = remote_addr.get_ip_address();
+        log_->log(LOG_PACKET, LM_DEBUG, "recv: No. = %d, IP = %u.%u.%u.%u, port = %d, bytes = %d\n",
+            recv_count_, (ip >> 24) & 0xff, (ip >> 16) & 0xff, (ip >> 8) & 0xff, ip & 0xff,
+            remote_addr.get_port_number(), (int)result);
+        log_->log(LOG_DATA, LM_INFO, "      data = %.*s\n", (int)result, buf);
+    }
+
+    if (sessions_ != NULL && 
+        sessions_->admit(*(const sockaddr_in*)remote_addr.get_addr(), result, sessions_->clock()) == -1)
+    {
+        ++stats_.throttled;
+        return 0;
     }
 
+    //echo straight from the receive slot, or let the pipeline answer
+    if (pipeline_ != NULL)
+        pipeline_->submit(buf, (int)result, *(const sockaddr_in*)remote_addr.get_addr());
+    else if (this->dgramt_.send(buf, result, remote_addr) == -1)
+        ++stats_.send_errors;
+
     return 0;
 }
 
-int MyTask::svc()
+#if defined (SERVER99_HAS_MMSG)
+//drain up to batch_ datagrams with one recvmmsg and echo them with one sendmmsg
+int Handler::handle_input_batch(void)
 {
-    ACE_DEBUG ((LM_INFO, ACE_TEXT ("(%t) enter MyTask::svc()\n\n")));
-
-    //initialization
-    selector = new ACE_Select_Reactor;
-    ACE_Reactor* reactor = new ACE_Reactor(selector);
-    ACE_Reactor::instance(reactor);  //then, ACE_Reactor::instance() is reactor
-    this->reactor(reactor);  //this reactor_ of ACE_Event_Handler can not be set
+    for (int i = 0; i < batch_; i++)
+    {
+        iovs_[i].iov_base = ring_.next();
+        iovs_[i].iov_len = PACKET_SIZE;
+        msgs_[i].msg_hdr.msg_namelen = sizeof peers_[i];
+    }
 
-    //register socket handler
-    Handler handler(UDP_PORT);
-    if (reactor->register_handler(&handler, ACE_Event_Handler::READ_MASK) == -1)
+    //the reactor saw the handle readable, so at least one datagram is waiting
+    int n = ::recvmmsg(this->get_handle(), msgs_, batch_, MSG_DONTWAIT, NULL);
+    if (n == -1)
     {
-        ACE_ERROR((LM_ERROR, "%p\n", "cant't register with Reactor in MyTask::svc()\n"));
-        return -1;
+        if (ENOSYS == errno)
+        {
+            ACE_ERROR((LM_WARNING, "(%t) handle_input: recvmmsg not supported, use recv\n"));
+            batch_ = 1;
+            return handle_input_single();
+        }
+        if (EAGAIN == errno || EWOULDBLOCK == errno)
+            return 0;
+        ++stats_.recv_errors;
+        ACE_ERROR_RETURN((LM_ERROR, "%p\n", "handle_input: recvmmsg failed"), -1);
     }
 
-    //spawn mytask2
-    mytask2::instance()->open(&handler);
+    recv_count_ += n;
+    stats_.packets += n;
+    stats_.record_batch(n);
 
-    //handle_events in forever-loop until receive two data packets from socket, then, it will notify the MY_EXIT_HANDLER
-    while (exit_flag == 0)
+    ACE_UINT64 bytes = 0;
+    for (int i = 0; i < n; i++)
     {
-        int result = reactor->handle_events();  //timeout will not occur at all
-        if (result)
+        iovs_[i].iov_len = msgs_[i].msg_len;
+        bytes += msgs_[i].msg_len;
+        if (verbose_)
         {
-            ACE_DEBUG ((LM_INFO, ACE_TEXT ("(%t) handle_events() succeed, result = %d\n\n"), result));
-            if (RECV_COUNT == handler.get_count())
-            {
-                ACE_DEBUG ((LM_INFO, ACE_TEXT ("(%t) MyTask::svc() notify the exit handler\n")));
-                ACE_Reactor::instance()->notify(&handler, ACE_Event_Handler::EXCEPT_MASK);
-            }
-
-            if (handler.get_flag())
-                exit_flag = 1;
+            ACE_UINT32 ip = ntohl(peers_[i].sin_addr.s_addr);
+            log_->log(LOG_PACKET, LM_DEBUG, "recv: No. = %d, IP = %u.%u.%u.%u, port = %d, bytes = %d\n",
+                recv_count_ - n + i + 1, (ip >> 24) & 0xff, (ip >> 16) & 0xff, (ip >> 8) & 0xff, ip & 0xff,
+                ntohs(peers_[i].sin_port), (int)msgs_[i].msg_len);
+            log_->log(LOG_DATA, LM_INFO, "      data = %.*s\n", (int)msgs_[i].msg_len, (char*)iovs_[i].iov_base);
         }
-        else
+    }
+    stats_.bytes += bytes;
+
+    //drop the datagrams of throttled peers, the others move up; the headers
+    //keep pointing to their own iovec and address, so those are copied
+    if (sessions_ != NULL)
+    {
+        const ACE_UINT64 now = sessions_->clock();
+        int kept = 0;
+        for (int i = 0; i < n; i++)
         {
-            ACE_ERROR((LM_ERROR, "%p\n", "handle_events() failed\n"));
-            return -1;
+            if (sessions_->admit(peers_[i], msgs_[i].msg_len, now) == -1)
+            {
+                ++stats_.throttled;
+                continue;
+            }
+            if (kept != i)
+            {
+                iovs_[kept] = iovs_[i];
+                peers_[kept] = peers_[i];
+                msgs_[kept].msg_len = msgs_[i].msg_len;
+                msgs_[kept].msg_hdr.msg_namelen = msgs_[i].msg_hdr.msg_namelen;
+            }
+            ++kept;
         }
+        n = kept;
     }
 
-    if (reactor->remove_handler(&handler, ACE_Event_Handler::READ_MASK | 
-        ACE_Event_Handler::DONT_CALL) == -1)
+    if (pipeline_ != NULL)
     {
-        ACE_ERROR((LM_ERROR, "%p\n", "cant't remove handler from Reactor\n"));
-        return -1;
+        for (int i = 0; i < n; i++)
+            pipeline_->submit((char*)iovs_[i].iov_base, (int)msgs_[i].msg_len, peers_[i]);
+        return 0;
+    }
+
+    //echo straight from the receive slots, sendmmsg may send less than asked
+    int sent = 0;
+    while (sent < n)
+    {
+        int result = ::sendmmsg(this->get_handle(), msgs_ + sent, n - sent, 0);
+        if (result == -1)
+        {
+            if (ENOSYS == errno)
+            {
+                for (int i = sent; i < n; i++)
+                {
+                    if (ACE_OS::sendto(this->get_handle(), (char*)iovs_[i].iov_base, msgs_[i].msg_len, 0, 
+                        (const sockaddr*)&peers_[i], msgs_[i].msg_hdr.msg_namelen) == -1)
+                        ++stats_.send_errors;
+                }
+                break;
+            }
+            stats_.send_errors += n - sent;
+            ACE_ERROR((LM_ERROR, "%p\n", "handle_input: sendmmsg failed"));
+            break;
+        }
+        sent += result;
     }
 
-    delete reactor;
-    reactor = NULL;
-    ACE_DEBUG ((LM_INFO, ACE_TEXT ("(%t) exit MyTask::svc()\n\n")));
     return 0;
 }
+#endif
 
-//////////////////////////////////////////////////////////////////////////
+//one receive on the non-blocking socket, returns the datagrams handled (0: none waiting)
+int Handler::poll(void)
+{
+    ACE_UINT64 before = stats_.packets;
+    if (this->handle_input(this->get_handle()) == -1)
+        return -1;
+    return (int)(stats_.packets - before);
+}
 
-int MyTask2::open(void *p)
+//echo whatever is queued on the socket without waiting for more, returns the count
+int Handler::drain(void)
 {
-    ACE_DEBUG ((LM_INFO, "(%t) MyTask2 start\n"));
+    enable_nonblock();
 
-    handler_ = (Handler*)p;
-    if(this->activate(THR_NEW_LWP, MAX_USER_THREAD) == -1)
+    int count = 0;
+    for (int i = 0; i < DRAIN_LIMIT; i++)
     {
-        ACE_DEBUG((LM_ERROR, "activate MyTask2 failed"));
-        return -1;
+        int n = poll();
+        if (n <= 0)
+            break;
+        count += n;
     }
 
+    return count;
+}
+
+#if defined (SERVER99_HAS_URING)
+//the ring: the socket as fixed file 0, and URING_BUFFERS slots as buffer group URING_BGID
+int Handler::open_uring(void)
+{
+    int result = io_uring_queue_init(URING_ENTRIES, &uring_, 0);
+    if (result < 0)
+    {
+        errno = -result;
+        ACE_ERROR_RETURN((LM_ERROR, "%p\n", "open_uring: io_uring_queue_init failed, use the reactor"), -1);
+    }
+
+    int fd = this->get_handle();
+    result = io_uring_register_files(&uring_, &fd, 1);
+    buf_ring_ = NULL;
+    if (0 == result)
+        buf_ring_ = io_uring_setup_buf_ring(&uring_, URING_BUFFERS, URING_BGID, 0, &result);
+    if (NULL == buf_ring_)
+    {
+        io_uring_queue_exit(&uring_);
+        errno = -result;
+        ACE_ERROR_RETURN((LM_ERROR, "%p\n", "open_uring: buffer ring failed, use the reactor"), -1);
+    }
+
+    uring_buffers_ = new PacketRing(URING_BUFFERS);
+    send_msgs_ = new struct msghdr[URING_BUFFERS];
+    send_iovs_ = new struct iovec[URING_BUFFERS];
+    ACE_OS::memset(send_msgs_, 0, URING_BUFFERS * sizeof send_msgs_[0]);
+    for (int i = 0; i < URING_BUFFERS; i++)
+    {
+        send_msgs_[i].msg_iov = &send_iovs_[i];
+        send_msgs_[i].msg_iovlen = 1;
+        recycle_uring(i);
+    }
+
+    //the kernel writes io_uring_recvmsg_out, the peer address and the payload into the buffer
+    ACE_OS::memset(&recv_msg_, 0, sizeof recv_msg_);
+    recv_msg_.msg_namelen = sizeof(sockaddr_in);
+
+    uring_armed_ = 0;
+    uring_sending_ = 0;
+    uring_open_ = 1;
     return 0;
 }
 
-int MyTask2::svc()
+void Handler::close_uring(void)
 {
-    ACE_DEBUG ((LM_INFO, ACE_TEXT ("(%t) enter MyTask2::svc()\n\n")));
+    if (!uring_open_)
+        return;
 
-    for (int i = 0; i < REGISTER_COUNT; i++)
+    //the same as the drain of the reactor path: the echoes the last pass
+    //queued go out, the multishot recv is cancelled, and the completions are
+    //reaped until it has ended and no send is in flight; the kernel may use
+    //the buffers until then. What is still on the socket is drained after
+    if (uring_armed_)
     {
-        ACE_DEBUG ((LM_INFO, ACE_TEXT ("(%t) MyTask2::svc() register exit handler\n")));
-        if (ACE_Reactor::instance()->register_handler(MY_EXIT_HANDLER, handler_, ACE_Event_Handler::EXCEPT_MASK) == -1)
+        struct io_uring_sqe* sqe = get_sqe();
+        if (sqe != NULL)
         {
-            ACE_ERROR((LM_ERROR, "%p\n", "(%t) MyTask2::svc() register exit handler failed\n"));
-            return -1;
+            //the recv is tagged URING_BUFFERS, its cancel the tag after
+            io_uring_prep_cancel64(sqe, URING_BUFFERS, 0);
+            io_uring_sqe_set_data64(sqe, URING_BUFFERS + 1);
         }
-        ACE_OS::sleep(1);
+    }
+    ACE_Time_Value wait(0, URING_WAIT_MSEC * 1000);
+    for (int i = 0; i < URING_DRAIN_WAITS && (uring_armed_ || uring_sending_ > 0); i++)
+    {
+        if (reap_uring(wait) == -1)
+            break;
+    }
+    if (uring_armed_ || uring_sending_ > 0)
+        ACE_ERROR((LM_WARNING, "(%t) close_uring: %d echoes not sent\n", uring_sending_));
+
+    uring_open_ = 0;
+    io_uring_free_buf_ring(&uring_, buf_ring_, URING_BUFFERS, URING_BGID);
+    io_uring_queue_exit(&uring_);
+    delete uring_buffers_;
+    delete [] send_msgs_;
+    delete [] send_iovs_;
+}
+
+//keep the multishot recv armed and reap. Returns the number of datagrams
+//echoed, 0 on timeout
+int Handler::run_uring(const ACE_Time_Value& wait)
+{
+    //the recv ends with ENOBUFS when every buffer is held by a send: it is
+    //armed again only once a send has given one back, else it would end at
+    //once again and the loop would spin. Until then the wait is for the sends
+    if (!uring_armed_ && uring_sending_ < URING_BUFFERS && arm_uring() == -1)
+        return -1;
+
+    int echoed = reap_uring(wait);
+    if (echoed == -1)
+        return -1;
+
+    if (!uring_armed_ && uring_sending_ < URING_BUFFERS && arm_uring() == -1)
+        return -1;
+    return echoed;
+}
+
+//one submit-and-wait: the echoes of the last pass go out, then the completions
+//are reaped. Returns the number of datagrams echoed, 0 on timeout
+int Handler::reap_uring(const ACE_Time_Value& wait)
+{
+    struct __kernel_timespec ts;
+    ts.tv_sec = wait.sec();
+    ts.tv_nsec = wait.usec() * 1000;
+    struct io_uring_cqe* cqe = NULL;
+    int result = io_uring_submit_and_wait_timeout(&uring_, &cqe, 1, &ts, NULL);
+    if (result < 0 && result != -ETIME && result != -EINTR)
+    {
+        errno = -result;
+        ACE_ERROR_RETURN((LM_ERROR, "%p\n", "reap_uring: io_uring_submit_and_wait_timeout failed"), -1);
+    }
 
-        ACE_DEBUG ((LM_INFO, ACE_TEXT ("(%t) MyTask2::svc() remove exit handler\n\n")));
-        if (ACE_Reactor::instance()->remove_handler(MY_EXIT_HANDLER, ACE_Event_Handler::EXCEPT_MASK) == -1)
+    ACE_hrtime_t start = ACE_OS::gethrtime();
+    unsigned head;
+    unsigned seen = 0;
+    int echoed = 0;
+    io_uring_for_each_cqe(&uring_, head, cqe)
+    {
+        ++seen;
+        if (URING_BUFFERS == cqe->user_data)
         {
-            ACE_ERROR((LM_ERROR, "%p\n", "(%t) MyTask2::svc() remove exit handler failed\n"));
-            return -1;
+            //the multishot recv ends on errors and when the buffers run out
+            if (!(cqe->flags & IORING_CQE_F_MORE))
+                uring_armed_ = 0;
+            if (cqe->res < 0)
+            {
+                if (cqe->res != -ENOBUFS && cqe->res != -ECANCELED)
+                    ++stats_.recv_errors;
+                continue;
+            }
+            if (echo_uring(cqe->flags >> IORING_CQE_BUFFER_SHIFT, cqe->res) == 0)
+                ++echoed;
+        }
+        else if (cqe->user_data < (__u64)URING_BUFFERS)
+        {
+            //a send is done, its buffer can take the next datagram
+            if (cqe->res < 0)
+                ++stats_.send_errors;
+            --uring_sending_;
+            recycle_uring((int)cqe->user_data);
         }
-        ACE_OS::sleep(1);
+        //else the cancel of the recv at close_uring, its recv completion says the rest
     }
+    io_uring_cq_advance(&uring_, seen);
 
-    ACE_DEBUG ((LM_INFO, ACE_TEXT ("(%t) exit MyTask2::svc()\n\n")));
-    return 0;
+    if (echoed > 0)
+    {
+        stats_.record_batch(echoed);
+        ACE_UINT64 ticks = ACE_OS::gethrtime() - start;
+        stats_.input_ticks += ticks;
+        if (ticks > stats_.input_max_ticks)
+            stats_.input_max_ticks = ticks;
+    }
+    return echoed;
 }
 
-//////////////////////////////////////////////////////////////////////////
+//the next free sqe, submits what is queued if the ring is full
+struct io_uring_sqe* Handler::get_sqe(void)
+{
+    struct io_uring_sqe* sqe = io_uring_get_sqe(&uring_);
+    if (NULL == sqe)
+    {
+        io_uring_submit(&uring_);
+        sqe = io_uring_get_sqe(&uring_);
+    }
+    return sqe;
+}
 
-Handler::Handler(u_short udp_port): addr_(udp_port)
+//the multishot recvmsg, tagged with URING_BUFFERS (no buffer id has it)
+int Handler::arm_uring(void)
 {
-    ACE_DEBUG ((LM_INFO, ACE_TEXT ("(%t) in Handler()\n\n")));
-    recv_count = 0;
-    exit_flag = 0;
-    dgramt_ = ACE_SOCK_Dgram(addr_);
+    struct io_uring_sqe* sqe = get_sqe();
+    if (NULL == sqe)
+        ACE_ERROR_RETURN((LM_ERROR, "(%t) arm_uring: submission queue full\n"), -1);
+
+    io_uring_prep_recvmsg_multishot(sqe, 0, &recv_msg_, 0);
+    sqe->flags |= IOSQE_FIXED_FILE | IOSQE_BUFFER_SELECT;
+    sqe->buf_group = URING_BGID;
+    io_uring_sqe_set_data64(sqe, URING_BUFFERS);
+    uring_armed_ = 1;
+    return 0;
 }
 
-Handler::~Handler(void)
+//queue the echo of the datagram in buffer bid, sent from where it was received
+int Handler::echo_uring(int bid, int length)
 {
-    ACE_DEBUG ((LM_INFO, ACE_TEXT ("(%t) in ~Handler()\n\n")));
-    if (this->dgramt_.close() == -1)
+    char* buf = uring_buffers_->slot(bid);
+    struct io_uring_recvmsg_out* out = io_uring_recvmsg_validate(buf, length, &recv_msg_);
+    if (NULL == out || (out->flags & MSG_TRUNC))
     {
-        ACE_ERROR((LM_ERROR, "%p\n", "ACE_SOCK_Dgram close failed"));
+        ++stats_.recv_errors;
+        recycle_uring(bid);
+        return -1;
     }
-}
 
-int Handler::handle_input(ACE_HANDLE h)
-{
-    char buf[BUFSIZ] = {0};
-    ACE_INET_Addr remote_addr;
+    sockaddr_in* peer = (sockaddr_in*)io_uring_recvmsg_name(out);
+    char* payload = (char*)io_uring_recvmsg_payload(out, &recv_msg_);
+    unsigned int size = io_uring_recvmsg_payload_length(out, length, &recv_msg_);
 
-    ssize_t result = this->dgramt_.recv(buf, sizeof buf, remote_addr);
-    if (result == -1)
-        ACE_ERROR_RETURN((LM_ERROR, "%p\n", "handle_input: recv failed"), -1);
+    ++recv_count_;
+    ++stats_.packets;
+    stats_.bytes += size;
+    if (verbose_)
+    {
+        ACE_UINT32 ip = ntohl(peer->sin_addr.s_addr);
+        log_->log(LOG_PACKET, LM_DEBUG, "recv: No. = %d, IP = %u.%u.%u.%u, port = %d, bytes = %d\n",
+            recv_count_, (ip >> 24) & 0xff, (ip >> 16) & 0xff, (ip >> 8) & 0xff, ip & 0xff,
+            ntohs(peer->sin_port), (int)size);
+        log_->log(LOG_DATA, LM_INFO, "      data = %.*s\n", (int)size, payload);
+    }
 
-    //receive successfully
-    ACE_DEBUG((LM_DEBUG, "recv: No. = %d, host = %s, IP = %x, port = %d, bytes = %d\n",
-        ++recv_count, remote_addr.get_host_name(), remote_addr.get_ip_address(), 
-        remote_addr.get_port_number(), result));
-    ACE_DEBUG((LM_INFO, "      data = %s\n", buf));
+    if (sessions_ != NULL && sessions_->admit(*peer, size, sessions_->clock()) == -1)
+    {
+        ++stats_.throttled;
+        recycle_uring(bid);
+        return -1;
+    }
 
-    this->dgramt_.send(buf, result, remote_addr);
+    struct io_uring_sqe* sqe = get_sqe();
+    if (NULL == sqe)
+    {
+        ++stats_.send_errors;
+        recycle_uring(bid);
+        return -1;
+    }
 
+    send_msgs_[bid].msg_name = peer;
+    send_msgs_[bid].msg_namelen = out->namelen < recv_msg_.msg_namelen ? out->namelen : recv_msg_.msg_namelen;
+    send_iovs_[bid].iov_base = payload;
+    send_iovs_[bid].iov_len = size;
+    io_uring_prep_sendmsg(sqe, 0, &send_msgs_[bid], 0);
+    sqe->flags |= IOSQE_FIXED_FILE;
+    io_uring_sqe_set_data64(sqe, bid);
+    ++uring_sending_;
     return 0;
 }
 
+//give buffer bid back to the kernel
+void Handler::recycle_uring(int bid)
+{
+    io_uring_buf_ring_add(buf_ring_, uring_buffers_->slot(bid), PACKET_SIZE, bid, 
+        io_uring_buf_ring_mask(URING_BUFFERS), 0);
+    io_uring_buf_ring_advance(buf_ring_, 1);
+}
+#else
+int Handler::open_uring(void)
+{
+    ACE_ERROR_RETURN((LM_WARNING, "(%t) built without SERVER99_HAS_URING, use the reactor\n"), -1);
+}
+
+int Handler::run_uring(const ACE_Time_Value&)
+{
+    return -1;
+}
+
+void Handler::close_uring(void)
+{
+}
+#endif
+
 int Handler::handle_exception (ACE_HANDLE h)
 {
     if (ACE_INVALID_HANDLE == h)
     {
         ACE_DEBUG ((LM_INFO, ACE_TEXT ("(%t) handle_exception: handle the exit handler\n")));
-        exit_flag = 1;
-        recv_count = 0;  //to avoid the second calling notify, that is, to guarantee send notification only once
+        exit_flag_ = 1;
+        recv_count_ = 0;  //to avoid the second calling notify, that is, to guarantee send notification only once
     }
 
     return 0;
@@ -313,22 +4245,31 @@ int Handler::handle_exception (ACE_HANDLE h)
 
 //////////////////////////////////////////////////////////////////////////
 
-void show_menu() 
+void show_menu(const ServerOptions& options) 
 { 
     printf("---------------------------------------------\n"); 
     printf("input command to test the program\n"); 
     printf(" s or S : start the talker (ACE Task)\n"); 
+    printf(" t or T : start the talker in throughput mode (%d seconds)\n", options.duration); 
+    printf(" r or R : throughput mode plus the registration benchmark\n"); 
     printf(" q or Q : quit\n"); 
     printf("---------------------------------------------\n"); 
     printf("$ input command >"); 
 }
 
-void start_task()
+void start_task(ServerOptions& options)
 {
     ACE_DEBUG ((LM_INFO, ACE_TEXT ("(%t) main::start\n")));
 
-    mytask::instance()->open(0);
+    logtask::instance()->open(0);
+    Server server;
+    server.start(options);
+
+    //logtask runs until the shards (and task2) are done
+    server.wait();
+    logtask::instance()->stop();
     ACE_Thread_Manager::instance ()->wait ();
+    server.report();
 
     ACE_DEBUG ((LM_INFO, ACE_TEXT ("(%t) main::end\n\n")));
 }
@@ -337,14 +4278,125 @@ int ACE_TMAIN (int argc, ACE_TCHAR* argv[])
 {
     char sinput[10]; 
 
-    show_menu(); 
+    ServerOptions options;
+    options.daemon = 0;
+    options.port = UDP_PORT;
+    options.duration = -1;
+    options.threads = MyTask::MAX_USER_THREAD;
+    options.throughput = 0;
+    options.reactor_type = SELECT_REACTOR;
+    options.batch = 1;
+    options.queue_commands = 0;
+    options.register_bench = 0;
+    options.register_rate = REGISTER_RATE;
+    options.stats_port = 0;
+    options.busy_poll = 0;
+    options.cpu = -1;
+    options.tcp_connections = 0;
+    options.uring = 0;
+    options.pipeline = 0;
+    options.idle_timeout = 0;
+    options.session_rate = -1;
+
+    ACE_Get_Opt get_opt(argc, argv, ACE_TEXT("Dp:d:n:r:b:qR:S:P:C:T:UxI:L:"));
+    int c;
+    while ((c = get_opt()) != -1)
+    {
+        switch (c)
+        {
+        case 'D':
+            options.daemon = 1;
+            break;
+        case 'p':
+            options.port = (u_short)ACE_OS::atoi(get_opt.opt_arg());
+            break;
+        case 'd':
+            options.duration = ACE_OS::atoi(get_opt.opt_arg());
+            break;
+        case 'n':
+            options.threads = ACE_OS::atoi(get_opt.opt_arg());
+            break;
+        case 'r':
+            options.reactor_type = reactor_type(get_opt.opt_arg());
+            break;
+        case 'b':
+            options.batch = ACE_OS::atoi(get_opt.opt_arg());
+            break;
+        case 'q':
+            options.queue_commands = 1;
+            break;
+        case 'R':
+            options.register_rate = ACE_OS::atoi(get_opt.opt_arg());
+            break;
+        case 'S':
+            options.stats_port = (u_short)ACE_OS::atoi(get_opt.opt_arg());
+            break;
+        case 'P':
+            options.busy_poll = ACE_OS::atoi(get_opt.opt_arg());
+            break;
+        case 'C':
+            options.cpu = ACE_OS::atoi(get_opt.opt_arg());
+            break;
+        case 'T':
+            options.tcp_connections = ACE_OS::atoi(get_opt.opt_arg());
+            break;
+        case 'U':
+            options.uring = 1;
+            break;
+        case 'x':
+            options.pipeline = 1;
+            break;
+        case 'I':
+            options.idle_timeout = ACE_OS::atoi(get_opt.opt_arg());
+            break;
+        case 'L':
+            options.session_rate = ACE_OS::atoi(get_opt.opt_arg());
+            if (options.session_rate < 0)
+                options.session_rate = 0;
+            break;
+        default:
+            ACE_ERROR_RETURN((LM_ERROR, "usage: %s [-D] [-p port] [-n threads] [-d seconds] [-r select|epoll|tp] "
+                "[-b batch] [-q] [-R rate] [-S stats port] [-P usec] [-C cpu] [-T connections] [-U] [-x] "
+                "[-I seconds] [-L rate]\n", argv[0]), -1);
+        }
+    }
+
+    //headless: throughput mode until -d seconds are over or a signal comes in
+    if (options.daemon)
+    {
+        if (options.duration < 0)
+            options.duration = 0;
+        options.throughput = 1;
+        start_task(options);
+        return 0;
+    }
+
+    if (options.duration <= 0)
+        options.duration = THROUGHPUT_SECONDS;
+
+    show_menu(options); 
 
     scanf("%s",sinput); 
-    while(strcmp(sinput,"q")!=0) 
+    //the menu offers both cases
+    while(ACE_OS::strcasecmp(sinput,"q")!=0) 
     { 
-        if(strcmp(sinput,"s")==0) 
+        if(ACE_OS::strcasecmp(sinput,"s")==0) 
+        { 
+            options.throughput = 0;
+            options.register_bench = 0;
+            start_task(options);
+        } 
+        else if(ACE_OS::strcasecmp(sinput,"t")==0) 
+        { 
+            options.throughput = 1;
+            options.register_bench = 0;
+            start_task(options);
+        } 
+        else if(ACE_OS::strcasecmp(sinput,"r")==0) 
         { 
-            start_task();
+            options.throughput = 1;
+            options.register_bench = 1;
+            start_task(options);
         } 
 
         //input command 
@@ -0,0 +1,152 @@
+# build server99 and client99 against ACE (and liburing), then run every
+# mode of server99 for a few seconds under client99 and check that the
+# echoes come back and the server reports and shuts down as it should.
+# the outputs are in smoke_<name>.txt and server_smoke_<name>.txt, the
+# summary in smoke99_linux.txt; the script fails if one check fails.
+# both are built with -Wall -Wextra -Werror (the ACE headers are system
+# headers), and with URING=1 server99 is built without io_uring first, so
+# that both variants are checked.
+# settings: ACE_ROOT (ACE headers in $ACE_ROOT/ace, lib in $ACE_ROOT/lib),
+# URING (1: build with -DSERVER99_HAS_URING -luring), RATE (pkts/s),
+# DURATION (seconds), PORT, MAX_LOSS (percent), NOBUILD (1: use the binaries)
+
+ACE_ROOT=${ACE_ROOT:-/usr}
+URING=${URING:-0}
+RATE=${RATE:-2000}
+DURATION=${DURATION:-3}
+PORT=${PORT:-6540}
+MAX_LOSS=${MAX_LOSS:-1}
+NOBUILD=${NOBUILD:-0}
+
+RESULT=smoke99_linux.txt
+failed=0
+
+if [ "$NOBUILD" != "1" ]
+then
+    FLAGS="-g -O2 -Wall -Wextra -Werror -isystem $ACE_ROOT/include -isystem $ACE_ROOT -L$ACE_ROOT/lib"
+    echo "build server99 and client99 ..."
+    g++ $FLAGS -o server99 server99.cpp -lACE -lpthread || exit 1
+    if [ "$URING" = "1" ]
+    then
+        g++ $FLAGS -DSERVER99_HAS_URING -o server99 server99.cpp -luring -lACE -lpthread || exit 1
+    fi
+    g++ $FLAGS -o client99 client99.cpp -lACE -lpthread || exit 1
+fi
+
+echo "server99 smoke test, `date`, `uname -sr`, `nproc` cpus, uring $URING" > $RESULT
+
+# pass when the clients got their echoes back with at most MAX_LOSS percent
+# lost and the server log has the expected line and no error
+verdict()
+{
+    name=$1
+    expect=$2
+    problem=
+    received=`awk '/^received/ {print $3}' smoke_$name.txt`
+    loss=`awk '/^lost/ {sub("%", "", $5); print $5}' smoke_$name.txt`
+    if [ -z "$received" ] || [ "$received" -eq 0 ]
+    then
+        problem="no echo received"
+    elif awk -v loss=$loss -v max=$MAX_LOSS 'BEGIN {exit !(loss > max)}'
+    then
+        problem="$loss% lost"
+    elif [ -n "$expect" ] && ! grep -q -E "$expect" server_smoke_$name.txt
+    then
+        problem="no \"$expect\" in the server log"
+    elif grep -q -E "failed|can't|use the reactor|echoes not sent" server_smoke_$name.txt
+    then
+        problem="`grep -m 1 -E "failed|can't|use the reactor|echoes not sent" server_smoke_$name.txt`"
+    fi
+
+    if [ -z "$problem" ]
+    then
+        echo "    ok" ; echo "ok     $name: `grep latency smoke_$name.txt`" >> $RESULT
+    else
+        echo "    FAILED: $problem" ; echo "FAILED $name: $problem" >> $RESULT
+        failed=1
+    fi
+}
+
+# run name "expected server line" "server options" "client options"
+run()
+{
+    name=$1
+    expect=$2
+    echo "$name: server99 $3, client99 $4 ..."
+    ./server99 -D -p $PORT -d $((DURATION + 3)) $3 > server_smoke_$name.txt 2>&1 &
+    sleep 1
+    ./client99 -p $PORT -r $RATE -d $DURATION $4 > smoke_$name.txt 2>&1
+    wait
+    verdict $name "$expect"
+}
+
+echo -e "start the smoke test of server99\n"
+
+# the reactor backends, one thread and a SO_REUSEPORT pool (user-001, user-002)
+run select "total: 1 threads" "-r select -n 1" ""
+run epoll "total: 4 threads" "-r epoll -n 4" "-n 4 -c 16"
+run tp "total: 4 threads" "-r tp -n 4" "-n 4 -c 16"
+# one datagram per call and the default batch (user-003, user-004)
+run batch1 "total: .* batches 1:[1-9][0-9]* 2:0 " "-r epoll -b 1" ""
+# task2 through the command queue, many registrations (user-006)
+run queue "total:" "-q -R 100" ""
+# busy polling on a pinned thread (user-010)
+run busypoll "total:" "-P 200 -C 0" ""
+# TCP echo and idle timeout (user-011, user-015)
+run tcp "thread 0 tcp:" "-r epoll -T 100 -I 1" "-t -c 50"
+# io_uring, with URING=1 it must not fall back (user-012)
+if [ "$URING" = "1" ]
+then
+    run uring "total:" "-U -n 2" "-n 2 -c 8"
+fi
+# one shard per cpu (user-013)
+run percore "total: `nproc` threads" "-r epoll -n 0" "-n 4 -c 16"
+# the staged pipeline (user-014)
+run pipeline "thread 0 pipeline:" "-x" ""
+# the session table without a limit (user-016)
+run sessions "thread 0 sessions:" "-L 0" "-c 8"
+
+# SIGTERM ends the daemon without -d and it still reports (user-008)
+echo "sigterm: server99 -d 0, client99, kill -TERM ..."
+./server99 -D -p $PORT -d 0 > server_smoke_sigterm.txt 2>&1 &
+server=$!
+sleep 1
+./client99 -p $PORT -r $RATE -d $DURATION > smoke_sigterm.txt 2>&1
+kill -TERM $server
+for i in 1 2 3 4 5
+do
+    kill -0 $server 2>/dev/null || break
+    sleep 1
+done
+if kill -0 $server 2>/dev/null
+then
+    kill -KILL $server
+    echo "    FAILED: still running 5 s after SIGTERM" ; echo "FAILED sigterm: still running 5 s after SIGTERM" >> $RESULT
+    failed=1
+else
+    wait $server
+    verdict sigterm "signal received"
+fi
+
+# the stats socket answers a query (user-009)
+if which nc > /dev/null 2>&1
+then
+    echo "stats: server99 -S $((PORT + 1)), nc -u ..."
+    ./server99 -D -p $PORT -d $((DURATION + 3)) -S $((PORT + 1)) > server_smoke_stats.txt 2>&1 &
+    sleep 1
+    ./client99 -p $PORT -r $RATE -d $DURATION > smoke_stats.txt 2>&1 &
+    sleep 1
+    echo stats | nc -u -w 1 127.0.0.1 $((PORT + 1)) > reply_smoke_stats.txt
+    wait
+    verdict stats ""
+    if ! grep -q "total: packets" reply_smoke_stats.txt
+    then
+        echo "    FAILED: no reply" ; echo "FAILED stats: no reply on the stats port" >> $RESULT
+        failed=1
+    fi
+fi
+
+echo
+cat $RESULT
+[ $failed -eq 0 ] && echo "done. bye." || echo "smoke test FAILED"
+exit $failed